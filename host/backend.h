@@ -0,0 +1,52 @@
+/** Report transport interface (host side)
+
+    A backend moves whole HID reports between the host and the device.
+    Client runs reads on its own thread while the application writes, so
+    readReports() and writeReports() may be called concurrently.
+*/
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include "protocol.h"
+}
+
+namespace pic18usb {
+
+/** One interrupt report, IN or OUT */
+struct Report {
+    unsigned char data[PROTO_MAX_REPORT_SIZE];
+    std::size_t size;
+};
+
+class Backend {
+public:
+    virtual ~Backend() {}
+
+    /** Wait up to timeoutMs for IN reports and store up to max of them.
+        Returns the number of reports, 0 on timeout, -1 on error. */
+    virtual int readReports(Report *reports, int max, int timeoutMs) = 0;
+
+    /** Send OUT reports (PROTO_CMD_REPORT_SIZE bytes each) in one go.
+        Returns false on error. */
+    virtual bool writeReports(const Report *reports, int count) = 0;
+};
+
+/** Linux hidraw backend, e.g. /dev/hidraw0. Returns null on error. */
+std::unique_ptr<Backend> openHidraw(const std::string &path);
+
+#ifdef PIC18USB_HAVE_LIBUSB
+/** libusb backend, keeps transfersInFlight interrupt IN transfers
+    submitted so no polling interval is missed. Returns null on error. */
+std::unique_ptr<Backend> openLibusb(unsigned vendorId, unsigned productId,
+                                    int transfersInFlight = 8);
+#endif
+
+} // namespace pic18usb
+
+#endif /* BACKEND_H */
@@ -0,0 +1,126 @@
+/* Device client implementation (host side) */
+
+#include "client.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace pic18usb {
+
+namespace {
+
+/* Reports taken from the backend per call */
+const int READ_BATCH = 32;
+const int READ_TIMEOUT_MS = 100;
+const std::size_t ECHO_QUEUE_SIZE = 64;
+
+} // namespace
+
+Client::Client(Backend &backend, std::size_t queueSize)
+    : backend_(backend), samples_(queueSize), echoes_(ECHO_QUEUE_SIZE),
+      running_(false), reports_(0), decoded_(0), dropped_(0), lost_(0),
+      errors_(0)
+{
+}
+
+Client::~Client()
+{
+    stop();
+}
+
+void Client::start()
+{
+    if (!running_.exchange(true)) {
+        decoder_.reset();
+        thread_ = std::thread(&Client::run, this);
+    }
+}
+
+void Client::stop()
+{
+    if (running_.exchange(false)) {
+        thread_.join();
+    }
+}
+
+void Client::run()
+{
+    Report reports[READ_BATCH];
+    std::vector<statusType> decoded;
+
+    decoded.reserve(READ_BATCH * 256);
+    while (running_.load(std::memory_order_relaxed)) {
+        int count = backend_.readReports(reports, READ_BATCH, READ_TIMEOUT_MS);
+        if (count < 0) {
+            errors_++;
+            break;
+        }
+
+        decoded.clear();
+        for (int i = 0; i < count; i++) {
+            const Report &r = reports[i];
+            if ((r.size > 0) && (PROTO_RPT_ECHO == r.data[0])) {
+                (void)echoes_.push(r);
+                continue;
+            }
+            if (ReportDecoder::DECODE_BAD_REPORT ==
+                decoder_.decode(r.data, r.size, decoded)) {
+                errors_++;
+            }
+        }
+        reports_ += count;
+        lost_.store(decoder_.lostReports());
+
+        for (std::size_t i = 0; i < decoded.size(); i++) {
+            if (!samples_.push(decoded[i])) {
+                dropped_ += decoded.size() - i;
+                break;
+            }
+        }
+        decoded_ += decoded.size();
+    }
+}
+
+std::size_t Client::read(statusType *samples, std::size_t max)
+{
+    return samples_.pop(samples, max);
+}
+
+std::size_t Client::readEcho(Report *replies, std::size_t max)
+{
+    return echoes_.pop(replies, max);
+}
+
+void Client::queueCommand(const void *cmd, std::size_t size)
+{
+    Report report;
+
+    std::memset(report.data, 0, sizeof(report.data));
+    size = std::min<std::size_t>(size, PROTO_CMD_REPORT_SIZE);
+    std::memcpy(report.data, cmd, size);
+    report.size = PROTO_CMD_REPORT_SIZE;
+    commands_.push_back(report);
+}
+
+bool Client::flush()
+{
+    if (commands_.empty()) {
+        return true;
+    }
+    bool ok = backend_.writeReports(&commands_[0], commands_.size());
+    commands_.clear();
+    return ok;
+}
+
+Client::Stats Client::stats() const
+{
+    Stats s;
+    s.reports = reports_.load();
+    s.samples = decoded_.load();
+    s.dropped = dropped_.load();
+    s.lost = lost_.load();
+    s.errors = errors_.load();
+    return s;
+}
+
+} // namespace pic18usb
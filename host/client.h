@@ -0,0 +1,77 @@
+/** Device client (host side)
+
+    Reads reports on a background thread through a Backend, decodes the
+    telemetry reports and hands the samples to the application through a
+    lock-free queue. Echo replies (PROTO_RPT_ECHO) go to a queue of their
+    own. Commands are queued with queueCommand() and sent together by
+    flush().
+
+    The samples are consumed by one application thread; commands may be
+    queued and flushed from one (other) thread.
+*/
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "backend.h"
+#include "report_decoder.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace pic18usb {
+
+class Client {
+public:
+    struct Stats {
+        unsigned long reports; /**< IN reports read */
+        unsigned long samples; /**< Samples decoded */
+        unsigned long dropped; /**< Samples dropped, the queue was full */
+        unsigned long lost; /**< Reports lost before they reached the host */
+        unsigned long errors; /**< Malformed or undecodable reports */
+    };
+
+    /** The backend must outlive the client */
+    explicit Client(Backend &backend, std::size_t queueSize = 1 << 16);
+    ~Client();
+
+    /** Start and stop the reader thread */
+    void start();
+    void stop();
+
+    /** Take up to max decoded samples, without blocking */
+    std::size_t read(statusType *samples, std::size_t max);
+
+    /** Take up to max echo replies, without blocking */
+    std::size_t readEcho(Report *replies, std::size_t max);
+
+    /** Queue a command, padded to PROTO_CMD_REPORT_SIZE */
+    void queueCommand(const void *cmd, std::size_t size);
+
+    /** Send the queued commands in one backend call */
+    bool flush();
+
+    Stats stats() const;
+
+private:
+    void run();
+
+    Backend &backend_;
+    ReportDecoder decoder_;
+    SpscQueue<statusType> samples_;
+    SpscQueue<Report> echoes_;
+    std::vector<Report> commands_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::atomic<unsigned long> reports_;
+    std::atomic<unsigned long> decoded_;
+    std::atomic<unsigned long> dropped_;
+    std::atomic<unsigned long> lost_;
+    std::atomic<unsigned long> errors_;
+};
+
+} // namespace pic18usb
+
+#endif /* CLIENT_H */
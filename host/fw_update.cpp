@@ -0,0 +1,224 @@
+/* Firmware update tool (host side, Linux usbfs)
+
+   Sends an Intel HEX image to the device with the PROTO_VREQ_FW_*
+   vendor requests. Only the data inside the device's updatable region
+   (protocol.h) is sent; gaps are filled with 0xFF. Once the image has
+   been checked, the device is told to reset into it.
+
+   Usage: fw_update image.hex
+   Build: g++ -O2 -iquote ../src -o fw_update fw_update.cpp */
+
+extern "C" {
+#include "protocol.h"
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/usbdevice_fs.h>
+
+namespace {
+
+const unsigned VENDOR_ID = 0x04D8;
+const unsigned PRODUCT_ID = 0x0001;
+const unsigned TIMEOUT_MS = 1000;
+const int BLOCK_RETRIES = 3;
+
+const unsigned char REQ_VENDOR_OUT = 0x40;
+const unsigned char REQ_VENDOR_IN = 0xC0;
+
+unsigned short crc16(unsigned short crc, unsigned char data)
+{
+    crc ^= data << 8;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+unsigned readSysfs(const std::string &path)
+{
+    std::ifstream f(path.c_str());
+    unsigned value = 0;
+    f >> std::hex >> value;
+    return value;
+}
+
+/* Find the device in sysfs and open its usbfs node */
+int openDevice()
+{
+    DIR *dir = opendir("/sys/bus/usb/devices");
+    if (!dir) {
+        return -1;
+    }
+    int fd = -1;
+    while (dirent *ent = readdir(dir)) {
+        std::string base = std::string("/sys/bus/usb/devices/") + ent->d_name;
+        if ((readSysfs(base + "/idVendor") != VENDOR_ID) ||
+            (readSysfs(base + "/idProduct") != PRODUCT_ID)) {
+            continue;
+        }
+        std::ifstream bus((base + "/busnum").c_str());
+        std::ifstream dev((base + "/devnum").c_str());
+        unsigned busnum = 0, devnum = 0;
+        bus >> busnum;
+        dev >> devnum;
+        char node[64];
+        std::snprintf(node, sizeof(node), "/dev/bus/usb/%03u/%03u", busnum, devnum);
+        fd = open(node, O_RDWR);
+        break;
+    }
+    closedir(dir);
+    return fd;
+}
+
+int control(int fd, unsigned char type, unsigned char request,
+            unsigned short value, unsigned short index,
+            void *data, unsigned short length)
+{
+    usbdevfs_ctrltransfer xfer;
+    xfer.bRequestType = type;
+    xfer.bRequest = request;
+    xfer.wValue = value;
+    xfer.wIndex = index;
+    xfer.wLength = length;
+    xfer.timeout = TIMEOUT_MS;
+    xfer.data = data;
+    return ioctl(fd, USBDEVFS_CONTROL, &xfer);
+}
+
+int hexByte(const std::string &line, std::size_t pos)
+{
+    return std::strtoul(line.substr(pos, 2).c_str(), 0, 16);
+}
+
+/* Load the part of an Intel HEX file inside the update region */
+bool loadHex(const char *path, std::vector<unsigned char> &image, unsigned &used)
+{
+    std::ifstream f(path);
+    if (!f) {
+        return false;
+    }
+    image.assign(PROTO_FW_REGION_END - PROTO_FW_REGION_START, 0xFF);
+    used = 0;
+    unsigned long base = 0;
+    std::string line;
+    while (std::getline(f, line)) {
+        if ((line.size() < 11) || (line[0] != ':')) {
+            continue;
+        }
+        int count = hexByte(line, 1);
+        unsigned long addr = (hexByte(line, 3) << 8) | hexByte(line, 5);
+        int type = hexByte(line, 7);
+        if (type == 1) {
+            break;
+        }
+        if (type == 4) {
+            base = ((unsigned long)hexByte(line, 9) << 24) | (hexByte(line, 11) << 16);
+            continue;
+        }
+        if (type != 0) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            unsigned long a = base + addr + i;
+            /* Configuration words and EEPROM data are not updated */
+            if ((a < PROTO_FW_REGION_START) || (a >= PROTO_FW_REGION_END)) {
+                continue;
+            }
+            image[a - PROTO_FW_REGION_START] = hexByte(line, 9 + i * 2);
+            used = std::max<unsigned>(used, a - PROTO_FW_REGION_START + 1);
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s image.hex\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<unsigned char> image;
+    unsigned used;
+    if (!loadHex(argv[1], image, used)) {
+        std::perror(argv[1]);
+        return 1;
+    }
+    if (0 == used) {
+        std::fprintf(stderr, "%s: no data in 0x%04X-0x%04X\n", argv[1],
+                     PROTO_FW_REGION_START, PROTO_FW_REGION_END);
+        return 1;
+    }
+
+    int fd = openDevice();
+    if (fd < 0) {
+        std::fprintf(stderr, "device %04X:%04X not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+
+    unsigned first = PROTO_FW_REGION_START / PROTO_FW_BLOCK_SIZE;
+    unsigned count = (used + PROTO_FW_BLOCK_SIZE - 1) / PROTO_FW_BLOCK_SIZE;
+    if (control(fd, REQ_VENDOR_OUT, PROTO_VREQ_FW_BEGIN, first, count, 0, 0) < 0) {
+        std::perror("begin");
+        return 1;
+    }
+
+    unsigned short imageCrc = PROTO_FW_CRC_INIT;
+    for (unsigned n = 0; n < count; n++) {
+        unsigned char *block = &image[n * PROTO_FW_BLOCK_SIZE];
+        unsigned short crc = PROTO_FW_CRC_INIT;
+        for (unsigned i = 0; i < PROTO_FW_BLOCK_SIZE; i++) {
+            crc = crc16(crc, block[i]);
+            imageCrc = crc16(imageCrc, block[i]);
+        }
+        int tries = 0;
+        while (control(fd, REQ_VENDOR_OUT, PROTO_VREQ_FW_BLOCK, first + n, crc,
+                       block, PROTO_FW_BLOCK_SIZE) < 0) {
+            if (++tries >= BLOCK_RETRIES) {
+                std::perror("block");
+                return 1;
+            }
+        }
+        std::printf("\r%u/%u blocks", n + 1, count);
+        std::fflush(stdout);
+    }
+    std::printf("\n");
+
+    int endRet = control(fd, REQ_VENDOR_OUT, PROTO_VREQ_FW_END, imageCrc, 0, 0, 0);
+
+    fwStatusType status;
+    if (control(fd, REQ_VENDOR_IN, PROTO_VREQ_FW_STATUS, 0, 0,
+                &status, sizeof(status)) < 0) {
+        std::perror("status");
+        return 1;
+    }
+
+    std::printf("state %u, error %u, %u blocks written\n", status.state,
+                status.error, status.blocksWritten);
+    if ((endRet < 0) || (PROTO_FW_DONE != status.state)) {
+        close(fd);
+        return 1;
+    }
+
+    if (control(fd, REQ_VENDOR_OUT, PROTO_VREQ_FW_RUN, 0, 0, 0, 0) < 0) {
+        std::perror("run");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    std::printf("starting the new image\n");
+    return 0;
+}
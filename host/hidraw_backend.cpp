@@ -0,0 +1,83 @@
+/* hidraw backend implementation (host side) */
+
+/* The hidraw driver queues IN reports in the kernel, so reads are never
+   the bottleneck as long as the queue is drained often enough; every
+   call takes all the reports that are already there. */
+
+#include "backend.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace pic18usb {
+
+namespace {
+
+class HidrawBackend : public Backend {
+public:
+    explicit HidrawBackend(int fd) : fd_(fd) {}
+    ~HidrawBackend() { close(fd_); }
+
+    int readReports(Report *reports, int max, int timeoutMs)
+    {
+        pollfd pfd = {fd_, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeoutMs);
+        if (ret <= 0) {
+            return ret;
+        }
+
+        int count = 0;
+        while (count < max) {
+            ssize_t n = read(fd_, reports[count].data, sizeof(reports[count].data));
+            if (n < 0) {
+                if ((EAGAIN == errno) || (EINTR == errno)) {
+                    /* The kernel queue is empty */
+                    break;
+                }
+                /* ENODEV once the device is unplugged: poll() keeps
+                   returning at once, so report the error to stop the
+                   reader. The reports already taken go out first. */
+                return (count > 0) ? count : -1;
+            }
+            reports[count].size = n;
+            count++;
+        }
+        return count;
+    }
+
+    bool writeReports(const Report *reports, int count)
+    {
+        unsigned char buf[1 + PROTO_MAX_REPORT_SIZE];
+
+        for (int i = 0; i < count; i++) {
+            /* Report ID 0, then the report */
+            buf[0] = 0;
+            std::copy(reports[i].data, reports[i].data + reports[i].size, buf + 1);
+            ssize_t size = reports[i].size + 1;
+            if (write(fd_, buf, size) != size) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    int fd_;
+};
+
+} // namespace
+
+std::unique_ptr<Backend> openHidraw(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return std::unique_ptr<Backend>();
+    }
+    return std::unique_ptr<Backend>(new HidrawBackend(fd));
+}
+
+} // namespace pic18usb
@@ -0,0 +1,191 @@
+/* End-to-end latency probe (host side, Linux hidraw)
+
+   Sends PROTO_CMD_ECHO probes on the interrupt OUT endpoint, waits for
+   each PROTO_RPT_ECHO reply and prints latency percentiles. With the
+   device's frame and timer stamps, each round trip is split into:
+
+     firmware   probe received to reply handed to the SIE
+     IN wait    reply handed to the SIE to collected by the host
+     host+OUT   the rest: host stack, OUT transfer, waking up the reader
+
+   The IN wait of a reply is reported with the next reply, so it is not
+   known for the last probe.
+
+   Usage: latency_probe /dev/hidrawN [count]
+   Build: g++ -O2 -iquote ../src -o latency_probe latency_probe.cpp */
+
+extern "C" {
+#include "protocol.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace {
+
+const int REPLY_TIMEOUT_MS = 1000;
+const unsigned FRAME_MASK = 0x7FF; /* UFRM is 11 bits */
+
+/* The latency timer wraps every 43 ms; longer intervals are measured in
+   frames */
+const unsigned TICKS_WRAP_FRAMES = 40;
+
+unsigned get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+struct Stamp {
+    unsigned frame;
+    unsigned ticks;
+};
+
+double elapsedMs(const Stamp &from, const Stamp &to)
+{
+    unsigned frames = (to.frame - from.frame) & FRAME_MASK;
+    if (frames < TICKS_WRAP_FRAMES) {
+        return ((to.ticks - from.ticks) & 0xFFFF) /
+               (double)PROTO_ECHO_TICKS_PER_MS;
+    }
+    return frames;
+}
+
+struct Reply {
+    unsigned tag;
+    Stamp rx;
+    Stamp tx;
+    unsigned prevTag;
+    Stamp prevDone;
+};
+
+Reply parseReply(const unsigned char *buf)
+{
+    Reply r;
+    r.tag = get16(buf + offsetof(echoReplyType, tag));
+    r.rx.frame = get16(buf + offsetof(echoReplyType, rxFrame));
+    r.rx.ticks = get16(buf + offsetof(echoReplyType, rxTicks));
+    r.tx.frame = get16(buf + offsetof(echoReplyType, txFrame));
+    r.tx.ticks = get16(buf + offsetof(echoReplyType, txTicks));
+    r.prevTag = get16(buf + offsetof(echoReplyType, prevTag));
+    r.prevDone.frame = get16(buf + offsetof(echoReplyType, prevDoneFrame));
+    r.prevDone.ticks = get16(buf + offsetof(echoReplyType, prevDoneTicks));
+    return r;
+}
+
+void printPercentiles(const char *name, std::vector<double> &v)
+{
+    if (v.empty()) {
+        std::printf("%-10s no samples\n", name);
+        return;
+    }
+    std::sort(v.begin(), v.end());
+    const double pct[] = {50, 90, 99, 99.9};
+    std::printf("%-10s", name);
+    for (double p : pct) {
+        std::size_t i = (std::size_t)(p / 100 * (v.size() - 1) + 0.5);
+        std::printf("  p%-4g %7.3f", p, v[i]);
+    }
+    std::printf("  max %7.3f ms\n", v.back());
+}
+
+/* Wait for the reply to tag, skipping telemetry reports */
+bool readReply(int fd, unsigned tag, Reply &reply)
+{
+    unsigned char buf[PROTO_MAX_REPORT_SIZE];
+    pollfd pfd = {fd, POLLIN, 0};
+
+    for (;;) {
+        int ret = poll(&pfd, 1, REPLY_TIMEOUT_MS);
+        if (ret <= 0) {
+            return false;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            return false;
+        }
+        if ((n < (ssize_t)sizeof(echoReplyType)) || (PROTO_RPT_ECHO != buf[0])) {
+            continue;
+        }
+        reply = parseReply(buf);
+        if (reply.tag == tag) {
+            return true;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s /dev/hidrawN [count]\n", argv[0]);
+        return 1;
+    }
+    unsigned count = (argc > 2) ? std::strtoul(argv[2], 0, 0) : 10000;
+
+    int fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<double> rtt, firmware, inWait, rest;
+    Reply last = Reply(); /* The previous probe, its IN wait is still unknown */
+    double lastRtt = 0;
+    bool haveLast = false;
+    unsigned lost = 0;
+
+    for (unsigned i = 0; i < count; i++) {
+        unsigned tag = i & 0xFFFF;
+        /* Report ID 0, then the OUT report */
+        unsigned char cmd[1 + PROTO_CMD_REPORT_SIZE] = {0};
+        cmd[1 + offsetof(echoCommandType, cmd)] = PROTO_CMD_ECHO;
+        cmd[1 + offsetof(echoCommandType, tag)] = tag & 0xFF;
+        cmd[1 + offsetof(echoCommandType, tag) + 1] = tag >> 8;
+
+        auto start = std::chrono::steady_clock::now();
+        if (write(fd, cmd, sizeof(cmd)) != (ssize_t)sizeof(cmd)) {
+            std::perror("write");
+            return 1;
+        }
+        Reply reply;
+        if (!readReply(fd, tag, reply)) {
+            lost++;
+            haveLast = false;
+            continue;
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+        double fw = elapsedMs(reply.rx, reply.tx);
+        rtt.push_back(ms);
+        firmware.push_back(fw);
+
+        /* This reply completes the previous probe */
+        if (haveLast && (reply.prevTag == last.tag)) {
+            double wait = elapsedMs(last.tx, reply.prevDone);
+            inWait.push_back(wait);
+            rest.push_back(lastRtt - elapsedMs(last.rx, last.tx) - wait);
+        }
+        last = reply;
+        lastRtt = ms;
+        haveLast = true;
+    }
+    close(fd);
+
+    std::printf("%u probes, %u lost\n", count, lost);
+    printPercentiles("round trip", rtt);
+    printPercentiles("firmware", firmware);
+    printPercentiles("IN wait", inWait);
+    printPercentiles("host+OUT", rest);
+    return 0;
+}
@@ -0,0 +1,171 @@
+/* libusb backend implementation (host side)
+
+   Build with -DPIC18USB_HAVE_LIBUSB and link with -lusb-1.0. */
+
+/* Several interrupt IN transfers are kept submitted, so the host
+   controller always has one queued for the next polling interval, even
+   while completed ones are being handed to the caller. Completions are
+   collected by libusb_handle_events on the reading thread; writes are
+   synchronous transfers, which libusb allows from another thread. */
+
+#ifdef PIC18USB_HAVE_LIBUSB
+
+#include "backend.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <libusb-1.0/libusb.h>
+
+namespace pic18usb {
+
+namespace {
+
+const unsigned char EP_IN = 0x81;
+const unsigned char EP_OUT = 0x01;
+const unsigned WRITE_TIMEOUT_MS = 1000;
+
+class LibusbBackend : public Backend {
+public:
+    LibusbBackend() : ctx_(0), handle_(0), pending_(0), error_(false) {}
+
+    ~LibusbBackend()
+    {
+        for (std::size_t i = 0; i < transfers_.size(); i++) {
+            libusb_cancel_transfer(transfers_[i]);
+        }
+        /* Let the cancellations complete before freeing the transfers */
+        while (pending_ > 0) {
+            libusb_handle_events(ctx_);
+        }
+        for (std::size_t i = 0; i < transfers_.size(); i++) {
+            libusb_free_transfer(transfers_[i]);
+        }
+        if (handle_) {
+            libusb_release_interface(handle_, 0);
+            libusb_close(handle_);
+        }
+        if (ctx_) {
+            libusb_exit(ctx_);
+        }
+    }
+
+    bool open(unsigned vendorId, unsigned productId, int transfersInFlight)
+    {
+        if (0 != libusb_init(&ctx_)) {
+            return false;
+        }
+        handle_ = libusb_open_device_with_vid_pid(ctx_, vendorId, productId);
+        if (!handle_) {
+            return false;
+        }
+        libusb_set_auto_detach_kernel_driver(handle_, 1);
+        if (0 != libusb_claim_interface(handle_, 0)) {
+            return false;
+        }
+
+        buffers_.resize(transfersInFlight);
+        pending_ = 0;
+        for (int i = 0; i < transfersInFlight; i++) {
+            libusb_transfer *t = libusb_alloc_transfer(0);
+            libusb_fill_interrupt_transfer(t, handle_, EP_IN, buffers_[i].data,
+                                           sizeof(buffers_[i].data),
+                                           &LibusbBackend::completed, this, 0);
+            transfers_.push_back(t);
+            if (0 != libusb_submit_transfer(t)) {
+                return false;
+            }
+            pending_++;
+        }
+        return true;
+    }
+
+    int readReports(Report *reports, int max, int timeoutMs)
+    {
+        if (done_.empty()) {
+            timeval tv = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+            if (0 != libusb_handle_events_timeout_completed(ctx_, &tv, 0)) {
+                return -1;
+            }
+        }
+        if (error_) {
+            return -1;
+        }
+
+        int count = std::min<int>(max, done_.size());
+        std::copy(done_.begin(), done_.begin() + count, reports);
+        done_.erase(done_.begin(), done_.begin() + count);
+        return count;
+    }
+
+    bool writeReports(const Report *reports, int count)
+    {
+        for (int i = 0; i < count; i++) {
+            int sent;
+            if ((0 != libusb_interrupt_transfer(handle_, EP_OUT,
+                                                 const_cast<unsigned char *>(reports[i].data),
+                                                 reports[i].size, &sent,
+                                                 WRITE_TIMEOUT_MS)) ||
+                (sent != (int)reports[i].size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static void LIBUSB_CALL completed(libusb_transfer *t)
+    {
+        LibusbBackend *self = static_cast<LibusbBackend *>(t->user_data);
+
+        switch (t->status) {
+        case LIBUSB_TRANSFER_COMPLETED: {
+            Report report;
+            report.size = t->actual_length;
+            std::copy(t->buffer, t->buffer + t->actual_length, report.data);
+            self->done_.push_back(report);
+            break;
+        }
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            break;
+        case LIBUSB_TRANSFER_CANCELLED:
+            self->pending_--;
+            return;
+        default:
+            self->error_ = true;
+            self->pending_--;
+            return;
+        }
+
+        /* Resubmit right away to keep the queue full */
+        if (0 != libusb_submit_transfer(t)) {
+            self->error_ = true;
+            self->pending_--;
+        }
+    }
+
+    libusb_context *ctx_;
+    libusb_device_handle *handle_;
+    std::vector<Report> buffers_;
+    std::vector<libusb_transfer *> transfers_;
+    std::deque<Report> done_;
+    int pending_;
+    bool error_;
+};
+
+} // namespace
+
+std::unique_ptr<Backend> openLibusb(unsigned vendorId, unsigned productId,
+                                    int transfersInFlight)
+{
+    std::unique_ptr<LibusbBackend> backend(new LibusbBackend);
+    if (!backend->open(vendorId, productId, transfersInFlight)) {
+        return std::unique_ptr<Backend>();
+    }
+    return std::unique_ptr<Backend>(backend.release());
+}
+
+} // namespace pic18usb
+
+#endif /* PIC18USB_HAVE_LIBUSB */
@@ -0,0 +1,112 @@
+/* Mock backend implementation (host side) */
+
+#include "mock_backend.h"
+
+#include <cstring>
+
+namespace pic18usb {
+
+namespace {
+
+/* As in report.c */
+const unsigned KEY_INTERVAL = 16;
+
+unsigned zigzag(unsigned short diff)
+{
+    return (diff & 0x8000) ? ((~diff & 0xFFFF) << 1) | 1 : diff << 1;
+}
+
+unsigned varintBits(unsigned value)
+{
+    unsigned bits = PROTO_VARINT_BITS + 1;
+    for (value >>= PROTO_VARINT_BITS; value; value >>= PROTO_VARINT_BITS) {
+        bits += PROTO_VARINT_BITS + 1;
+    }
+    return bits;
+}
+
+} // namespace
+
+MockBackend::MockBackend(std::size_t reportSize)
+    : reportSize_(reportSize), bitPos_(0), seq_(0), reportsToKey_(0),
+      samples_(0), written_(0)
+{
+    std::memset(&prev_, 0, sizeof(prev_));
+    std::memset(&next_, 0, sizeof(next_));
+}
+
+void MockBackend::putBits(Report &report, unsigned value, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++, bitPos_++) {
+        report.data[bitPos_ >> 3] |= ((value >> i) & 1) << (bitPos_ & 7);
+    }
+}
+
+/* Fill a report with samples: a counter, a slow ramp and two constants */
+void MockBackend::encode(Report &report)
+{
+    bool key = (0 == reportsToKey_);
+    unsigned count = 0;
+
+    std::memset(report.data, 0, sizeof(report.data));
+    report.size = reportSize_;
+    bitPos_ = PROTO_HDR_SIZE * 8;
+    if (key) {
+        std::memset(&prev_, 0, sizeof(prev_));
+    }
+
+    for (;;) {
+        unsigned diff[PROTO_NUM_FIELDS];
+        unsigned changed = 0;
+        std::size_t bits = PROTO_NUM_FIELDS;
+
+        for (unsigned i = 0; i < PROTO_NUM_FIELDS; i++) {
+            diff[i] = zigzag((unsigned short)(next_.field[i] - prev_.field[i]));
+            if (diff[i]) {
+                changed |= 1u << i;
+                bits += varintBits(diff[i]);
+            }
+        }
+        if ((bitPos_ + bits > reportSize_ * 8) || (count == 0xFF)) {
+            break;
+        }
+
+        putBits(report, changed, PROTO_NUM_FIELDS);
+        for (unsigned i = 0; i < PROTO_NUM_FIELDS; i++) {
+            for (unsigned v = diff[i]; v; ) {
+                unsigned group = v & ((1u << PROTO_VARINT_BITS) - 1);
+                v >>= PROTO_VARINT_BITS;
+                putBits(report, group | (v ? PROTO_VARINT_CONT : 0),
+                        PROTO_VARINT_BITS + 1);
+            }
+        }
+        prev_ = next_;
+        count++;
+        samples_++;
+
+        next_.field[0]++;
+        next_.field[1] = (short)(samples_.load() >> 4);
+        next_.field[2] = 2;
+    }
+
+    report.data[0] = PROTO_RPT_TELEMETRY;
+    report.data[1] = (seq_++ & PROTO_HDR_SEQ_MASK) | (key ? PROTO_HDR_KEY : 0);
+    report.data[2] = count;
+    reportsToKey_ = key ? KEY_INTERVAL - 1 : reportsToKey_ - 1;
+}
+
+int MockBackend::readReports(Report *reports, int max, int)
+{
+    for (int i = 0; i < max; i++) {
+        encode(reports[i]);
+    }
+    return max;
+}
+
+bool MockBackend::writeReports(const Report *, int count)
+{
+    written_ += count;
+    return true;
+}
+
+} // namespace pic18usb
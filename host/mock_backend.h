@@ -0,0 +1,47 @@
+/** Mock backend (host side)
+
+    Produces telemetry reports in the firmware's format (report.c) from a
+    synthetic sample stream, as fast as they are read, and counts the
+    reports written to it. For tests and benchmarks without a device.
+*/
+
+#ifndef MOCK_BACKEND_H
+#define MOCK_BACKEND_H
+
+#include "backend.h"
+
+#include <atomic>
+
+namespace pic18usb {
+
+class MockBackend : public Backend {
+public:
+    /** reportSize: as set by the report profile (protocol.h) */
+    explicit MockBackend(std::size_t reportSize = PROTO_HIGH_REPORT_SIZE);
+
+    int readReports(Report *reports, int max, int timeoutMs);
+    bool writeReports(const Report *reports, int count);
+
+    /** Samples encoded so far */
+    unsigned long samplesSent() const { return samples_.load(); }
+
+    /** OUT reports received so far */
+    unsigned long reportsWritten() const { return written_.load(); }
+
+private:
+    void encode(Report &report);
+    void putBits(Report &report, unsigned value, unsigned count);
+
+    std::size_t reportSize_;
+    std::size_t bitPos_;
+    unsigned char seq_;
+    unsigned reportsToKey_;
+    statusType prev_;
+    statusType next_;
+    std::atomic<unsigned long> samples_;
+    std::atomic<unsigned long> written_;
+};
+
+} // namespace pic18usb
+
+#endif /* MOCK_BACKEND_H */
@@ -0,0 +1,55 @@
+/** Generated by tools/protogen.py from tools/protocol.schema, do not edit */
+
+#ifndef PROTOCOL_DECODE_H
+#define PROTOCOL_DECODE_H
+
+extern "C" {
+#include "protocol.h"
+}
+
+namespace pic18usb {
+
+struct FieldInfo {
+    const char *name;
+    unsigned bits;
+    bool isSigned;
+    double scale; /**< Raw value to unit */
+    const char *unit;
+};
+
+const FieldInfo sampleFields[PROTO_NUM_FIELDS] = {
+    {"counter", 16, false, 1.0, "count"},
+    {"temperature", 12, true, 0.0625, "degC"},
+    {"voltage", 10, false, 0.00489, "V"},
+    {"status", 4, false, 1.0, ""},
+    {"boot", 4, false, 1.0, ""},
+};
+
+/** Unpack a PROTO_SAMPLE_SIZE-byte sample feature report */
+inline void unpackSample(const unsigned char *buf, statusType &s)
+{
+    unsigned v;
+    v = buf[0] | (buf[1] << 8);
+    s.field[0] = (short)v;
+    v = (buf[2] | (buf[3] << 8)) & 0xFFF;
+    s.field[1] = (short)((v ^ 0x800) - 0x800);
+    v = ((buf[3] >> 4) | (buf[4] << 4)) & 0x3FF;
+    s.field[2] = (short)v;
+    v = ((buf[4] >> 6) | (buf[5] << 2)) & 0xF;
+    s.field[3] = (short)v;
+    v = ((buf[5] >> 2)) & 0xF;
+    s.field[4] = (short)v;
+}
+
+/** A field in its unit */
+inline double scaledField(const statusType &s, unsigned field)
+{
+    const FieldInfo &f = sampleFields[field];
+    int raw = f.isSigned ? s.field[field]
+                         : (unsigned short)s.field[field];
+    return raw * f.scale;
+}
+
+} // namespace pic18usb
+
+#endif /* PROTOCOL_DECODE_H */
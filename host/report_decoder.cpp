@@ -0,0 +1,131 @@
+/* Telemetry report decoder implementation (host side) */
+
+#include "report_decoder.h"
+
+#include <cstring>
+
+namespace pic18usb {
+
+namespace {
+
+/* Reads the LSB-first bit stream of a report */
+class BitReader {
+public:
+    BitReader(const unsigned char *buf, std::size_t size)
+        : buf_(buf), bitPos_(0), bitSize_(size * 8) {}
+
+    bool get(unsigned count, unsigned &value)
+    {
+        if (bitPos_ + count > bitSize_) {
+            return false;
+        }
+        value = 0;
+        for (unsigned i = 0; i < count; i++) {
+            std::size_t pos = bitPos_ + i;
+            value |= ((buf_[pos >> 3] >> (pos & 7)) & 1u) << i;
+        }
+        bitPos_ += count;
+        return true;
+    }
+
+    bool getVarint(unsigned &value)
+    {
+        unsigned group;
+        unsigned shift = 0;
+
+        value = 0;
+        do {
+            if (!get(PROTO_VARINT_BITS + 1, group) || (shift >= 16)) {
+                return false;
+            }
+            value |= (group & ((1u << PROTO_VARINT_BITS) - 1)) << shift;
+            shift += PROTO_VARINT_BITS;
+        } while (0 != (group & PROTO_VARINT_CONT));
+        return true;
+    }
+
+private:
+    const unsigned char *buf_;
+    std::size_t bitPos_;
+    std::size_t bitSize_;
+};
+
+unsigned short unzigzag(unsigned value)
+{
+    return (unsigned short)((value >> 1) ^ (0u - (value & 1)));
+}
+
+} // namespace
+
+ReportDecoder::ReportDecoder()
+    : lost_(0)
+{
+    reset();
+}
+
+void ReportDecoder::reset()
+{
+    synced_ = false;
+    nextSeq_ = 0;
+    std::memset(&prev_, 0, sizeof(prev_));
+}
+
+ReportDecoder::Result ReportDecoder::decode(const unsigned char *report,
+                                            std::size_t size,
+                                            std::vector<statusType> &samples)
+{
+    if ((size < PROTO_HDR_SIZE) || (PROTO_RPT_TELEMETRY != report[0])) {
+        synced_ = false;
+        return DECODE_BAD_REPORT;
+    }
+
+    unsigned char seq = report[1] & PROTO_HDR_SEQ_MASK;
+    bool key = (0 != (report[1] & PROTO_HDR_KEY));
+    unsigned count = report[2];
+
+    if (synced_ && (seq != nextSeq_)) {
+        lost_ += (seq - nextSeq_) & PROTO_HDR_SEQ_MASK;
+        synced_ = false;
+    }
+    nextSeq_ = (seq + 1) & PROTO_HDR_SEQ_MASK;
+
+    if (key) {
+        std::memset(&prev_, 0, sizeof(prev_));
+    } else if (!synced_) {
+        return DECODE_SKIPPED;
+    }
+
+    /* Decode into a copy so a malformed report leaves no partial samples */
+    BitReader reader(report + PROTO_HDR_SIZE, size - PROTO_HDR_SIZE);
+    std::vector<statusType> decoded;
+    statusType sample = prev_;
+    decoded.reserve(count);
+
+    for (unsigned n = 0; n < count; n++) {
+        unsigned changed;
+        if (!reader.get(PROTO_NUM_FIELDS, changed)) {
+            synced_ = false;
+            return DECODE_BAD_REPORT;
+        }
+        for (unsigned i = 0; i < PROTO_NUM_FIELDS; i++) {
+            unsigned diff;
+            if (0 == (changed & (1u << i))) {
+                continue;
+            }
+            if (!reader.getVarint(diff)) {
+                synced_ = false;
+                return DECODE_BAD_REPORT;
+            }
+            sample.field[i] = (short)(unsigned short)(
+                (unsigned short)sample.field[i] + unzigzag(diff));
+        }
+        decoded.push_back(sample);
+    }
+
+    prev_ = sample;
+    synced_ = true;
+    samples.insert(samples.end(), decoded.begin(), decoded.end());
+    return DECODE_OK;
+}
+
+} // namespace pic18usb
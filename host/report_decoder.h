@@ -0,0 +1,51 @@
+/** Telemetry report decoder header (host side)
+
+    Decodes the interrupt IN reports produced by the firmware's report
+    encoder (report.c) back into statusType samples. The report format is
+    described in protocol.h.
+*/
+
+#ifndef REPORT_DECODER_H
+#define REPORT_DECODER_H
+
+#include <cstddef>
+#include <vector>
+
+extern "C" {
+#include "protocol.h"
+}
+
+namespace pic18usb {
+
+class ReportDecoder {
+public:
+    enum Result {
+        DECODE_OK, /**< Samples were appended */
+        DECODE_SKIPPED, /**< Not in sync; waiting for a key report */
+        DECODE_BAD_REPORT /**< Report is malformed; waiting for a key report */
+    };
+
+    ReportDecoder();
+
+    /** Forget the decoding state, e.g. after the device was reconfigured.
+        Reports are skipped until the next key report. */
+    void reset();
+
+    /** Decode one telemetry report, appending its samples to samples.
+        Reports of other types must not be passed in. */
+    Result decode(const unsigned char *report, std::size_t size,
+                  std::vector<statusType> &samples);
+
+    /** Number of reports lost, detected from sequence number gaps */
+    unsigned long lostReports() const { return lost_; }
+
+private:
+    bool synced_;
+    unsigned char nextSeq_;
+    statusType prev_;
+    unsigned long lost_;
+};
+
+} // namespace pic18usb
+
+#endif /* REPORT_DECODER_H */
@@ -0,0 +1,77 @@
+/* Sample snapshot tool (host side, Linux hidraw)
+
+   Reads the sample feature report (HID Get_Report) and prints every
+   telemetry field raw and in its unit, as described by
+   tools/protocol.schema.
+
+   Usage: snapshot /dev/hidrawN [count [interval ms]]
+   Build: g++ -O2 -iquote ../src -o snapshot snapshot.cpp */
+
+#include "protocol_decode.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/hidraw.h>
+
+namespace {
+
+bool readSample(int fd, statusType &s)
+{
+    /* Report ID 0, then the report */
+    unsigned char buf[1 + PROTO_SAMPLE_SIZE] = {0};
+
+    int n = ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf);
+    if (n < (int)sizeof(buf)) {
+        return false;
+    }
+    pic18usb::unpackSample(buf + 1, s);
+    return true;
+}
+
+void printSample(const statusType &s)
+{
+    for (unsigned i = 0; i < PROTO_NUM_FIELDS; i++) {
+        const pic18usb::FieldInfo &f = pic18usb::sampleFields[i];
+        std::printf("%s%s %g%s%s", i ? "  " : "", f.name,
+                    pic18usb::scaledField(s, i), *f.unit ? " " : "", f.unit);
+    }
+    std::printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s /dev/hidrawN [count [interval ms]]\n",
+                     argv[0]);
+        return 1;
+    }
+    unsigned count = (argc > 2) ? std::strtoul(argv[2], 0, 0) : 1;
+    unsigned interval = (argc > 3) ? std::strtoul(argv[3], 0, 0) : 100;
+
+    int fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        statusType s;
+        if (!readSample(fd, s)) {
+            std::perror("HIDIOCGFEATURE");
+            close(fd);
+            return 1;
+        }
+        printSample(s);
+        if (i + 1 < count) {
+            usleep(interval * 1000);
+        }
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/** Lock-free single-producer, single-consumer queue (host side)
+
+    One thread pushes and one thread pops; neither ever blocks or takes a
+    lock. The capacity is rounded up to a power of 2.
+*/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace pic18usb {
+
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(std::size_t capacity)
+        : head_(0), tail_(0)
+    {
+        std::size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        buf_.resize(size);
+        mask_ = size - 1;
+    }
+
+    /** Producer: append an item. Returns false if the queue is full. */
+    bool push(const T &item)
+    {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        buf_[head & mask_] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer: take up to max items. Returns the number taken. */
+    std::size_t pop(T *items, std::size_t max)
+    {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        std::size_t count = head_.load(std::memory_order_acquire) - tail;
+        if (count > max) {
+            count = max;
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            items[i] = buf_[(tail + i) & mask_];
+        }
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    std::vector<T> buf_;
+    std::size_t mask_;
+    /* Kept on separate cache lines so the two threads do not contend */
+    alignas(64) std::atomic<std::size_t> head_; /* Written by the producer */
+    alignas(64) std::atomic<std::size_t> tail_; /* Written by the consumer */
+};
+
+} // namespace pic18usb
+
+#endif /* SPSC_QUEUE_H */
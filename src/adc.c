@@ -0,0 +1,161 @@
+/* Telemetry acquisition implementation */
+
+/* The interrupt handler assembles a sample in adcSample and copies it to
+   the ring when complete, so the slot the consumer is reading is never
+   written. Head and tail are single bytes, each written by one side only,
+   so the ring needs no locking. */
+
+#include <p18f2550.h>
+
+#include "adc.h"
+
+#if (ADC_CFG_RING_SIZE > 128) || \
+    (0 != (ADC_CFG_RING_SIZE & (ADC_CFG_RING_SIZE - 1)))
+#error "ADC_CFG_RING_SIZE must be a power of 2 up to 128"
+#endif
+
+#define ADC_MASK (ADC_CFG_RING_SIZE - 1)
+
+/* Timer 3 at Fosc = 48 MHz: 12 MHz instruction clock / prescale 8 */
+#define ADC_TIMER_HZ 1500000L
+#define ADC_T3CON 0xB9 /* 16-bit, prescale 1:8, CCP2 on Timer 3, TMR3ON */
+#define ADC_PERIOD (ADC_TIMER_HZ / ADC_CFG_SAMPLE_RATE_HZ)
+
+#if (ADC_PERIOD > 65536L)
+#error "ADC_CFG_SAMPLE_RATE_HZ is too low for Timer 3"
+#endif
+
+#define ADC_CCP2CON 0x0B /* Compare mode, special event trigger */
+
+/* Right justified, 4 TAD acquisition time, TAD = 64 / Fosc */
+#define ADC_ADCON2 0x96
+
+/* Select a channel with the converter on */
+#define ADC_ADCON0(channel) ((unsigned char)(((channel) << 2) | 0x01))
+
+/* Read by the interrupt handler, so kept in RAM: a table read would
+   clobber TBLPTR under a table read in the main context */
+static const unsigned char adcChannels[ADC_CFG_NUM_CHANNELS] = ADC_CFG_CHANNELS;
+static const unsigned char adcFields[ADC_CFG_NUM_CHANNELS] = ADC_CFG_FIELDS;
+
+static statusType adcRing[ADC_CFG_RING_SIZE];
+static volatile unsigned char adcHead; /* Next sample to write */
+static volatile unsigned char adcTail; /* Next sample to read */
+
+static statusType adcSample; /* The sample being converted */
+static unsigned char adcIndex; /* Channel list entry being converted */
+static unsigned short adcSequence;
+static unsigned char adcBoot;
+static unsigned char adcLost; /* Samples were dropped since the last stored one */
+static unsigned int adcOverruns;
+static schedTaskId adcTask;
+
+void adcInit(schedTaskId task)
+{
+    adcTask = task;
+    adcSequence = 0;
+    adcStop();
+    adcHead = 0;
+    adcTail = 0;
+    adcLost = 0;
+    adcOverruns = 0;
+    ADCON1 = ADC_CFG_ADCON1;
+    ADCON2 = ADC_ADCON2;
+    ADCON0 = ADC_ADCON0(adcChannels[0]);
+}
+
+void adcSetBoot(unsigned char boot)
+{
+    adcBoot = boot;
+}
+
+void adcStart(void)
+{
+    unsigned int period = (unsigned int)(ADC_PERIOD - 1);
+
+    /* A sample cut short by adcStop() is started over, the ring and the
+       overrun state are left as they are */
+    adcStop();
+    adcIndex = 0;
+    ADCON0 = ADC_ADCON0(adcChannels[0]);
+
+    CCPR2H = (unsigned char)(period >> 8);
+    CCPR2L = (unsigned char)period;
+    TMR3H = 0;
+    TMR3L = 0;
+    PIR1bits.ADIF = 0;
+    PIE1bits.ADIE = 1;
+    CCP2CON = ADC_CCP2CON;
+    T3CON = ADC_T3CON;
+}
+
+void adcStop(void)
+{
+    T3CON = 0;
+    CCP2CON = 0;
+    PIE1bits.ADIE = 0;
+}
+
+statusType *adcPeek(void)
+{
+    if (adcHead == adcTail) {
+        return 0;
+    }
+    return &adcRing[adcTail & ADC_MASK];
+}
+
+void adcRelease(void)
+{
+    if (adcHead != adcTail) {
+        adcTail++;
+    }
+}
+
+unsigned int adcGetOverruns(void)
+{
+    unsigned int overruns;
+    unsigned char enabled = PIE1bits.ADIE;
+
+    /* Two bytes wide, mask the A/D interrupt while reading */
+    PIE1bits.ADIE = 0;
+    overruns = adcOverruns;
+    PIE1bits.ADIE = enabled;
+    return overruns;
+}
+
+/* The sample is complete, store it */
+void adcStore(void)
+{
+    adcSample.field[PROTO_FIELD_COUNTER] = adcSequence++;
+    adcSample.field[PROTO_FIELD_BOOT] = adcBoot;
+    if ((unsigned char)(adcHead - adcTail) >= ADC_CFG_RING_SIZE) {
+        adcLost = 1;
+        adcOverruns++;
+        return;
+    }
+    adcSample.field[PROTO_FIELD_STATUS] = adcLost ? PROTO_STATUS_OVERRUN : 0;
+    adcLost = 0;
+    adcRing[adcHead & ADC_MASK] = adcSample;
+    adcHead++;
+    schedPostEvent(adcTask);
+}
+
+void adcInterruptHandler(void)
+{
+    if (((unsigned char)1 == PIE1bits.ADIE) &&
+        ((unsigned char)1 == PIR1bits.ADIF)) {
+        PIR1bits.ADIF = 0;
+        adcSample.field[adcFields[adcIndex]] = ((unsigned int)ADRESH << 8) | ADRESL;
+        adcIndex++;
+        if (adcIndex < ADC_CFG_NUM_CHANNELS) {
+            ADCON0 = ADC_ADCON0(adcChannels[adcIndex]);
+            ADCON0bits.GO = 1;
+            return;
+        }
+
+        /* The next trigger starts on the first channel */
+        adcIndex = 0;
+        ADCON0 = ADC_ADCON0(adcChannels[0]);
+        adcStore();
+    }
+}
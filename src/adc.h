@@ -0,0 +1,69 @@
+/** Telemetry acquisition header
+
+    Samples are taken at a fixed rate, independent of the USB schedule.
+    CCP2 in compare mode with the special event trigger resets Timer 3 and
+    starts an A/D conversion every sample period; the A/D interrupt
+    handler then converts the remaining channels of the list back to back
+    (the acquisition time is inserted by the A/D module, ADCON2.ACQT).
+    Once the last channel is converted, the sample is stamped with its
+    sequence number and stored in a ring, and the consumer task is posted.
+
+    The ring is drained in the main context with adcPeek() and
+    adcRelease(). If it is full, the sample is dropped; the sequence
+    number still advances, and the next stored sample carries
+    PROTO_STATUS_OVERRUN.
+
+    Timer 3 and CCP2 are used by this module. adcInterruptHandler() must
+    be called from the high priority interrupt.
+*/
+
+#ifndef ADC_H
+#define ADC_H
+
+#include "protocol.h"
+#include "sched.h"
+
+/** Sample rate, at least 23 Hz (Timer 3 period) */
+#define ADC_CFG_SAMPLE_RATE_HZ 100
+
+/** Channel list: the A/D channels converted for each sample, in order,
+    and the statusType field each one is stored in */
+#define ADC_CFG_NUM_CHANNELS 2
+#define ADC_CFG_CHANNELS {0, 1}
+#define ADC_CFG_FIELDS {PROTO_FIELD_TEMPERATURE, PROTO_FIELD_VOLTAGE}
+
+/** ADCON1: AN0 and AN1 analog, references VSS and VDD. The channel pins
+    must be inputs (TRISA, the reset default). */
+#define ADC_CFG_ADCON1 0x0D
+
+/** Ring size in samples, a power of 2 up to 128 */
+#define ADC_CFG_RING_SIZE 16
+
+/** Set up the A/D converter and empty the ring. task is posted for every
+    stored sample. */
+void adcInit(schedTaskId task);
+
+/** Boot number stamped on the samples, see storeGetBoot() */
+void adcSetBoot(unsigned char boot);
+
+/** Start the conversion timer. The ring, the sample numbers and the
+    overrun count carry on from before adcStop(). */
+void adcStart(void);
+
+/** Stop the conversion timer. The samples in the ring are kept. */
+void adcStop(void);
+
+/** The oldest sample in the ring, or 0 if the ring is empty. The sample
+    stays in the ring, and valid, until adcRelease() is called. */
+statusType *adcPeek(void);
+
+/** Remove the oldest sample from the ring */
+void adcRelease(void);
+
+/** Number of samples dropped on overflow since adcInit() */
+unsigned int adcGetOverruns(void);
+
+/** Store conversion results, call from the interrupt handler */
+void adcInterruptHandler(void);
+
+#endif /* ADC_H */
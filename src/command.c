@@ -0,0 +1,186 @@
+/* Command input implementation */
+
+/* The ring is filled from the USB task and drained by the command task.
+   Both are scheduler tasks, so neither can preempt the other and the
+   ring indexes need no locking. */
+
+#include <p18f2550.h>
+
+#include "command.h"
+#include "sched.h"
+
+#include "string.h"
+
+/** Number of command slots, a power of 2 */
+#define CMD_CFG_RING_SLOTS 4
+
+/** Max number of registered commands */
+#define CMD_CFG_NUM_HANDLERS 4
+
+typedef struct {
+    unsigned char cmd;
+    cmdHandler handler;
+} cmdHandlerEntry;
+
+typedef struct {
+    char data[CMD_CFG_RING_SLOTS][PROTO_CMD_REPORT_SIZE];
+    unsigned char size[CMD_CFG_RING_SLOTS];
+    unsigned char head; /**< Next slot to fill */
+    unsigned char tail; /**< Next slot to dispatch */
+    char held; /**< A packet is left on the endpoint, the ring was full */
+    usbBdSyncVal sync; /**< Expected data toggle of the next packet */
+    schedTaskId task;
+    cmdHandlerEntry handlers[CMD_CFG_NUM_HANDLERS];
+    char numHandlers;
+    cmdStats stats;
+} cmdInternalState;
+
+static cmdInternalState cmdState;
+
+#define CMD_RING_COUNT() ((unsigned char)(cmdState.head - cmdState.tail))
+#define CMD_RING_SLOT(index) ((index) & (CMD_CFG_RING_SLOTS - 1))
+
+void cmdTask(void);
+
+usbError cmdInit(void)
+{
+    (void) memset((void *)&cmdState, 0, sizeof(cmdState));
+    cmdState.task = schedAddTask(cmdTask);
+    if (SCHED_NO_TASK == cmdState.task) {
+        return USB_ENOMEM;
+    }
+    return USB_SUCCESS;
+}
+
+usbError cmdRegister(unsigned char cmd, cmdHandler handler)
+{
+    cmdHandlerEntry *entry;
+
+    if (cmdState.numHandlers >= CMD_CFG_NUM_HANDLERS) {
+        return USB_ENOMEM;
+    }
+    entry = &cmdState.handlers[cmdState.numHandlers++];
+    entry->cmd = cmd;
+    entry->handler = handler;
+    return USB_SUCCESS;
+}
+
+/* Hand the endpoint BD back to the SIE */
+void cmdArm(void)
+{
+    usbBdHandle handle;
+
+    usbBdGetHandleForEndpoint(CMD_CFG_ENDPOINT, USB_ED_OUT, &handle);
+    usbBdSetSync(handle, USB_DTS_ON, cmdState.sync);
+    (void) usbBdReceive(handle);
+}
+
+void cmdStart(void)
+{
+    cmdState.head = 0;
+    cmdState.tail = 0;
+    cmdState.held = 0;
+    cmdState.sync = USB_DTS_DATA0;
+    cmdArm();
+}
+
+/* Copy the packet in the endpoint BD to the ring and re-arm the BD */
+usbError cmdTake(usbBdHandle handle)
+{
+    char *buf;
+    int size;
+    unsigned char slot;
+    usbError ret;
+
+    ret = usbBdGetBuf(handle, &buf, &size);
+    if (USB_SUCCESS != ret) {
+        return ret;
+    }
+    if (size > PROTO_CMD_REPORT_SIZE) {
+        size = PROTO_CMD_REPORT_SIZE;
+    }
+
+    slot = CMD_RING_SLOT(cmdState.head);
+    memcpy(cmdState.data[slot], buf, size);
+    cmdState.size[slot] = size;
+    cmdState.head++;
+    cmdState.stats.received++;
+
+    cmdState.sync = (USB_DTS_DATA0 == cmdState.sync) ? USB_DTS_DATA1 : USB_DTS_DATA0;
+    cmdArm();
+    return USB_SUCCESS;
+}
+
+usbError cmdHandleTransaction(usbBdHandle handle)
+{
+    if ((CMD_CFG_ENDPOINT != usbBdGetEndpoint(handle)) ||
+        (USB_ED_OUT != usbBdGetDirection(handle))) {
+        return USB_EBADPARM;
+    }
+
+    if (CMD_RING_COUNT() >= CMD_CFG_RING_SLOTS) {
+        /* Keep the packet in the BD; the host is NAKed until the
+           command task makes room */
+        cmdState.held = 1;
+        cmdState.stats.full++;
+        return USB_ENOMEM;
+    }
+
+    (void) cmdTake(handle);
+    schedPostEvent(cmdState.task);
+    return USB_SUCCESS;
+}
+
+usbError cmdEndpointReset(usbBdHandle handle)
+{
+    if ((CMD_CFG_ENDPOINT != usbBdGetEndpoint(handle)) ||
+        (USB_ED_OUT != usbBdGetDirection(handle))) {
+        return USB_EBADPARM;
+    }
+
+    /* A packet held in the BD was dropped with the halt */
+    cmdState.held = 0;
+    cmdState.sync = USB_DTS_DATA0;
+    cmdArm();
+    return USB_SUCCESS;
+}
+
+void cmdDispatch(const char *data, unsigned char size)
+{
+    char i;
+
+    if (0 == size) {
+        return;
+    }
+    for (i = 0; i < cmdState.numHandlers; i++) {
+        if (cmdState.handlers[i].cmd == (unsigned char)data[0]) {
+            (void) cmdState.handlers[i].handler(data, size);
+            return;
+        }
+    }
+    cmdState.stats.unknown++;
+}
+
+/* Scheduler task, dispatches the queued commands */
+void cmdTask(void)
+{
+    usbBdHandle handle;
+    unsigned char slot;
+
+    while (0 != CMD_RING_COUNT()) {
+        slot = CMD_RING_SLOT(cmdState.tail);
+        cmdDispatch(cmdState.data[slot], cmdState.size[slot]);
+        cmdState.tail++;
+
+        if (cmdState.held) {
+            cmdState.held = 0;
+            usbBdGetHandleForEndpoint(CMD_CFG_ENDPOINT, USB_ED_OUT, &handle);
+            (void) cmdTake(handle);
+        }
+    }
+}
+
+void cmdGetStats(cmdStats *stats)
+{
+    *stats = cmdState.stats;
+}
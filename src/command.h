@@ -0,0 +1,57 @@
+/** Command input header
+
+    Host commands arrive as interrupt OUT reports on CMD_CFG_ENDPOINT, see
+    protocol.h. Each received packet is copied to a ring of command slots
+    and the endpoint is re-armed right away, so the host is NAKed only
+    while the ring is full. The command task then dispatches the commands
+    to the handlers registered for their command byte.
+
+    Typical use: cmdInit() and cmdRegister() at startup, cmdStart() once
+    the device is configured, and cmdHandleTransaction() from the
+    USB_CB_TRANSACTION callback for OUT transactions on the endpoint.
+*/
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "usb.h"
+#include "usb_bd.h"
+#include "protocol.h"
+
+/** Endpoint the commands are received on */
+#define CMD_CFG_ENDPOINT 1
+
+/** Command handler, called from the command task with the whole OUT
+    report; data[0] is the command byte. */
+typedef usbError (*cmdHandler)(const char *data, unsigned char size);
+
+/** Command counters */
+typedef struct {
+    unsigned int received; /**< Commands taken from the endpoint */
+    unsigned int unknown; /**< Commands with no handler */
+    unsigned int full; /**< Packets held on the endpoint, ring full */
+} cmdStats;
+
+/** Add the command task to the scheduler. The endpoint is set up from
+    the configuration descriptor when the device is configured. */
+usbError cmdInit(void);
+
+/** Register the handler of a command */
+usbError cmdRegister(unsigned char cmd, cmdHandler handler);
+
+/** Flush the ring and arm the endpoint, called once configured */
+void cmdStart(void);
+
+/** Take a received packet off the endpoint. Returns USB_EBADPARM if the
+    handle is not the command endpoint's OUT BD. */
+usbError cmdHandleTransaction(usbBdHandle handle);
+
+/** Re-arm the endpoint at DATA0 once its halt is cleared, from the
+    USB_CB_ENDPOINT_RESET callback. The queued commands are kept. Returns
+    USB_EBADPARM if the handle is not the command endpoint. */
+usbError cmdEndpointReset(usbBdHandle handle);
+
+/** Get the command counters */
+void cmdGetStats(cmdStats *stats);
+
+#endif /* COMMAND_H */
@@ -1,5 +1,21 @@
 #include <p18f2550.h>
 #include "usb_ctl.h"
+#include "protocol.h"
+#include "descriptors.h"
+#include "usb_config.h"
+
+#if defined(PROTO_VENDOR_ENDPOINT) && \
+    (USB_CFG_MSOS20_VENDOR_CODE != PROTO_VREQ_MSOS20)
+#error "USB_CFG_MSOS20_VENDOR_CODE must be PROTO_VREQ_MSOS20"
+#endif
+
+/* With the vendor interface, the device reports USB 2.01 so that Windows
+   reads the BOS descriptor, then the Microsoft OS 2.0 descriptor set */
+#ifdef PROTO_VENDOR_ENDPOINT
+#define USB_BCD_VERSION 0x01, 0x02
+#else
+#define USB_BCD_VERSION 0x01, 0x01
+#endif
 
 #pragma romdata descriptor_table
 
@@ -7,77 +23,167 @@ const rom char usbDeviceDescriptor[] =
 {
     18, // Size in bytes
     1, // Device Descriptor
-    0x01, 0x01, // USB 1.1 compliant
+    USB_BCD_VERSION, // USB version (BCD)
     0, 0, 0, // Class/subclass/protocol
-    8, // EP0 max size
+    USB_CFG_EP0_BUFFER_SIZE, // EP0 max size
     0xD8, 0x04, // Vendor ID
     0x01, 0x00, // Product ID
     0x01, 0x00, // Device version (BCD)
-    0, // Manufacturer string
-    0, // Product string
-    0, // Serial number string
+    1, // Manufacturer string
+    2, // Product string
+    3, // Serial number string
     1  // Number of configurations
 };
 
-const rom char usbConfigurationDescriptor[] =
+/* String descriptors. The text is kept as 8-bit characters and expanded
+   to UTF-16LE when sent; the terminating NUL is not sent. */
+const rom char usbLanguageDescriptor[] =
+{
+    4, // Size in bytes
+    3, // String Descriptor
+    0x09, 0x04 // English (United States)
+};
+
+const rom char usbManufacturerString[] = "pic18usb";
+const rom char usbProductString[] = "PIC18F2550 Telemetry";
+
+/* The serial number is the hex dump of the last bytes of the data EEPROM,
+   programmed per device ("FFFFFFFF" if blank) */
+#define SERIAL_EEPROM_ADDR 0xFC
+#define SERIAL_EEPROM_BYTES 4
+
+/* The configuration and report descriptors depend on the report profile.
+   Both are generated from tools/protocol.schema, see protocol_gen.h. */
+const rom char usbHIDReportDescriptorLow[PROTO_HID_REPORT_DESCRIPTOR_SIZE] =
+    PROTO_HID_REPORT_DESCRIPTOR_LOW;
+
+const rom char usbHIDReportDescriptorHigh[PROTO_HID_REPORT_DESCRIPTOR_SIZE] =
+    PROTO_HID_REPORT_DESCRIPTOR_HIGH;
+
+/* The configuration descriptor is sent from fragments: only the HID
+   endpoints differ between profiles, the other blocks are shared */
+const rom char usbConfigurationHeader[] = PROTO_CONFIGURATION_HEADER;
+const rom char usbHIDInterface[] = PROTO_HID_INTERFACE;
+const rom char usbHIDEndpointsLow[] = PROTO_HID_ENDPOINTS_LOW;
+const rom char usbHIDEndpointsHigh[] = PROTO_HID_ENDPOINTS_HIGH;
+#ifdef PROTO_MSC_ENDPOINT
+const rom char usbMSCInterface[] = PROTO_MSC_INTERFACE_DESCRIPTORS;
+#define MSC_FRAGMENT \
+    , {USB_CTL_FROM_ROM, (char *)usbMSCInterface, sizeof(usbMSCInterface)}
+#else
+#define MSC_FRAGMENT
+#endif
+#ifdef PROTO_VENDOR_ENDPOINT
+const rom char usbVendorInterface[] = PROTO_VENDOR_INTERFACE_DESCRIPTORS;
+#define VENDOR_FRAGMENT \
+    , {USB_CTL_FROM_ROM, (char *)usbVendorInterface, sizeof(usbVendorInterface)}
+#else
+#define VENDOR_FRAGMENT
+#endif
+
+const rom usbCtlFragment usbConfigurationLow[] =
+{
+    {USB_CTL_FROM_ROM, (char *)usbConfigurationHeader, sizeof(usbConfigurationHeader)},
+    {USB_CTL_FROM_ROM, (char *)usbHIDInterface, sizeof(usbHIDInterface)},
+    {USB_CTL_FROM_ROM, (char *)usbHIDEndpointsLow, sizeof(usbHIDEndpointsLow)}
+    MSC_FRAGMENT
+    VENDOR_FRAGMENT
+};
+
+const rom usbCtlFragment usbConfigurationHigh[] =
 {
-    9, // Size in bytes
-    2, // Configuration Descriptor
-    34, 0, // Total size in bytes
-    1, // Number of interfaces
-    1, // Configuration index
-    0, // Configuration string
-    0x40, // Self-powered
-    50, // 100 mA power consumption
-
-    9, // Size in bytes
-    4, // Interface Descriptor
-    0, // Interface number
-    0, // Alternate setting number
-    1, // Number of endpoints, excluding EP0
-    3, // HID Class
-0, // Subclass
-0, // Protocol
-    0, // Interface string
-
-    9, // Size in bytes
-    0x21, // HID Descriptor
-    0x01, 0x01, // HID 1.1 Compliant
-    0, // Country code (0 = not localized)
-    1, // Number of subordinate descriptors
-    0x22, // Descriptor type (report)
-    0x15, 0x00, // Report descriptor size in bytes
+    {USB_CTL_FROM_ROM, (char *)usbConfigurationHeader, sizeof(usbConfigurationHeader)},
+    {USB_CTL_FROM_ROM, (char *)usbHIDInterface, sizeof(usbHIDInterface)},
+    {USB_CTL_FROM_ROM, (char *)usbHIDEndpointsHigh, sizeof(usbHIDEndpointsHigh)}
+    MSC_FRAGMENT
+    VENDOR_FRAGMENT
+};
+
+#define FRAGMENT_COUNT(list) (sizeof(list) / sizeof(usbCtlFragment))
 
+#ifdef PROTO_VENDOR_ENDPOINT
+/* Microsoft OS 2.0 descriptor set, generated from the vendor line of the
+   schema: WinUSB and the device interface GUID for the vendor interface */
+const rom char usbMsOs20DescriptorSet[PROTO_MSOS20_DESCRIPTOR_SET_SIZE] =
+    PROTO_MSOS20_DESCRIPTOR_SET;
+
+/* The BOS descriptor is sent from fragments, one per device capability,
+   so its wTotalLength is filled in */
+const rom char usbBosHeader[] =
+{
+    5, // Size in bytes
+    15, // BOS Descriptor
+    0, 0, // Total size in bytes, filled in when sent
+    2 // Number of device capabilities
+};
+
+const rom char usbUsb20Extension[] =
+{
     7, // Size in bytes
-    5, // Endpoint Descriptor
-    0x81, // Endpoint and direction. Bit 7: OUT=0, IN=1
-    3, // 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt
-    0x40, 0x00, // Max packet size (0-1023)
-    0x64 // Max polling latency, ms for Interrupt
+    16, // Device Capability Descriptor
+    2, // USB 2.0 Extension
+    0, 0, 0, 0 // No Link Power Management
 };
 
-const rom char usbHIDReportDescriptor[] = 
+const rom char usbMsOs20Platform[] =
 {
-    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined Page 1)
-    0x09, 0x01,                    // USAGE (Vendor Usage 1)
-    0xa1, 0x01,                    // COLLECTION (Application)
-    0x09, 0x02,                    //   USAGE (Vendor Usage 2)
-    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
-    0x95, 0x02,                    //   REPORT_COUNT (2)
-    0x75, 0x08,                    //   REPORT_SIZE (8)
-    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
-    0xc0                           // END_COLLECTION
+    28, // Size in bytes
+    16, // Device Capability Descriptor
+    5, // Platform
+    0, // Reserved
+    0xDF, 0x60, 0xDD, 0xD8, 0x89, 0x45, 0xC7, 0x4C, // MS OS 2.0 platform UUID
+    0x9C, 0xD2, 0x65, 0x9D, 0x9E, 0x64, 0x8A, 0x9F, // D8DD60DF-4589-4CC7-9CD2-659D9E648A9F
+    0x00, 0x00, 0x03, 0x06, // Windows 8.1 and later
+    (char)PROTO_MSOS20_DESCRIPTOR_SET_SIZE, PROTO_MSOS20_DESCRIPTOR_SET_SIZE >> 8,
+    PROTO_VREQ_MSOS20, // Vendor request code of the descriptor set
+    0 // No alternate enumeration
 };
 
+const rom usbCtlFragment usbBosDescriptor[] =
+{
+    {USB_CTL_FROM_ROM, (char *)usbBosHeader, sizeof(usbBosHeader)},
+    {USB_CTL_FROM_ROM, (char *)usbUsb20Extension, sizeof(usbUsb20Extension)},
+    {USB_CTL_FROM_ROM, (char *)usbMsOs20Platform, sizeof(usbMsOs20Platform)}
+};
+#endif
+
+/* Profile-independent descriptors. The profile descriptors are served
+   through the USB_CB_GET_DESCRIPTOR callback in main.c. */
 const rom usbCtlDescriptor usbCtlDescriptorList[] =
 {
     {1, 0, sizeof(usbDeviceDescriptor), (char *)usbDeviceDescriptor},
-    {2, 0, sizeof(usbConfigurationDescriptor), (char *)usbConfigurationDescriptor},
-    {0x22, 0, sizeof(usbHIDReportDescriptor), (char *)usbHIDReportDescriptor}
+    {3, 0, sizeof(usbLanguageDescriptor), (char *)usbLanguageDescriptor},
+    {3, 1, sizeof(usbManufacturerString) - 1, (char *)usbManufacturerString,
+     USB_CTL_FROM_ROM_STRING},
+    {3, 2, sizeof(usbProductString) - 1, (char *)usbProductString,
+     USB_CTL_FROM_ROM_STRING},
+    {3, 3, SERIAL_EEPROM_BYTES, (char *)SERIAL_EEPROM_ADDR,
+     USB_CTL_FROM_EEPROM_HEX}
+#ifdef PROTO_VENDOR_ENDPOINT
+    ,
+    {15, 0, FRAGMENT_COUNT(usbBosDescriptor), (char *)usbBosDescriptor,
+     USB_CTL_FROM_FRAGMENTS},
+    {USB_CTL_DESC_MSOS20, 0, sizeof(usbMsOs20DescriptorSet),
+     (char *)usbMsOs20DescriptorSet}
+#endif
 };
 
 const rom char usbCtlDescriptorCount = sizeof(usbCtlDescriptorList) / 
                                        sizeof(usbCtlDescriptor);
 
+/* Descriptors that depend on the report profile, indexed by profile */
+const rom usbCtlDescriptor hidProfileDescriptorList[PROTO_NUM_PROFILES][HID_PROFILE_DESCRIPTORS] =
+{
+    {
+        {2, 0, FRAGMENT_COUNT(usbConfigurationLow), (char *)usbConfigurationLow,
+         USB_CTL_FROM_FRAGMENTS},
+        {0x22, 0, sizeof(usbHIDReportDescriptorLow), (char *)usbHIDReportDescriptorLow}
+    },
+    {
+        {2, 0, FRAGMENT_COUNT(usbConfigurationHigh), (char *)usbConfigurationHigh,
+         USB_CTL_FROM_FRAGMENTS},
+        {0x22, 0, sizeof(usbHIDReportDescriptorHigh), (char *)usbHIDReportDescriptorHigh}
+    }
+};
+
 #pragma romdata
@@ -0,0 +1,15 @@
+/** Application descriptor tables */
+
+#ifndef DESCRIPTORS_H
+#define DESCRIPTORS_H
+
+#include "usb_ctl.h"
+#include "protocol.h"
+
+/** Configuration and HID report descriptors of a profile */
+#define HID_PROFILE_DESCRIPTORS 2
+
+/** Descriptors that depend on the report profile, indexed by profile */
+extern const rom usbCtlDescriptor hidProfileDescriptorList[PROTO_NUM_PROFILES][HID_PROFILE_DESCRIPTORS];
+
+#endif /* DESCRIPTORS_H */
@@ -0,0 +1,65 @@
+/* Latency probe implementation */
+
+#include <p18f2550.h>
+
+#include "echo.h"
+
+#include "string.h"
+
+/* Timer 1 runs at PROTO_ECHO_TICKS_PER_MS:
+   12 MHz instruction clock / prescale 8 = 1.5 MHz, wraps every 43 ms */
+#define ECHO_T1CON 0xB1 /* 16-bit reads, prescale 1:8, TMR1ON */
+
+typedef struct {
+    unsigned short tag;
+    unsigned short frame;
+    unsigned short ticks;
+} echoCollectedType;
+
+static echoCollectedType echoPrev;
+
+void echoInit(void)
+{
+    (void) memset((void *)&echoPrev, 0, sizeof(echoPrev));
+    TMR1H = 0;
+    TMR1L = 0;
+    T1CON = ECHO_T1CON;
+}
+
+void echoStamp(unsigned short *frame, unsigned short *ticks)
+{
+    unsigned char low, high;
+
+    /* With 16-bit reads (RD16), reading TMR1L latches TMR1H */
+    low = TMR1L;
+    *ticks = low | ((unsigned short)TMR1H << 8);
+    /* UFRMH is not latched: read it again and retry if the low byte
+       wrapped in between */
+    do {
+        high = UFRMH;
+        low = UFRML;
+    } while (high != UFRMH);
+    *frame = low | ((unsigned short)high << 8);
+}
+
+void echoReceived(unsigned short tag, echoReplyType *reply)
+{
+    reply->type = PROTO_RPT_ECHO;
+    reply->reserved = 0;
+    reply->tag = tag;
+    echoStamp(&reply->rxFrame, &reply->rxTicks);
+    reply->prevTag = echoPrev.tag;
+    reply->prevDoneFrame = echoPrev.frame;
+    reply->prevDoneTicks = echoPrev.ticks;
+}
+
+void echoSending(echoReplyType *reply)
+{
+    echoStamp(&reply->txFrame, &reply->txTicks);
+}
+
+void echoCollected(unsigned short tag)
+{
+    echoPrev.tag = tag;
+    echoStamp(&echoPrev.frame, &echoPrev.ticks);
+}
@@ -0,0 +1,31 @@
+/** Latency probe header
+
+    Stamps PROTO_CMD_ECHO probes with the USB frame number and the latency
+    timer (Timer 1), see protocol.h. The application passes received probes
+    to echoReceived(), stamps the reply with echoSending() right before
+    handing it to the SIE, and calls echoCollected() once the host has
+    read it.
+*/
+
+#ifndef ECHO_H
+#define ECHO_H
+
+#include "protocol.h"
+
+/** Start the latency timer */
+void echoInit(void);
+
+/** Read the frame number and the latency timer */
+void echoStamp(unsigned short *frame, unsigned short *ticks);
+
+/** Start a reply to a received probe */
+void echoReceived(unsigned short tag, echoReplyType *reply);
+
+/** Stamp a reply about to be sent */
+void echoSending(echoReplyType *reply);
+
+/** The host has collected the reply with the given tag. The time is
+    reported in the prev fields of the next reply. */
+void echoCollected(unsigned short tag);
+
+#endif /* ECHO_H */
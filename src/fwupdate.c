@@ -0,0 +1,475 @@
+/* Firmware update implementation */
+
+/* Blocks are received and written in order. Two RAM buffers are used in
+   turn: one is filled by the control transfer while the other waits for
+   the update task. A flash erase or write stalls the CPU for about 2 ms,
+   but not the SIE, so the next block keeps arriving in the meantime. If
+   both buffers are full once a block has arrived, its status stage is
+   held (usbCtlDeferStatus) until the task has written the oldest one, so
+   the host never sends a block without a free buffer. Flash is only
+   erased and written by the task, never from the control transfer.
+
+   The first block of the region holds the application's vectors. It is
+   erased by the task when the update begins, so an interrupted update
+   leaves no application to start, and kept in its own buffer until the
+   image CRC has been checked at the end. */
+
+#include <p18f2550.h>
+
+#include "fwupdate.h"
+#include "sched.h"
+
+#include "string.h"
+
+/** Flash write buffer size of the 2550 */
+#define FW_WRITE_SIZE 32
+
+#define FW_NUM_BUFFERS 2
+
+/* After PROTO_VREQ_FW_RUN, the device detaches once the status stage is
+   done, then resets */
+#define FW_RUN_DELAY_MS 10
+#define FW_RUN_DETACH_MS 200
+
+#if (PROTO_FW_REGION_START % PROTO_FW_BLOCK_SIZE) || \
+    (PROTO_FW_REGION_END % PROTO_FW_BLOCK_SIZE)
+#error "The update region must be aligned to PROTO_FW_BLOCK_SIZE"
+#endif
+
+/* The vectors below jump to literal addresses */
+#if (PROTO_FW_REGION_START != 0x4000) || (PROTO_FW_APP_FLAG_ADDRESS != 0x5F)
+#error "Update fwAppFlag and the vectors in main.c to the new layout"
+#endif
+
+#define FW_FIRST_BLOCK (PROTO_FW_REGION_START / PROTO_FW_BLOCK_SIZE)
+#define FW_END_BLOCK (PROTO_FW_REGION_END / PROTO_FW_BLOCK_SIZE)
+
+typedef struct {
+    char data[PROTO_FW_BLOCK_SIZE];
+    unsigned short block;
+    char full;
+} fwBuffer;
+
+typedef struct {
+    fwStatusType status;
+    unsigned short firstBlock;
+    unsigned short numBlocks;
+    unsigned short imageCrc;
+    fwBuffer buffers[FW_NUM_BUFFERS];
+    fwBuffer entry; /**< The first block, written last */
+    fwBuffer *receiving; /**< Buffer of the block in the data stage */
+    unsigned char fill; /**< Buffer receiving the next block */
+    unsigned char write; /**< Next buffer to write */
+    unsigned char deferred; /**< Request whose status stage is held */
+    unsigned char run; /**< PROTO_VREQ_FW_RUN steps done */
+    schedTaskId task;
+} fwInternalState;
+
+static fwInternalState fwState;
+
+/* Non-zero once the application runs, read by the interrupt vectors
+   before anything is saved, so it lives in access RAM at a fixed address
+   that neither the loader nor the application allocates */
+#pragma udata access fw_app_flag=0x5F
+near unsigned char fwAppFlag;
+#pragma udata
+
+void fwTask(void);
+
+usbError fwInit(void)
+{
+    (void) memset((void *)&fwState, 0, sizeof(fwState));
+    fwState.task = schedAddTask(fwTask);
+    if (SCHED_NO_TASK == fwState.task) {
+        return USB_ENOMEM;
+    }
+    return USB_SUCCESS;
+}
+
+unsigned short fwCrc16(unsigned short crc, unsigned char data)
+{
+    char i;
+
+    crc ^= (unsigned short)data << 8;
+    for (i = 0; i < 8; i++) {
+        if (0 != (crc & 0x8000)) {
+            crc = (crc << 1) ^ 0x1021;
+        } else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+void fwSetTablePtr(unsigned short address)
+{
+    TBLPTRU = 0;
+    TBLPTRH = address >> 8;
+    TBLPTRL = address & 0xFF;
+}
+
+void fwStartApplication(void)
+{
+    unsigned short vector;
+    char stay;
+    char i;
+
+    fwAppFlag = 0;
+
+    /* RB0 is analog (AN12) at reset. The pin and the pull-ups are put
+       back afterwards, the application finds them as after a reset. */
+    ADCON1 = 0x0F;
+    INTCON2bits.RBPU = 0;
+    for (i = 0; i < 100; i++) {
+        /* Let the pull-up charge the pin */
+    }
+    stay = ((unsigned char)0 == PORTBbits.RB0);
+    INTCON2bits.RBPU = 1;
+    ADCON1 = 0;
+
+    fwSetTablePtr(PROTO_FW_APP_RESET);
+    _asm TBLRDPOSTINC _endasm
+    vector = TABLAT;
+    _asm TBLRDPOSTINC _endasm
+    vector |= (unsigned short)TABLAT << 8;
+
+    if (stay || (0xFFFF == vector)) {
+        /* Stay in the loader */
+        return;
+    }
+
+    /* The application starts with an empty return stack, and never comes
+       back */
+    fwAppFlag = 1;
+    STKPTR = 0;
+    _asm goto 0x4000 _endasm
+}
+
+/* Run the flash unlock sequence and start the erase or write set up in
+   EECON1. The CPU stalls until it is done. */
+void fwStartWrite(void)
+{
+    unsigned char gie;
+
+    /* A data EEPROM write may be in progress (store.c) */
+    while ((unsigned char)1 == EECON1bits.WR) {
+    }
+    EECON1bits.EEPGD = 1;
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    gie = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    INTCONbits.GIE = gie;
+    EECON1bits.WREN = 0;
+}
+
+unsigned short fwCrcFlash(unsigned short crc, unsigned short address,
+                          unsigned int size)
+{
+    fwSetTablePtr(address);
+    while (0 != size--) {
+        _asm TBLRDPOSTINC _endasm
+        crc = fwCrc16(crc, TABLAT);
+    }
+    return crc;
+}
+
+unsigned short fwCrcRam(unsigned short crc, const char *data)
+{
+    char i;
+
+    for (i = 0; i < PROTO_FW_BLOCK_SIZE; i++) {
+        crc = fwCrc16(crc, data[i]);
+    }
+    return crc;
+}
+
+void fwFail(unsigned char error)
+{
+    fwState.status.state = PROTO_FW_FAILED;
+    fwState.status.error = error;
+}
+
+/* A request out of sequence ends the update, unless it has already
+   failed: the first error is kept */
+usbError fwOutOfSequence(void)
+{
+    if (PROTO_FW_FAILED != fwState.status.state) {
+        fwFail(PROTO_FW_ESTATE);
+    }
+    return USB_EBADSTATE;
+}
+
+void fwEraseBlock(unsigned short block)
+{
+    fwSetTablePtr(block * PROTO_FW_BLOCK_SIZE);
+    EECON1bits.FREE = 1;
+    fwStartWrite();
+}
+
+/* Erase, write and verify a block */
+void fwWriteBlock(fwBuffer *buf)
+{
+    unsigned short address = buf->block * PROTO_FW_BLOCK_SIZE;
+    char i, j;
+
+    fwEraseBlock(buf->block);
+
+    for (i = 0; i < PROTO_FW_BLOCK_SIZE; i += FW_WRITE_SIZE) {
+        fwSetTablePtr(address + i);
+        for (j = 0; j < FW_WRITE_SIZE; j++) {
+            TABLAT = buf->data[i + j];
+            _asm TBLWTPOSTINC _endasm
+        }
+        /* TBLPTR has to point into the written row */
+        fwSetTablePtr(address + i);
+        EECON1bits.FREE = 0;
+        fwStartWrite();
+    }
+
+    if (fwCrcRam(PROTO_FW_CRC_INIT, buf->data) !=
+        fwCrcFlash(PROTO_FW_CRC_INIT, address, PROTO_FW_BLOCK_SIZE)) {
+        fwFail(PROTO_FW_EVERIFY);
+    } else {
+        fwState.status.blocksWritten++;
+    }
+}
+
+/* Write the oldest received block */
+void fwWriteNext(void)
+{
+    fwBuffer *buf = &fwState.buffers[fwState.write];
+
+    if (buf->full) {
+        if (PROTO_FW_ACTIVE == fwState.status.state) {
+            fwWriteBlock(buf);
+        }
+        buf->full = 0;
+        fwState.write = (fwState.write + 1) % FW_NUM_BUFFERS;
+    }
+}
+
+/* Check the image, the first block from RAM and the others from flash,
+   then write the first block */
+usbError fwFinish(void)
+{
+    unsigned short crc;
+    unsigned short block;
+
+    if (PROTO_FW_ACTIVE != fwState.status.state) {
+        return USB_EBADSTATE;
+    }
+    if (!fwState.entry.full) {
+        fwFail(PROTO_FW_EIMAGE);
+        return USB_EBADDATA;
+    }
+
+    crc = fwCrcRam(PROTO_FW_CRC_INIT, fwState.entry.data);
+    for (block = 1; block < fwState.numBlocks; block++) {
+        crc = fwCrcFlash(crc, (fwState.firstBlock + block) * PROTO_FW_BLOCK_SIZE,
+                         PROTO_FW_BLOCK_SIZE);
+    }
+    if (crc != fwState.imageCrc) {
+        fwFail(PROTO_FW_EIMAGE);
+        return USB_EBADDATA;
+    }
+
+    fwWriteBlock(&fwState.entry);
+    if (PROTO_FW_ACTIVE != fwState.status.state) {
+        /* The first block did not verify, erase it again */
+        fwEraseBlock(fwState.firstBlock);
+        return USB_ERROR;
+    }
+    fwState.status.state = PROTO_FW_DONE;
+    return USB_SUCCESS;
+}
+
+/* PROTO_VREQ_FW_RUN: detach, then reset into the application */
+void fwRun(void)
+{
+    if (1 == fwState.run) {
+        fwState.run = 2;
+        usbPostEvent(USB_EV_DETACHED);
+        schedStartTimer(fwState.task, SCHED_MS(FW_RUN_DETACH_MS), 0);
+    } else {
+        Reset();
+    }
+}
+
+void fwTask(void)
+{
+    unsigned char request = fwState.deferred;
+    char i;
+
+    if (0 != fwState.run) {
+        fwRun();
+        return;
+    }
+
+    if ((PROTO_VREQ_FW_BEGIN == request) &&
+        (PROTO_FW_ACTIVE == fwState.status.state)) {
+        /* No application to start until the update is done */
+        fwEraseBlock(fwState.firstBlock);
+    }
+    for (i = 0; i < FW_NUM_BUFFERS; i++) {
+        fwWriteNext();
+    }
+
+    fwState.deferred = 0;
+    switch (request) {
+    case PROTO_VREQ_FW_BEGIN:
+    case PROTO_VREQ_FW_BLOCK:
+        usbCtlFinishStatus((PROTO_FW_ACTIVE == fwState.status.state) ?
+                           USB_SUCCESS : USB_ERROR);
+        break;
+
+    case PROTO_VREQ_FW_END:
+        usbCtlFinishStatus(fwFinish());
+        break;
+    }
+}
+
+/* Hold the status stage of the request until the update task has run */
+void fwDefer(unsigned char request)
+{
+    fwState.deferred = request;
+    usbCtlDeferStatus();
+    schedPostEvent(fwState.task);
+}
+
+usbError fwBegin(const usbCtlSetupPacket *setup)
+{
+    char i;
+
+    for (i = 0; i < FW_NUM_BUFFERS; i++) {
+        fwState.buffers[i].full = 0;
+    }
+    fwState.entry.full = 0;
+    fwState.fill = 0;
+    fwState.write = 0;
+    fwState.status.blocksWritten = 0;
+    fwState.status.error = PROTO_FW_OK;
+
+    if ((FW_FIRST_BLOCK != setup->data) || (0 == setup->index) ||
+        (setup->index > FW_END_BLOCK - FW_FIRST_BLOCK)) {
+        fwFail(PROTO_FW_ERANGE);
+        return USB_EBADPARM;
+    }
+    fwState.firstBlock = setup->data;
+    fwState.numBlocks = setup->index;
+    fwState.status.state = PROTO_FW_ACTIVE;
+    fwDefer(PROTO_VREQ_FW_BEGIN);
+    return USB_SUCCESS;
+}
+
+/* Setup stage of PROTO_VREQ_FW_BLOCK: pick a buffer for the data */
+usbError fwBlock(usbCtlRequest *req)
+{
+    unsigned short block = req->setup->data;
+    fwBuffer *buf;
+
+    if (PROTO_FW_ACTIVE != fwState.status.state) {
+        return fwOutOfSequence();
+    }
+    if ((block < fwState.firstBlock) ||
+        (block - fwState.firstBlock >= fwState.numBlocks) ||
+        (PROTO_FW_BLOCK_SIZE != req->setup->length)) {
+        fwFail(PROTO_FW_ERANGE);
+        return USB_EBADPARM;
+    }
+
+    if (fwState.firstBlock == block) {
+        buf = &fwState.entry;
+    } else {
+        buf = &fwState.buffers[fwState.fill];
+        if (buf->full) {
+            /* The host gave up on a held status stage, it tries again once
+               the task has written a buffer */
+            return USB_EBADSTATE;
+        }
+    }
+    buf->block = block;
+    fwState.receiving = buf;
+    req->data = buf->data;
+    req->size = PROTO_FW_BLOCK_SIZE;
+    return USB_SUCCESS;
+}
+
+usbError fwEnd(const usbCtlSetupPacket *setup)
+{
+    if (PROTO_FW_ACTIVE != fwState.status.state) {
+        return fwOutOfSequence();
+    }
+    fwState.imageCrc = setup->data;
+    fwDefer(PROTO_VREQ_FW_END);
+    return USB_SUCCESS;
+}
+
+usbError fwVendorRequest(usbCtlRequest *req)
+{
+    switch (req->setup->request) {
+    case PROTO_VREQ_FW_BEGIN:
+        return fwBegin(req->setup);
+
+    case PROTO_VREQ_FW_BLOCK:
+        return fwBlock(req);
+
+    case PROTO_VREQ_FW_END:
+        return fwEnd(req->setup);
+
+    case PROTO_VREQ_FW_STATUS:
+        req->source = USB_CTL_FROM_RAM;
+        req->data = (char *)&fwState.status;
+        req->size = sizeof(fwState.status);
+        return USB_SUCCESS;
+
+    case PROTO_VREQ_FW_RUN:
+        if (0 != fwState.run) {
+            /* Already starting */
+            return USB_EBADSTATE;
+        }
+        if (PROTO_FW_DONE != fwState.status.state) {
+            return fwOutOfSequence();
+        }
+        fwState.run = 1;
+        schedStartTimer(fwState.task, SCHED_MS(FW_RUN_DELAY_MS), 0);
+        return USB_SUCCESS;
+
+    default:
+        return USB_ENOIMP;
+    }
+}
+
+usbError fwVendorData(usbCtlRequest *req)
+{
+    fwBuffer *buf = fwState.receiving;
+
+    if (PROTO_VREQ_FW_BLOCK != req->setup->request) {
+        return USB_ENOIMP;
+    }
+
+    fwState.status.lastBlock = buf->block;
+    if (fwCrcRam(PROTO_FW_CRC_INIT, buf->data) != req->setup->index) {
+        /* Not fatal, the host sends the block again */
+        fwState.status.error = PROTO_FW_ECRC;
+        return USB_EBADDATA;
+    }
+
+    buf->full = 1;
+    if (&fwState.entry == buf) {
+        /* Written by fwFinish() */
+        return USB_SUCCESS;
+    }
+
+    fwState.fill = (fwState.fill + 1) % FW_NUM_BUFFERS;
+    if (fwState.buffers[fwState.fill].full) {
+        /* No room for the next block until the task has written one */
+        fwDefer(PROTO_VREQ_FW_BLOCK);
+    } else {
+        schedPostEvent(fwState.task);
+    }
+    return USB_SUCCESS;
+}
@@ -0,0 +1,46 @@
+/** Firmware update header
+
+    Reflashes the program memory over the control endpoint, using the
+    PROTO_VREQ_FW_* vendor requests (protocol.h). Each block is received
+    into one of two RAM buffers and written by the update task, so the
+    host can send the next block while the previous one is being erased
+    and written. Requests that must wait for flash to be written hold
+    their status stage until the task is done.
+
+    This firmware is the resident loader: it is linked below
+    PROTO_FW_REGION_START by 18f2550_loader.lkr, and only blocks of the
+    application region PROTO_FW_REGION_START - PROTO_FW_REGION_END are
+    accepted. At reset, fwStartApplication() jumps to the application if
+    one has been written; its interrupts go through the loader's vectors,
+    see protocol.h for the layout the application is linked with.
+*/
+
+#ifndef FWUPDATE_H
+#define FWUPDATE_H
+
+#include "usb.h"
+#include "usb_ctl.h"
+#include "protocol.h"
+
+/** Start the application, if one has been written and RB0 is not held
+    low. Called first thing at reset, it only returns to run the
+    loader. */
+void fwStartApplication(void);
+
+/** Non-zero while the application runs, see the interrupt vectors */
+extern near unsigned char fwAppFlag;
+
+/** Add the update task to the scheduler */
+usbError fwInit(void);
+
+/** Handle a vendor request (USB_CB_VENDOR_REQUEST). Returns USB_ENOIMP
+    if it is not a firmware update request. */
+usbError fwVendorRequest(usbCtlRequest *req);
+
+/** Handle the data stage of a vendor request (USB_CB_VENDOR_DATA) */
+usbError fwVendorData(usbCtlRequest *req);
+
+/** CRC-16 of a byte, see protocol.h */
+unsigned short fwCrc16(unsigned short crc, unsigned char data);
+
+#endif /* FWUPDATE_H */
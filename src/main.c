@@ -1,80 +1,477 @@
 #include <p18f2550.h>
 #include "usb.h"
 #include "usb_bd.h"
+#include "usb_ctl.h"
+#include "usb_chan.h"
+#include "sched.h"
 #include <stdio.h>
 #include <usart.h>
 #include <string.h>
 
 #include "protocol.h"
+#include "report.h"
+#include "descriptors.h"
+#include "echo.h"
+#include "command.h"
+#include "uart.h"
+#include "fwupdate.h"
+#include "adc.h"
+#include "msc.h"
+#include "vendor.h"
+#include "store.h"
 
 #pragma config WDT = OFF
-#define DATA_ENDPOINT_SIZE 32
 
-void CheckForUSBAttachDetach();
-unsigned char senseWaitCounter = 0;
-unsigned char sensePrevValue = 0;
+/* Telemetry is sampled at ADC_CFG_SAMPLE_RATE_HZ once configured. A report
+   is sent when it is full, or after STATUS_PERIOD_MS at the latest. */
+#define STATUS_PERIOD_MS 100
 
+/* On a profile change, the device disconnects REENUMERATE_DELAY_MS after
+   the request (once its status stage is done) for REENUMERATE_DETACH_MS */
+#define REENUMERATE_DELAY_MS 10
+#define REENUMERATE_DETACH_MS 200
+
+/* The device is self-powered, it draws nothing from VBUS while the bus
+   is suspended. Only a bus-powered device has to sleep then: Sleep mode
+   stops the scheduler tick, and with it the VBUS sensing that sees a
+   detach during the suspend. */
+#define POWER_STATE USB_POWER_SELF
+
+/* HID class request Get_Report, wValue = report type << 8 | report ID,
+   wIndex = interface */
+#define HID_INTERFACE 0
+#define HID_REQ_GET_REPORT 1
+#define HID_REPORT_TYPE_FEATURE 3
+
+void high_isr(void);
+void SampleTask(void);
+void StatusTask(void);
+void ReenumerateTask(void);
+void AlarmTask(void);
+unsigned char configured = 0;
+
+/* Report profile, see protocol.h */
+const rom unsigned char profileReportSize[PROTO_NUM_PROFILES] =
+{
+    PROTO_LOW_REPORT_SIZE,
+    PROTO_HIGH_REPORT_SIZE
+};
+unsigned char profile = PROTO_PROFILE_LOW;
+unsigned char newProfile = PROTO_PROFILE_LOW;
+schedTaskId reenumerateTask;
+schedTaskId sampleTask;
+schedTaskId alarmTask;
+unsigned char reenumerateDetached = 0;
+
+#ifdef PROTO_MSC_ENDPOINT
+/* Files of the mass storage volume, LOG.BIN is the stored samples */
+const rom mscFile mscFileList[] =
+{
+    {"LOG     BIN", MSC_FROM_EEPROM, STORE_CFG_EEPROM_START, STORE_CFG_EEPROM_SIZE},
+    {"FIRMWAREBIN", MSC_FROM_ROM, PROTO_FW_REGION_START,
+     PROTO_FW_REGION_END - PROTO_FW_REGION_START}
+};
+
+const rom char mscFileCount = sizeof(mscFileList) / sizeof(mscFile);
+#endif
+
+/* The latest sample taken from the ring */
 statusType statusBuf;
 
-void CheckForUSBAttachDetach() 
+/* The sample feature report, packed on Get_Report. The data stage is sent
+   from this buffer, so it is not packed in place from statusBuf. */
+unsigned char sampleReport[PROTO_SAMPLE_SIZE];
+
+/* The report being encoded. Once finished, it is pending until EP1 IN
+   is free to take it. */
+char reportBuf[PROTO_MAX_REPORT_SIZE];
+unsigned char reportPending = 0;
+
+/* A latency probe reply waiting for EP1 IN, and the tag of the probe
+   reply the SIE is sending, if any */
+echoReplyType echoReply;
+unsigned char echoPending = 0;
+unsigned char echoInFlight = 0;
+unsigned short echoInFlightTag;
+echoReplyType echoCtlReply;
+
+/* The halt counters, copied when the host reads them */
+usbHaltStats haltStats;
+
+#ifdef PROTO_VENDOR_ENDPOINT
+/* The vendor interface counters, copied when the host reads them */
+vndStats vendorStats;
+#endif
+
+/* The interrupt vectors pass interrupts on to the application once it
+   runs (fwupdate.h). The flag is tested in access RAM, nothing has been
+   saved yet. The loader only uses high priority interrupts, so the low
+   priority vector is only reached by the application. */
+#pragma code high_vector=0x08
+void high_vector(void)
 {
-  unsigned char senseValue;
+  _asm
+    btfsc fwAppFlag, 0, 0
+    goto 0x4008
+    goto high_isr
+  _endasm
+}
 
-  /* If the USB sense pin recently changed state, wait */
-  if (senseWaitCounter > (unsigned char)0) {
-      senseWaitCounter--;
-      return;
-  }
-  
-  /* Whenever a USB sense pin changes state, post attach/detach events. */
-  senseValue = PORTC & 0x01;
-  if (senseValue != sensePrevValue) {
-      sensePrevValue = senseValue;
-      senseWaitCounter = 0xFF;
-      if (senseValue) {
-          usbPostEvent(USB_EV_ATTACHED);
-      } else {
-          usbPostEvent(USB_EV_DETACHED);
-      }
+#pragma code low_vector=0x18
+void low_vector(void)
+{
+  _asm goto 0x4018 _endasm
+}
+#pragma code
+
+#pragma interrupt high_isr save=section(".tmpdata")
+void high_isr(void)
+{
+  schedInterruptHandler();
+  adcInterruptHandler();
+  usbInterruptHandler();
+  if ((unsigned char)1 == INTCONbits.INT0IF) {
+    /* Alarm input, also wakes the CPU from Sleep mode */
+    INTCONbits.INT0IF = 0;
+    schedPostEvent(alarmTask);
   }
+  uartInterruptHandler();
+}
+
+/* EP1 IN channel fill callback: the pending probe reply or report. Probe
+   replies go first so telemetry does not add to the measured latency. The
+   buffer is the size of the active profile's reports. */
+usbError FillEP1In(char *buf, int *size)
+{
+    if (echoPending) {
+        echoSending(&echoReply);
+        memset(buf, 0, *size);
+        memcpy(buf, (void *)&echoReply, sizeof(echoReply));
+        echoPending = 0;
+        echoInFlight = 1;
+        echoInFlightTag = echoReply.tag;
+        return USB_SUCCESS;
+    }
+    if (reportPending) {
+        memcpy(buf, (void *)reportBuf, *size);
+        reportPending = 0;
+        rptBegin(reportBuf, *size);
+        /* Samples may have queued up behind the report */
+        schedPostEvent(sampleTask);
+        return USB_SUCCESS;
+    }
+    return USB_EBADSTATE;
+}
+
+/* Send the pending probe reply or report if EP1 IN is free, otherwise it
+   goes once the host has collected the previous one */
+void ServiceEP1In(void)
+{
+    (void)usbChanReady(1);
 }
 
-void SendStatusUpdate(void)
+void FinishReport(void)
 {
-    char handle;
+    (void)rptEnd();
+    reportPending = 1;
+    ServiceEP1In();
+}
+
+/* PROTO_CMD_ECHO handler */
+usbError EchoCommand(const char *data, unsigned char size)
+{
+    const echoCommandType *cmd = (const echoCommandType *)data;
+
+    if (size < sizeof(echoCommandType)) {
+        return USB_EBADDATA;
+    }
+    /* The host waits for each reply, a probe that overlaps one still
+       pending is dropped */
+    if (echoPending) {
+        return USB_EBADSTATE;
+    }
+    echoReceived(cmd->tag, &echoReply);
+    echoPending = 1;
+    ServiceEP1In();
+    return USB_SUCCESS;
+}
+
+/* EP1 transactions */
+usbError TransactionCallback(void *param)
+{
+    char handle = *(char *)param;
     usbError ret;
-    char *buf;
-    int bufSize;
 
-    usbBdGetHandleForEndpoint(1, USB_ED_IN, &handle);
-    ret = usbBdGetBuf(handle, &buf, &bufSize);
-    if (USB_EACCESS == ret) {
-        printf("No access to EP1 - previous buffer?\r\n");
-    } else {
-        statusBuf.dummy1 = 1;
-        statusBuf.dummy2 = 2;
-        memcpy(buf, (void *)(&statusBuf), sizeof(statusBuf));
-        ret = usbBdSend(handle, sizeof(statusBuf));
-        if (USB_SUCCESS != ret) {
-            printf("Send failed %d\r\n", ret);
+    if (1 != usbBdGetEndpoint(handle)) {
+        /* The mass storage and vendor endpoints, if any */
+        ret = mscHandleTransaction(handle);
+        if (USB_EBADPARM == ret) {
+            ret = vndHandleTransaction(handle);
         }
+        return ret;
     }
+
+    if (USB_ED_OUT == usbBdGetDirection(handle)) {
+        return cmdHandleTransaction(handle);
+    }
+
+    /* The channel refills EP1 IN after this */
+    if (echoInFlight) {
+        echoCollected(echoInFlightTag);
+        echoInFlight = 0;
+    }
+    return USB_SUCCESS;
+}
+
+/* A halt was cleared: the owner of the endpoint re-arms it */
+usbError EndpointResetCallback(void *param)
+{
+    char handle = *(char *)param;
+    usbError ret;
+
+    if (1 != usbBdGetEndpoint(handle)) {
+        ret = mscEndpointReset(handle);
+        if (USB_EBADPARM == ret) {
+            ret = vndEndpointReset(handle);
+        }
+        return ret;
+    }
+
+    if (USB_ED_OUT == usbBdGetDirection(handle)) {
+        return cmdEndpointReset(handle);
+    }
+
+    /* An echo reply dropped with the halt is not collected */
+    echoInFlight = 0;
+    return USB_SUCCESS;
 }
 
 usbError SetConfigCallback(void *param)
 {
     unsigned char *config = (unsigned char *)param;
     if ((unsigned)1 == *config) {
-        SendStatusUpdate();
+        configured = 1;
+
+        /* EP1 has been set up from the configuration descriptor */
+        echoPending = 0;
+        echoInFlight = 0;
+        cmdStart();
+        mscStart();
+        vndStart();
+
+        /* The host starts decoding at a key report */
+        rptInit();
+        rptBegin(reportBuf, profileReportSize[profile]);
+        reportPending = 0;
+
+        /* Send the samples stored while unconfigured */
+        storeSetFlushing(1);
+        schedPostEvent(sampleTask);
         return USB_SUCCESS;
     } else {
+        configured = 0;
+        storeSetFlushing(0);
         return USB_EBADPARM;
     }
 }
 
+/* Serve the configuration and report descriptors of the active profile */
+usbError GetDescriptorCallback(void *param)
+{
+    usbCtlDescriptor *desc = (usbCtlDescriptor *)param;
+    const rom usbCtlDescriptor *entry = hidProfileDescriptorList[profile];
+    char i;
+
+    for (i = 0; i < HID_PROFILE_DESCRIPTORS; i++) {
+        if ((entry[i].type == desc->type) && (entry[i].index == desc->index)) {
+            desc->totalSize = entry[i].totalSize;
+            desc->data = entry[i].data;
+            desc->source = entry[i].source;
+            return USB_SUCCESS;
+        }
+    }
+    return USB_EBADPARM;
+}
+
+usbError VendorRequestCallback(void *param)
+{
+    usbCtlRequest *req = (usbCtlRequest *)param;
+
+    switch (req->setup->request) {
+    case PROTO_VREQ_SET_PROFILE:
+        if (req->setup->data >= PROTO_NUM_PROFILES) {
+            return USB_EBADPARM;
+        }
+        newProfile = req->setup->data;
+        if (newProfile != profile) {
+            /* The host caches the descriptors; reconnect once the
+               request has completed */
+            printf("Profile %d, reconnecting\r\n", newProfile);
+            reenumerateDetached = 0;
+            schedStartTimer(reenumerateTask, SCHED_MS(REENUMERATE_DELAY_MS), 0);
+        }
+        return USB_SUCCESS;
+
+    case PROTO_VREQ_GET_PROFILE:
+        req->source = USB_CTL_FROM_RAM;
+        req->data = (char *)&profile;
+        req->size = sizeof(profile);
+        return USB_SUCCESS;
+
+    case PROTO_VREQ_ECHO:
+        /* The data stage is sent from this buffer packet by packet, it is
+           kept apart from the EP1 probe reply */
+        echoReceived(req->setup->data, &echoCtlReply);
+        echoSending(&echoCtlReply);
+        req->source = USB_CTL_FROM_RAM;
+        req->data = (char *)&echoCtlReply;
+        req->size = sizeof(echoCtlReply);
+        return USB_SUCCESS;
+
+    case PROTO_VREQ_GET_HALT_STATS:
+        usbGetHaltStats(&haltStats);
+        req->source = USB_CTL_FROM_RAM;
+        req->data = (char *)&haltStats;
+        req->size = sizeof(haltStats);
+        return USB_SUCCESS;
+
+#ifdef PROTO_VENDOR_ENDPOINT
+    case PROTO_VREQ_GET_VENDOR_STATS:
+        vndGetStats(&vendorStats);
+        req->source = USB_CTL_FROM_RAM;
+        req->data = (char *)&vendorStats;
+        req->size = sizeof(vendorStats);
+        return USB_SUCCESS;
+#endif
+
+    default:
+        return fwVendorRequest(req);
+    }
+}
+
+/* HID Get_Report(Feature): the latest sample, packed as described by the
+   report descriptor */
+usbError ClassRequestCallback(void *param)
+{
+    usbCtlRequest *req = (usbCtlRequest *)param;
+
+    if (HID_INTERFACE != req->setup->index) {
+        return mscClassRequest(req);
+    }
+    if ((HID_REQ_GET_REPORT != req->setup->request) ||
+        (HID_REPORT_TYPE_FEATURE != (req->setup->data >> 8))) {
+        return USB_ENOIMP;
+    }
+    PROTO_PACK_SAMPLE(sampleReport, &statusBuf);
+    req->source = USB_CTL_FROM_RAM;
+    req->data = (char *)sampleReport;
+    req->size = sizeof(sampleReport);
+    return USB_SUCCESS;
+}
+
+/* While the bus is suspended, sampling stops. A bus-powered device also
+   sleeps until bus activity or the alarm input wakes it up; a
+   self-powered one idles, so a detach is still seen and sampling resumes
+   into the store. */
+usbError SuspendCallback(void *param)
+{
+    if ((unsigned char)1 == *(unsigned char *)param) {
+        adcStop();
+        if (USB_POWER_BUS == POWER_STATE) {
+            schedSetDeepSleep(1);
+        }
+    } else {
+        schedSetDeepSleep(0);
+        adcStart();
+    }
+    return USB_SUCCESS;
+}
+
+usbError VendorDataCallback(void *param)
+{
+    return fwVendorData((usbCtlRequest *)param);
+}
+
+/* One-shot timer task, switches the profile and reconnects */
+void ReenumerateTask(void)
+{
+    if (!reenumerateDetached) {
+        configured = 0;
+        profile = newProfile;
+        reenumerateDetached = 1;
+        usbPostEvent(USB_EV_DETACHED);
+        schedStartTimer(reenumerateTask, SCHED_MS(REENUMERATE_DETACH_MS), 0);
+    } else {
+        /* The stack connects again if VBUS is present */
+        usbPostEvent(USB_EV_ATTACHED);
+    }
+}
+
+/* Posted by the ADC for every sample and when EP1 IN takes a report.
+   Moves samples from the ring into reports, a full report at a time; while
+   a finished report waits for EP1 IN, the samples stay in the ring. Live
+   samples go first, the report is then topped up from the store. While
+   unconfigured, the samples go to the store. */
+void SampleTask(void)
+{
+    statusType *sample;
+    statusType stored;
+
+    if (!configured) {
+        while (0 != (sample = adcPeek())) {
+            statusBuf = *sample;
+            (void)storePut(sample);
+            adcRelease();
+        }
+        return;
+    }
+
+    while (!reportPending) {
+        sample = adcPeek();
+        if (0 == sample) {
+            if (!storePeek(&stored)) {
+                break;
+            }
+            sample = &stored;
+        }
+        if (USB_ENOMEM == rptAddSample(sample)) {
+            /* Sent right away if EP1 IN is free, and the sample goes into
+               the next report */
+            FinishReport();
+            continue;
+        }
+        if (&stored == sample) {
+            storeRelease();
+        } else {
+            statusBuf = *sample;
+            adcRelease();
+        }
+    }
+}
+
+/* Posted on a falling edge of the alarm input. If the bus is suspended,
+   the host is woken up and the reports go out again within a few ms. */
+void AlarmTask(void)
+{
+    if (USB_SUCCESS == usbRemoteWakeup()) {
+        printf("main: Alarm, host woken up\r\n");
+    }
+}
+
+/* Timer task, runs every STATUS_PERIOD_MS to send partially filled reports */
+void StatusTask(void)
+{
+    if (configured && !reportPending && (0 != rptGetCount())) {
+        FinishReport();
+    }
+}
+
 void main (void)
 {
-  usbError ret;
+  schedTaskId task;
+
+  /* Does not return if there is an application to run */
+  fwStartApplication();
 
   /* Configure the USB Sense pin - C0 */
   TRISC = TRISC & 1;
@@ -84,25 +481,50 @@ void main (void)
              USART_ASYNCH_MODE & USART_EIGHT_BIT  &
              USART_CONT_RX,
              51);
+  /* Debug output is buffered from here on, see uart.h */
+  uartInit();
 
   printf("USB Project Debug Output\r\n");
 
+  /* The USB task is added first and has the highest priority */
+  schedInit();
   (void)usbInit();
-  usbSetPowerState(USB_POWER_SELF);
+  usbSetPowerState(POWER_STATE);
   usbSetCallback(USB_CB_CONFIG, SetConfigCallback);
-  ret = usbBdSetup(1, USB_ED_OUT, DATA_ENDPOINT_SIZE);
-  if (USB_SUCCESS != ret) {
-    printf("Data BD Setup failed! ret=%d\r\n", ret);
-    return;
-  }
-  ret = usbBdSetup(1, USB_ED_IN, DATA_ENDPOINT_SIZE);
-  if (USB_SUCCESS != ret) {
-    printf("Data BD Setup failed! ret=%d\r\n", ret);
-    return;
-  }
+  usbSetCallback(USB_CB_GET_DESCRIPTOR, GetDescriptorCallback);
+  usbSetCallback(USB_CB_VENDOR_REQUEST, VendorRequestCallback);
+  usbSetCallback(USB_CB_VENDOR_DATA, VendorDataCallback);
+  usbSetCallback(USB_CB_CLASS_REQUEST, ClassRequestCallback);
+  usbSetCallback(USB_CB_TRANSACTION, TransactionCallback);
+  usbSetCallback(USB_CB_SUSPEND, SuspendCallback);
+  usbSetCallback(USB_CB_ENDPOINT_RESET, EndpointResetCallback);
+  /* The HID interface has a single interrupt IN endpoint, so probe
+     replies and telemetry share one channel */
+  (void)usbChanOpen(1, 0, FillEP1In);
+  (void)mscInit();
+  (void)vndInit();
+  echoInit();
+  (void)cmdInit();
+  (void)cmdRegister(PROTO_CMD_ECHO, EchoCommand);
+  (void)fwInit();
 
-  while (1) {
-    CheckForUSBAttachDetach();
-    (void)usbWork();
-  }
+  reenumerateTask = schedAddTask(ReenumerateTask);
+  sampleTask = schedAddTask(SampleTask);
+  adcInit(sampleTask);
+  (void)storeInit();
+  adcSetBoot(storeGetBoot());
+  /* Sampling runs from now on, configured or not */
+  adcStart();
+
+  /* Alarm input on RB0/INT0, active low with the PORTB pull-ups; ADCON1
+     (adcInit) has made it digital */
+  alarmTask = schedAddTask(AlarmTask);
+  INTCON2bits.RBPU = 0;
+  INTCON2bits.INTEDG0 = 0;
+  INTCONbits.INT0IF = 0;
+  INTCONbits.INT0IE = 1;
+  task = schedAddTask(StatusTask);
+  schedStartTimer(task, SCHED_MS(STATUS_PERIOD_MS), SCHED_MS(STATUS_PERIOD_MS));
+
+  schedRun();
 }
\ No newline at end of file
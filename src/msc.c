@@ -0,0 +1,450 @@
+/* USB mass storage implementation */
+
+/* Bulk-Only Transport: the host sends a 31-byte Command Block Wrapper
+   (CBW) on the OUT endpoint, then data moves in the direction of the
+   command, then the device sends a 13-byte Command Status Wrapper (CSW)
+   on the IN endpoint.
+
+   The CBW is handled in the USB task as soon as it is received. Data-in
+   and the CSW are produced by the IN channel's fill callback, a packet at
+   a time, either from the small reply buffer or generated from the
+   volume. Data-out is only accepted to be discarded, the volume is
+   read-only.
+
+   When the device has less data than the host asked for, it sends what
+   it has and ends the data stage with a short (or zero-length) packet;
+   the CSW carries the residue. When it has more (Hi < Di), it sends as
+   much as the host asked for and reports a phase error. Replies already
+   cut to the command's allocation length are not more data than asked.
+
+   An invalid CBW halts both endpoints until the host's reset recovery:
+   Bulk-Only Mass Storage Reset, then a Clear Feature (ENDPOINT_HALT) on
+   each endpoint. Until the reset, clearing the halt leaves the endpoint
+   halted. */
+
+#include <p18f2550.h>
+#include <stdio.h>
+
+#include "msc.h"
+#include "usb_chan.h"
+
+#include "string.h"
+
+#ifdef PROTO_MSC_ENDPOINT
+
+#define MSC_CBW_SIZE 31
+#define MSC_CSW_SIZE 13
+#define MSC_CBW_SIGNATURE 0x43425355L /* "USBC" */
+#define MSC_CBW_FLAG_IN 0x80
+
+/* CBW offsets */
+#define MSC_CBW_TAG 4
+#define MSC_CBW_LENGTH 8
+#define MSC_CBW_FLAGS 12
+#define MSC_CBW_LUN 13
+#define MSC_CBW_CB_LENGTH 14
+#define MSC_CBW_CB 15
+
+/* CSW status */
+#define MSC_STATUS_PASSED 0
+#define MSC_STATUS_FAILED 1
+#define MSC_STATUS_PHASE_ERROR 2
+
+/* Class requests */
+#define MSC_REQ_RESET 0xFF
+#define MSC_REQ_GET_MAX_LUN 0xFE
+
+/* SCSI commands */
+#define MSC_SCSI_TEST_UNIT_READY 0x00
+#define MSC_SCSI_REQUEST_SENSE 0x03
+#define MSC_SCSI_INQUIRY 0x12
+#define MSC_SCSI_MODE_SENSE_6 0x1A
+#define MSC_SCSI_START_STOP_UNIT 0x1B
+#define MSC_SCSI_PREVENT_ALLOW 0x1E
+#define MSC_SCSI_READ_FORMAT_CAPACITIES 0x23
+#define MSC_SCSI_READ_CAPACITY_10 0x25
+#define MSC_SCSI_READ_10 0x28
+#define MSC_SCSI_WRITE_10 0x2A
+#define MSC_SCSI_VERIFY_10 0x2F
+
+/* Sense keys and additional sense codes */
+#define MSC_SENSE_NONE 0x00
+#define MSC_SENSE_ILLEGAL_REQUEST 0x05
+#define MSC_SENSE_DATA_PROTECT 0x07
+#define MSC_ASC_NONE 0x00
+#define MSC_ASC_INVALID_COMMAND 0x20
+#define MSC_ASC_LBA_OUT_OF_RANGE 0x21
+#define MSC_ASC_WRITE_PROTECTED 0x27
+
+#define MSC_REQUEST_SENSE_SIZE 18
+#define MSC_REPLY_SIZE 36 /* The largest reply, Inquiry */
+
+typedef enum {
+    MSC_ST_CBW, /**< Waiting for a command */
+    MSC_ST_DATA_IN,
+    MSC_ST_DATA_OUT,
+    MSC_ST_CSW, /**< The status is next on the IN endpoint */
+    MSC_ST_RESET /**< Invalid CBW, waiting for the reset recovery */
+} mscTransportState;
+
+typedef struct {
+    mscTransportState state;
+    usbBdSyncVal outSync; /**< Expected data toggle of the next OUT packet */
+    unsigned long tag;
+    unsigned long residue; /**< Data the host expects and has not moved */
+    unsigned char status;
+    /** Data-in: bytes the device still has, from the volume or the reply.
+        Data-out: bytes still to be received. */
+    unsigned long remaining;
+    char fromDisk;
+    unsigned short lba; /**< Volume data: sector and offset in it */
+    unsigned int offset;
+    char reply[MSC_REPLY_SIZE];
+    unsigned char replyOffset;
+    /** Sense data of the last command */
+    unsigned char senseKey;
+    unsigned char asc;
+} mscInternalState;
+
+static mscInternalState mscState;
+
+static const rom char mscInquiry[MSC_REPLY_SIZE] =
+{
+    0x00, /* Direct access block device */
+    0x80, /* Removable */
+    0x02, /* Version */
+    0x02, /* Response data format */
+    31, /* Additional length */
+    0, 0, 0,
+    'p', 'i', 'c', '1', '8', 'u', 's', 'b', /* Vendor */
+    'L', 'o', 'g', ' ', 'V', 'o', 'l', 'u', /* Product */
+    'm', 'e', ' ', ' ', ' ', ' ', ' ', ' ',
+    '1', '.', '0', '0' /* Revision */
+};
+
+usbError mscFill(char *buf, int *size);
+
+unsigned long mscGet32(const char *p)
+{
+    return (unsigned char)p[0] | ((unsigned long)(unsigned char)p[1] << 8) |
+           ((unsigned long)(unsigned char)p[2] << 16) |
+           ((unsigned long)(unsigned char)p[3] << 24);
+}
+
+/* SCSI fields are big-endian */
+void mscPutBE32(char *p, unsigned long value)
+{
+    p[0] = (char)(value >> 24);
+    p[1] = (char)(value >> 16);
+    p[2] = (char)(value >> 8);
+    p[3] = (char)value;
+}
+
+usbError mscInit(void)
+{
+    usbError ret;
+
+    (void) memset((void *)&mscState, 0, sizeof(mscState));
+    ret = mscDiskInit();
+    if (USB_SUCCESS != ret) {
+        printf("msc: Files do not fit the volume\r\n");
+        return ret;
+    }
+    return usbChanOpen(MSC_CFG_ENDPOINT, MSC_CFG_PRIORITY, mscFill);
+}
+
+/* Hand the OUT BD back to the SIE */
+void mscArm(void)
+{
+    usbBdHandle handle;
+
+    usbBdGetHandleForEndpoint(MSC_CFG_ENDPOINT, USB_ED_OUT, &handle);
+    usbBdSetSync(handle, USB_DTS_ON, mscState.outSync);
+    (void) usbBdReceive(handle);
+}
+
+void mscStart(void)
+{
+    mscState.state = MSC_ST_CBW;
+    mscState.senseKey = MSC_SENSE_NONE;
+    mscState.asc = MSC_ASC_NONE;
+    mscState.outSync = USB_DTS_DATA0;
+    mscArm();
+}
+
+void mscFail(unsigned char senseKey, unsigned char asc)
+{
+    mscState.status = MSC_STATUS_FAILED;
+    mscState.senseKey = senseKey;
+    mscState.asc = asc;
+}
+
+/* Reply from the reply buffer, at most allocation bytes of it */
+void mscReply(unsigned char size, unsigned int allocation)
+{
+    mscState.remaining = (size < allocation) ? size : allocation;
+}
+
+/* Run the SCSI command of a CBW, set up the data stage */
+void mscScsiCommand(const char *cb)
+{
+    unsigned long lba;
+    unsigned int blocks;
+    unsigned short last;
+    char *reply = mscState.reply;
+
+    if (MSC_SCSI_REQUEST_SENSE != cb[0]) {
+        mscState.senseKey = MSC_SENSE_NONE;
+        mscState.asc = MSC_ASC_NONE;
+    }
+    (void) memset((void *)reply, 0, MSC_REPLY_SIZE);
+
+    switch (cb[0]) {
+    case MSC_SCSI_TEST_UNIT_READY:
+    case MSC_SCSI_START_STOP_UNIT:
+    case MSC_SCSI_PREVENT_ALLOW:
+    case MSC_SCSI_VERIFY_10:
+        break;
+
+    case MSC_SCSI_REQUEST_SENSE:
+        reply[0] = 0x70; /* Current error, fixed format */
+        reply[2] = mscState.senseKey;
+        reply[7] = MSC_REQUEST_SENSE_SIZE - 8;
+        reply[12] = mscState.asc;
+        mscReply(MSC_REQUEST_SENSE_SIZE, (unsigned char)cb[4]);
+        mscState.senseKey = MSC_SENSE_NONE;
+        mscState.asc = MSC_ASC_NONE;
+        break;
+
+    case MSC_SCSI_INQUIRY:
+        memcpypgm2ram((void *)reply, (const rom void *)mscInquiry, sizeof(mscInquiry));
+        mscReply(sizeof(mscInquiry), (unsigned char)cb[4]);
+        break;
+
+    case MSC_SCSI_MODE_SENSE_6:
+        reply[0] = 3; /* Mode data length */
+        reply[2] = 0x80; /* Write protected */
+        mscReply(4, (unsigned char)cb[4]);
+        break;
+
+    case MSC_SCSI_READ_CAPACITY_10:
+        last = mscDiskGetSectors() - 1;
+        mscPutBE32(reply, last);
+        mscPutBE32(reply + 4, MSC_SECTOR_SIZE);
+        mscReply(8, 8);
+        break;
+
+    case MSC_SCSI_READ_FORMAT_CAPACITIES:
+        reply[3] = 8; /* Capacity list length */
+        mscPutBE32(reply + 4, mscDiskGetSectors());
+        mscPutBE32(reply + 8, MSC_SECTOR_SIZE); /* 24-bit block length */
+        reply[8] = 0x02; /* Descriptor type: formatted media */
+        mscReply(12, ((unsigned int)(unsigned char)cb[7] << 8) | (unsigned char)cb[8]);
+        break;
+
+    case MSC_SCSI_READ_10:
+        lba = ((unsigned long)(unsigned char)cb[2] << 24) |
+              ((unsigned long)(unsigned char)cb[3] << 16) |
+              ((unsigned long)(unsigned char)cb[4] << 8) | (unsigned char)cb[5];
+        blocks = ((unsigned int)(unsigned char)cb[7] << 8) | (unsigned char)cb[8];
+        if (lba + blocks > mscDiskGetSectors()) {
+            mscFail(MSC_SENSE_ILLEGAL_REQUEST, MSC_ASC_LBA_OUT_OF_RANGE);
+            break;
+        }
+        mscState.fromDisk = 1;
+        mscState.lba = (unsigned short)lba;
+        mscState.offset = 0;
+        mscState.remaining = (unsigned long)blocks * MSC_SECTOR_SIZE;
+        break;
+
+    case MSC_SCSI_WRITE_10:
+        mscFail(MSC_SENSE_DATA_PROTECT, MSC_ASC_WRITE_PROTECTED);
+        break;
+
+    default:
+        printf("msc: Unsupported command %x\r\n", (int)(unsigned char)cb[0]);
+        mscFail(MSC_SENSE_ILLEGAL_REQUEST, MSC_ASC_INVALID_COMMAND);
+        break;
+    }
+}
+
+/* A CBW has been received */
+void mscCommand(const char *cbw, int size)
+{
+    if ((MSC_CBW_SIZE != size) || (MSC_CBW_SIGNATURE != mscGet32(cbw)) ||
+        (0 != cbw[MSC_CBW_LUN]) || (0 == cbw[MSC_CBW_CB_LENGTH])) {
+        printf("msc: Invalid CBW, size=%d\r\n", size);
+        mscState.state = MSC_ST_RESET;
+        (void) usbHaltEndpoint(0x80 | MSC_CFG_ENDPOINT);
+        (void) usbHaltEndpoint(MSC_CFG_ENDPOINT);
+        return;
+    }
+
+    mscState.tag = mscGet32(cbw + MSC_CBW_TAG);
+    mscState.residue = mscGet32(cbw + MSC_CBW_LENGTH);
+    mscState.status = MSC_STATUS_PASSED;
+    mscState.remaining = 0;
+    mscState.fromDisk = 0;
+    mscState.replyOffset = 0;
+    mscScsiCommand(cbw + MSC_CBW_CB);
+
+    if (0 == mscState.residue) {
+        if (0 != mscState.remaining) {
+            mscState.status = MSC_STATUS_PHASE_ERROR;
+        }
+        mscState.state = MSC_ST_CSW;
+    } else if (0 != (cbw[MSC_CBW_FLAGS] & MSC_CBW_FLAG_IN)) {
+        if (mscState.remaining > mscState.residue) {
+            /* The host expects less than the command transfers */
+            mscState.remaining = mscState.residue;
+            mscState.status = MSC_STATUS_PHASE_ERROR;
+        }
+        mscState.state = MSC_ST_DATA_IN;
+    } else {
+        /* The host sends data to a read-only device, it is dropped and
+           counted in the residue */
+        if (0 != mscState.remaining) {
+            mscState.status = MSC_STATUS_PHASE_ERROR;
+        } else if (MSC_STATUS_PASSED == mscState.status) {
+            mscFail(MSC_SENSE_ILLEGAL_REQUEST, MSC_ASC_INVALID_COMMAND);
+        }
+        mscState.remaining = mscState.residue;
+        mscState.state = MSC_ST_DATA_OUT;
+        return;
+    }
+    (void) usbChanReady(MSC_CFG_ENDPOINT);
+}
+
+usbError mscHandleTransaction(usbBdHandle handle)
+{
+    char *buf;
+    int size;
+
+    if (MSC_CFG_ENDPOINT != usbBdGetEndpoint(handle)) {
+        return USB_EBADPARM;
+    }
+    if (USB_ED_IN == usbBdGetDirection(handle)) {
+        /* The channel sends the next packet */
+        return USB_SUCCESS;
+    }
+
+    (void) usbBdGetBuf(handle, &buf, &size);
+    switch (mscState.state) {
+    case MSC_ST_CBW:
+        mscCommand(buf, size);
+        if (MSC_ST_RESET == mscState.state) {
+            /* The endpoint is halted, the BD stays with the SIE */
+            return USB_SUCCESS;
+        }
+        break;
+    case MSC_ST_DATA_OUT:
+        mscState.remaining -= ((unsigned long)size < mscState.remaining) ?
+                              (unsigned long)size : mscState.remaining;
+        if ((0 == mscState.remaining) || (PROTO_MSC_PACKET_SIZE != size)) {
+            mscState.state = MSC_ST_CSW;
+            (void) usbChanReady(MSC_CFG_ENDPOINT);
+        }
+        break;
+    default:
+        /* Out of sequence, dropped */
+        break;
+    }
+
+    mscState.outSync = (USB_DTS_DATA0 == mscState.outSync) ? USB_DTS_DATA1 : USB_DTS_DATA0;
+    mscArm();
+    return USB_SUCCESS;
+}
+
+usbError mscEndpointReset(usbBdHandle handle)
+{
+    if (MSC_CFG_ENDPOINT != usbBdGetEndpoint(handle)) {
+        return USB_EBADPARM;
+    }
+    if (MSC_ST_RESET == mscState.state) {
+        (void) usbHaltEndpoint(MSC_CFG_ENDPOINT |
+                               ((USB_ED_IN == usbBdGetDirection(handle)) ? 0x80 : 0));
+        return USB_SUCCESS;
+    }
+    if (USB_ED_OUT == usbBdGetDirection(handle)) {
+        mscState.outSync = USB_DTS_DATA0;
+        mscArm();
+    }
+    return USB_SUCCESS;
+}
+
+/* IN channel fill callback: the next data-in packet or the CSW */
+usbError mscFill(char *buf, int *size)
+{
+    unsigned char count;
+
+    switch (mscState.state) {
+    case MSC_ST_DATA_IN:
+        count = ((unsigned long)*size < mscState.remaining) ?
+                (unsigned char)*size : (unsigned char)mscState.remaining;
+        if (mscState.fromDisk) {
+            mscDiskRead(mscState.lba, mscState.offset, buf, count);
+            mscState.offset += count;
+            if (MSC_SECTOR_SIZE == mscState.offset) {
+                mscState.lba++;
+                mscState.offset = 0;
+            }
+        } else {
+            memcpy((void *)buf, (void *)(mscState.reply + mscState.replyOffset), count);
+            mscState.replyOffset += count;
+        }
+        mscState.remaining -= count;
+        mscState.residue -= count;
+
+        /* A short packet ends the data stage early. If the data ends on a
+           packet boundary before the host's length, a zero-length packet
+           follows. */
+        if (((int)count < *size) || (0 == mscState.residue)) {
+            mscState.state = MSC_ST_CSW;
+        }
+        *size = count;
+        return USB_SUCCESS;
+
+    case MSC_ST_CSW:
+        buf[0] = 'U';
+        buf[1] = 'S';
+        buf[2] = 'B';
+        buf[3] = 'S';
+        (void) memcpy((void *)(buf + 4), (void *)&mscState.tag, 4);
+        (void) memcpy((void *)(buf + 8), (void *)&mscState.residue, 4);
+        buf[12] = mscState.status;
+        *size = MSC_CSW_SIZE;
+        mscState.state = MSC_ST_CBW;
+        return USB_SUCCESS;
+
+    default:
+        return USB_EBADSTATE;
+    }
+}
+
+usbError mscClassRequest(usbCtlRequest *req)
+{
+    static char maxLun = 0;
+
+    if (PROTO_MSC_INTERFACE != req->setup->index) {
+        return USB_ENOIMP;
+    }
+
+    switch (req->setup->request) {
+    case MSC_REQ_RESET:
+        /* Ready for the next CBW. The OUT BD stays armed, or after an
+           invalid CBW, is armed when the host clears the halt. */
+        mscState.state = MSC_ST_CBW;
+        return USB_SUCCESS;
+
+    case MSC_REQ_GET_MAX_LUN:
+        req->source = USB_CTL_FROM_RAM;
+        req->data = &maxLun;
+        req->size = 1;
+        return USB_SUCCESS;
+
+    default:
+        return USB_ENOIMP;
+    }
+}
+
+#endif /* PROTO_MSC_ENDPOINT */
@@ -0,0 +1,110 @@
+/** USB mass storage header
+
+    A read-only mass storage interface (Bulk-Only Transport, SCSI
+    transparent command set) next to the HID interface. It shows a small
+    FAT12 volume with one file per mscFileList entry, so logs and other
+    device memory can be copied off with any file manager.
+
+    The volume is not stored anywhere: every sector is generated on the
+    fly, a packet at a time, from the file list. The boot sector, FATs and
+    root directory are computed from the file sizes; file data is read
+    straight from program memory or the data EEPROM.
+
+    The interface is part of the configuration when tools/protocol.schema
+    has an msc line (PROTO_MSC_ENDPOINT). Without it, the functions below
+    are empty macros.
+
+    Typical use: mscInit() at startup, mscStart() once the device is
+    configured, mscHandleTransaction() from the USB_CB_TRANSACTION
+    callback and mscClassRequest() from the USB_CB_CLASS_REQUEST callback.
+    Data and status go out through an IN channel (usb_chan.h) at
+    MSC_CFG_PRIORITY.
+*/
+
+#ifndef MSC_H
+#define MSC_H
+
+#include "usb.h"
+#include "usb_bd.h"
+#include "usb_ctl.h"
+#include "protocol.h"
+
+/** Sector size of the volume */
+#define MSC_SECTOR_SIZE 512
+
+/** Max number of files, the root directory takes one sector */
+#define MSC_MAX_FILES 15
+
+/** Where the data of a file is read from */
+typedef enum {
+    MSC_FROM_ROM, /**< Program memory */
+    MSC_FROM_EEPROM /**< Data EEPROM */
+} mscSource;
+
+/** A file of the volume */
+typedef struct {
+    char name[11]; /**< 8.3 name without the dot, space padded */
+    mscSource source;
+    unsigned short address;
+    unsigned short size;
+} mscFile;
+
+/** The file list
+
+    Like usbCtlDescriptorList, these are symbols the application defines
+    when the mass storage interface is used. */
+extern const rom mscFile mscFileList[];
+extern const rom char mscFileCount;
+
+#ifdef PROTO_MSC_ENDPOINT
+
+/** Endpoint pair of the interface, from the schema */
+#define MSC_CFG_ENDPOINT PROTO_MSC_ENDPOINT
+
+/** IN channel priority, after the HID reports */
+#define MSC_CFG_PRIORITY 1
+
+/** Lay out the volume and open the IN channel. Returns USB_ENOMEM if the
+    files do not fit a one-sector FAT or the root directory. */
+usbError mscInit(void);
+
+/** Reset the transport and arm the OUT endpoint, called once configured */
+void mscStart(void);
+
+/** Handle a transaction on the interface's endpoints. Returns
+    USB_EBADPARM if the handle is not one of them. */
+usbError mscHandleTransaction(usbBdHandle handle);
+
+/** Re-arm an endpoint of the interface once its halt is cleared, from
+    the USB_CB_ENDPOINT_RESET callback. Returns USB_EBADPARM if the handle
+    is not one of them. */
+usbError mscEndpointReset(usbBdHandle handle);
+
+/** Handle Bulk-Only Mass Storage Reset and Get Max LUN. Returns
+    USB_ENOIMP for requests to other interfaces. */
+usbError mscClassRequest(usbCtlRequest *req);
+
+/* The following functions are internal to the mass storage module */
+
+/** Compute the volume layout from the file list */
+usbError mscDiskInit(void);
+
+/** Number of sectors of the volume */
+unsigned short mscDiskGetSectors(void);
+
+/** Generate size bytes of a sector, from offset within the sector. The
+    range must not cross the end of the sector. */
+void mscDiskRead(unsigned short lba, unsigned int offset, char *buf,
+                 unsigned char size);
+
+#else
+
+#define mscInit() (USB_SUCCESS)
+#define mscStart()
+#define mscHandleTransaction(handle) (USB_EBADPARM)
+#define mscEndpointReset(handle) (USB_EBADPARM)
+#define mscClassRequest(req) (USB_ENOIMP)
+
+#endif /* PROTO_MSC_ENDPOINT */
+
+#endif /* MSC_H */
@@ -0,0 +1,274 @@
+/* Synthetic FAT12 volume */
+
+/* Layout, one sector per cluster, no partition table:
+
+     sector 0                boot sector
+     sectors 1-2             two copies of a one-sector FAT
+     sector 3                root directory: the volume label, then the
+                             files in list order
+     sector 4...             file data, each file in consecutive clusters
+                             from cluster 2, in list order
+
+   A one-sector FAT holds 341 entries, so the data area is limited to
+   MSC_DISK_MAX_CLUSTERS (about 170 KB), more than the device has. */
+
+#include <p18f2550.h>
+
+#include "msc.h"
+
+#include "string.h"
+
+#ifdef PROTO_MSC_ENDPOINT
+
+#define MSC_DISK_FAT_LBA 1
+#define MSC_DISK_NUM_FATS 2
+#define MSC_DISK_ROOT_LBA (MSC_DISK_FAT_LBA + MSC_DISK_NUM_FATS)
+#define MSC_DISK_DATA_LBA (MSC_DISK_ROOT_LBA + 1)
+#define MSC_DISK_FIRST_CLUSTER 2
+#define MSC_DISK_MAX_CLUSTERS (MSC_SECTOR_SIZE * 2 / 3 - MSC_DISK_FIRST_CLUSTER)
+
+#define MSC_DISK_DIR_ENTRY_SIZE 32
+#define MSC_DISK_ATTR_READ_ONLY 0x01
+#define MSC_DISK_ATTR_VOLUME_ID 0x08
+
+/* FAT12 chain values */
+#define MSC_DISK_FAT_MEDIA 0xFF8
+#define MSC_DISK_FAT_EOC 0xFFF
+
+/* Modification date of all files, 2013-01-01 */
+#define MSC_DISK_DATE 0x4221
+
+/* Boot sector offsets */
+#define MSC_DISK_BS_TOTAL_SECTORS 19
+#define MSC_DISK_BS_SIGNATURE 510
+
+/* The boot sector up to the boot code, the total sector count is patched
+   in */
+static const rom char mscBootSector[] =
+{
+    0xEB, 0x3C, 0x90, /* Jump to the boot code */
+    'P', 'I', 'C', '1', '8', 'U', 'S', 'B', /* OEM name */
+    0x00, 0x02, /* Bytes per sector */
+    1, /* Sectors per cluster */
+    MSC_DISK_FAT_LBA, 0, /* Reserved sectors */
+    MSC_DISK_NUM_FATS, /* Number of FATs */
+    16, 0, /* Root directory entries */
+    0, 0, /* Total sectors */
+    0xF8, /* Media descriptor, fixed disk */
+    1, 0, /* Sectors per FAT */
+    1, 0, /* Sectors per track */
+    1, 0, /* Number of heads */
+    0, 0, 0, 0, /* Hidden sectors */
+    0, 0, 0, 0, /* Total sectors, 32-bit */
+    0x80, /* Drive number */
+    0, /* Reserved */
+    0x29, /* Extended boot signature */
+    0x18, 0x25, 0x50, 0x00, /* Volume serial number */
+    'P', 'I', 'C', '1', '8', 'U', 'S', 'B', ' ', ' ', ' ', /* Volume label */
+    'F', 'A', 'T', '1', '2', ' ', ' ', ' ' /* File system type */
+};
+
+static const rom char mscVolumeLabel[11] = "PIC18USB   ";
+
+static unsigned short mscDiskSectors;
+
+/* Number of clusters of a file */
+unsigned short mscDiskClusters(const rom mscFile *file)
+{
+    return (file->size + (MSC_SECTOR_SIZE - 1)) / MSC_SECTOR_SIZE;
+}
+
+usbError mscDiskInit(void)
+{
+    unsigned short clusters = 0;
+    char i;
+
+    if (mscFileCount > MSC_MAX_FILES) {
+        return USB_ENOMEM;
+    }
+    for (i = 0; i < mscFileCount; i++) {
+        clusters += mscDiskClusters(&mscFileList[i]);
+    }
+    if (clusters > MSC_DISK_MAX_CLUSTERS) {
+        return USB_ENOMEM;
+    }
+    mscDiskSectors = MSC_DISK_DATA_LBA + clusters;
+    return USB_SUCCESS;
+}
+
+unsigned short mscDiskGetSectors(void)
+{
+    return mscDiskSectors;
+}
+
+/* The file holding a cluster and the file's first cluster, or -1 if the
+   cluster is free */
+char mscDiskFindCluster(unsigned short cluster, unsigned short *first)
+{
+    unsigned short next = MSC_DISK_FIRST_CLUSTER;
+    char i;
+
+    for (i = 0; i < mscFileCount; i++) {
+        *first = next;
+        next += mscDiskClusters(&mscFileList[i]);
+        if (cluster < next) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* FAT entry of a cluster: files are contiguous, so each entry points to
+   the next cluster, or ends the chain on the last cluster of a file */
+unsigned short mscDiskFatEntry(unsigned short cluster)
+{
+    unsigned short first;
+    char file;
+
+    if (cluster < MSC_DISK_FIRST_CLUSTER) {
+        return (0 == cluster) ? MSC_DISK_FAT_MEDIA : MSC_DISK_FAT_EOC;
+    }
+    file = mscDiskFindCluster(cluster, &first);
+    if (file < 0) {
+        return 0;
+    }
+    if (cluster == first + mscDiskClusters(&mscFileList[file]) - 1) {
+        return MSC_DISK_FAT_EOC;
+    }
+    return cluster + 1;
+}
+
+/* FAT12 packs two entries into three bytes */
+char mscDiskFatByte(unsigned int offset)
+{
+    unsigned short pair = offset / 3;
+    unsigned short low = mscDiskFatEntry(pair * 2);
+    unsigned short high = mscDiskFatEntry(pair * 2 + 1);
+
+    switch (offset % 3) {
+    case 0:
+        return (char)low;
+    case 1:
+        return (char)((low >> 8) | (high << 4));
+    default:
+        return (char)(high >> 4);
+    }
+}
+
+/* Byte of a root directory entry: 0 is the volume label, then the files */
+char mscDiskDirByte(unsigned int offset)
+{
+    unsigned char entry = offset / MSC_DISK_DIR_ENTRY_SIZE;
+    unsigned char i = offset % MSC_DISK_DIR_ENTRY_SIZE;
+    const rom mscFile *file;
+    unsigned short first;
+    char j;
+
+    if (0 == entry) {
+        if (i < sizeof(mscVolumeLabel)) {
+            return mscVolumeLabel[i];
+        }
+        return (11 == i) ? MSC_DISK_ATTR_VOLUME_ID : 0;
+    }
+    entry--;
+    if (entry >= (unsigned char)mscFileCount) {
+        return 0;
+    }
+
+    file = &mscFileList[entry];
+    if (i < sizeof(file->name)) {
+        return file->name[i];
+    }
+    switch (i) {
+    case 11:
+        return MSC_DISK_ATTR_READ_ONLY;
+    case 24: /* Modification date */
+        return (char)MSC_DISK_DATE;
+    case 25:
+        return (char)(MSC_DISK_DATE >> 8);
+    case 26: /* First cluster, 0 for an empty file */
+    case 27:
+        if (0 == file->size) {
+            return 0;
+        }
+        first = MSC_DISK_FIRST_CLUSTER;
+        for (j = 0; j < (char)entry; j++) {
+            first += mscDiskClusters(&mscFileList[j]);
+        }
+        return (26 == i) ? (char)first : (char)(first >> 8);
+    case 28: /* Size */
+        return (char)file->size;
+    case 29:
+        return (char)(file->size >> 8);
+    default:
+        return 0;
+    }
+}
+
+/* File data; the tail of the last cluster reads as zeros */
+void mscDiskReadData(unsigned short cluster, unsigned int offset, char *buf,
+                     unsigned char size)
+{
+    const rom mscFile *file;
+    unsigned short first;
+    unsigned short pos;
+    unsigned char count = 0;
+    char index;
+    char i;
+
+    index = mscDiskFindCluster(cluster, &first);
+    if (index >= 0) {
+        file = &mscFileList[index];
+        pos = (cluster - first) * MSC_SECTOR_SIZE + offset;
+        if (pos < file->size) {
+            count = (file->size - pos < size) ? file->size - pos : size;
+            if (MSC_FROM_ROM == file->source) {
+                memcpypgm2ram((void *)buf, (const rom void *)(file->address + pos),
+                              count);
+            } else {
+                for (i = 0; i < count; i++) {
+                    buf[i] = usbCtlReadEeprom((unsigned char)(file->address + pos + i));
+                }
+            }
+        }
+    }
+    (void) memset((void *)(buf + count), 0, size - count);
+}
+
+void mscDiskRead(unsigned short lba, unsigned int offset, char *buf,
+                 unsigned char size)
+{
+    unsigned char i;
+
+    if (lba >= MSC_DISK_DATA_LBA) {
+        mscDiskReadData(lba - MSC_DISK_DATA_LBA + MSC_DISK_FIRST_CLUSTER,
+                        offset, buf, size);
+        return;
+    }
+
+    for (i = 0; i < size; i++) {
+        if (0 == lba) {
+            if (offset < sizeof(mscBootSector)) {
+                buf[i] = mscBootSector[offset];
+            } else if (MSC_DISK_BS_SIGNATURE == offset) {
+                buf[i] = 0x55;
+            } else if (MSC_DISK_BS_SIGNATURE + 1 == offset) {
+                buf[i] = 0xAA;
+            } else {
+                buf[i] = 0;
+            }
+            if (MSC_DISK_BS_TOTAL_SECTORS == offset) {
+                buf[i] = (char)mscDiskSectors;
+            } else if (MSC_DISK_BS_TOTAL_SECTORS + 1 == offset) {
+                buf[i] = (char)(mscDiskSectors >> 8);
+            }
+        } else if (lba < MSC_DISK_ROOT_LBA) {
+            buf[i] = mscDiskFatByte(offset);
+        } else {
+            buf[i] = mscDiskDirByte(offset);
+        }
+        offset++;
+    }
+}
+
+#endif /* PROTO_MSC_ENDPOINT */
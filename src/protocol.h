@@ -3,9 +3,213 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+/* The telemetry fields, the report profiles and the report sizes are
+   described in tools/protocol.schema; tools/protogen.py generates their
+   constants, the HID descriptors and the sample packer. */
+#include "protocol_gen.h"
+
+/** A telemetry sample. Each field is held as a 16-bit signed value; its
+    schema width and scale apply to the sample feature report. */
 typedef struct {
-    char dummy1;
-    char dummy2;
+    short field[PROTO_NUM_FIELDS];
 } statusType;
 
+/* Samples are taken at a fixed rate, also while the device is not
+   configured. The counter field is the sample number, it also counts
+   samples the device had to drop; it starts over at every reset. The
+   boot field counts resets, modulo 16, and the status field carries the
+   flags below.
+
+   Samples taken while the device was not configured are kept, up to a
+   limit, and sent once it is configured again: after the live samples
+   in each report, so reports come at the full endpoint rate until the
+   backlog is out. Stored samples survive a power cycle, so the backlog
+   may come from an earlier boot than the live samples: sort by boot,
+   then by sample number, to rebuild the timeline. */
+
+/** Samples were dropped before this one, the device fell behind */
+#define PROTO_STATUS_OVERRUN 0x01
+/** A stored sample, taken while the device was not configured */
+#define PROTO_STATUS_BACKLOG 0x02
+
+/* Report types, byte 0 of every interrupt IN report */
+#define PROTO_RPT_TELEMETRY 0
+#define PROTO_RPT_ECHO 1
+
+/* Telemetry report format
+
+   Each telemetry report carries a run of samples:
+
+     byte 0     PROTO_RPT_TELEMETRY
+     byte 1     header: PROTO_HDR_KEY flag, sequence number (0-127)
+     byte 2     number of samples in the report
+     byte 3...  bit stream, LSB of each byte first, zero-padded
+
+   Every sample is coded as the difference from the previous sample:
+   PROTO_NUM_FIELDS change bits (bit n set if field n changed), followed by
+   the zigzag-coded difference of each changed field as a varint made of
+   4-bit groups (3 value bits, LSB group first, then a continuation bit).
+
+   In a key report, the first sample is coded against an all-zero sample,
+   so a host that lost reports (seen as a sequence number gap) can resync.
+   Otherwise, the first sample is coded against the last sample of the
+   previous report. */
+
+/* Report profiles
+
+   The report size and the polling interval of the interrupt IN endpoint
+   are set by the active profile. The descriptors and the endpoint buffers
+   are generated from the values below. The host selects a profile with
+   PROTO_VREQ_SET_PROFILE; if the profile changes, the device disconnects
+   and reconnects so the host picks up the new descriptors. */
+
+/* Sample feature report
+
+   HID Get_Report(Feature) returns the latest sample, PROTO_SAMPLE_SIZE
+   bytes: every field in its schema width, LSB first, packed back to back
+   in field order. The report descriptor gives the width, range and scale
+   of each field. There are no report IDs. */
+
+/* Vendor requests (bmRequestType 0x40 / 0xC0, recipient device) */
+
+/** Select a profile, wValue = profile. No data stage. */
+#define PROTO_VREQ_SET_PROFILE 1
+/** Read the active profile, one byte */
+#define PROTO_VREQ_GET_PROFILE 2
+/** Latency probe, wValue = tag. Returns an echoReplyType. */
+#define PROTO_VREQ_ECHO 3
+/** Start a firmware update, wValue = first block (the first block of the
+    region), wIndex = number of blocks. No data stage; the status stage
+    is NAKed while the application's first block is erased. */
+#define PROTO_VREQ_FW_BEGIN 4
+/** Firmware block, wValue = block, wIndex = CRC of the data. Data stage:
+    PROTO_FW_BLOCK_SIZE bytes. The status stage is NAKed while no buffer
+    is free for the next block. */
+#define PROTO_VREQ_FW_BLOCK 5
+/** Finish the update, wValue = CRC of the whole image. No data stage;
+    the status stage is NAKed until the image has been written and
+    checked, and stalled if the check fails. */
+#define PROTO_VREQ_FW_END 6
+/** Read the update status, returns an fwStatusType */
+#define PROTO_VREQ_FW_STATUS 7
+/** Start the application once the update is done (PROTO_FW_DONE): the
+    device detaches and resets into it. No data stage. */
+#define PROTO_VREQ_FW_RUN 8
+/** Read the endpoint halt counters, four 16-bit words LSB first: halts,
+    halts cleared, recovery of the last halt cleared and longest
+    recovery, in milliseconds (usbHaltStats) */
+#define PROTO_VREQ_GET_HALT_STATS 9
+/** Microsoft OS 2.0 descriptor set, wIndex = 7. Answered by the USB
+    stack (USB_CFG_MSOS20_VENDOR_CODE); Windows reads it to bind the
+    vendor interface to WinUSB. */
+#define PROTO_VREQ_MSOS20 10
+/** Read the vendor interface counters, two 32-bit words LSB first:
+    packets and bytes looped back (vndStats). Stalled without the
+    interface. */
+#define PROTO_VREQ_GET_VENDOR_STATS 11
+
+/* Commands, sent as interrupt OUT reports (PROTO_CMD_REPORT_SIZE bytes).
+   Byte 0 is the command. */
+
+/** Latency probe, echoed back as a PROTO_RPT_ECHO report */
+#define PROTO_CMD_ECHO 1
+
+/* Latency probe
+
+   The device stamps a probe with the USB frame number (UFRM, 1 ms) and
+   the latency timer (PROTO_ECHO_TICKS_PER_MS) when it receives the probe
+   and right before it hands the reply to the SIE. The time the host
+   collected a reply is only known after the fact, so it is returned with
+   the next reply (prev fields).
+
+   All multi-byte values are little-endian. */
+
+#define PROTO_ECHO_TICKS_PER_MS 1500
+
+typedef struct {
+    unsigned char cmd; /**< PROTO_CMD_ECHO */
+    unsigned char reserved;
+    unsigned short tag;
+} echoCommandType;
+
+typedef struct {
+    unsigned char type; /**< PROTO_RPT_ECHO */
+    unsigned char reserved;
+    unsigned short tag;
+    unsigned short rxFrame;
+    unsigned short rxTicks;
+    unsigned short txFrame;
+    unsigned short txTicks;
+    unsigned short prevTag; /**< Tag of the previous reply on EP1 IN */
+    unsigned short prevDoneFrame; /**< When the host collected it */
+    unsigned short prevDoneTicks;
+} echoReplyType;
+
+/* Firmware update
+
+   Flash is updated in blocks of PROTO_FW_BLOCK_SIZE bytes (the flash erase
+   block); block n starts at address n * PROTO_FW_BLOCK_SIZE. CRCs are
+   CRC-16/CCITT-FALSE: polynomial 0x1021, initial value PROTO_FW_CRC_INIT,
+   MSB first. The image CRC covers all blocks from the first one, in
+   address order.
+
+   The device firmware is a resident loader below PROTO_FW_REGION_START
+   (src/18f2550_loader.lkr); the region holds the application image. An
+   update starts at the first block of the region, which holds the
+   application's vectors: its reset vector at PROTO_FW_APP_RESET and its
+   interrupt vectors at PROTO_FW_APP_HIGH_VECTOR and
+   PROTO_FW_APP_LOW_VECTOR. That block is erased when the update begins
+   and written last, once the image CRC matches. At reset, the loader
+   starts the application if that block is written, unless RB0 is held
+   low. The application must leave access RAM byte
+   PROTO_FW_APP_FLAG_ADDRESS alone: the loader's interrupt vectors use it
+   to pass interrupts on to the application. */
+
+#define PROTO_FW_BLOCK_SIZE 64
+
+/** Updatable program memory region, aligned to PROTO_FW_BLOCK_SIZE */
+#define PROTO_FW_REGION_START 0x4000
+#define PROTO_FW_REGION_END 0x8000
+#define PROTO_FW_CRC_INIT 0xFFFF
+
+/** Application entry points */
+#define PROTO_FW_APP_RESET PROTO_FW_REGION_START
+#define PROTO_FW_APP_HIGH_VECTOR (PROTO_FW_REGION_START + 0x08)
+#define PROTO_FW_APP_LOW_VECTOR (PROTO_FW_REGION_START + 0x18)
+
+/** Access RAM byte kept by the loader */
+#define PROTO_FW_APP_FLAG_ADDRESS 0x5F
+
+/* fwStatusType.state */
+#define PROTO_FW_IDLE 0
+#define PROTO_FW_ACTIVE 1 /**< Blocks are being received */
+#define PROTO_FW_DONE 2 /**< The image has been checked */
+#define PROTO_FW_FAILED 3 /**< See error */
+
+/* fwStatusType.error */
+#define PROTO_FW_OK 0
+#define PROTO_FW_ERANGE 1 /**< Block outside the updatable region */
+#define PROTO_FW_ECRC 2 /**< Block data does not match its CRC */
+#define PROTO_FW_EVERIFY 3 /**< Flash contents differ after writing */
+#define PROTO_FW_EIMAGE 4 /**< Image CRC mismatch */
+#define PROTO_FW_ESTATE 5 /**< Request out of sequence */
+
+typedef struct {
+    unsigned char state;
+    unsigned char error;
+    unsigned short blocksWritten; /**< Blocks written and verified */
+    unsigned short lastBlock; /**< Last block received */
+} fwStatusType;
+
+/** Header flag: the report starts with a key sample */
+#define PROTO_HDR_KEY 0x80
+#define PROTO_HDR_SEQ_MASK 0x7F
+
+/** Offset of the sample bit stream in a report */
+#define PROTO_HDR_SIZE 3
+
+/** Varint group: value bits and the continuation flag */
+#define PROTO_VARINT_BITS 3
+#define PROTO_VARINT_CONT 0x08
+
 #endif /* PROTOCOL_H */
@@ -0,0 +1,365 @@
+/** Generated by tools/protogen.py from tools/protocol.schema, do not edit */
+
+#ifndef PROTOCOL_GEN_H
+#define PROTOCOL_GEN_H
+
+/** Number of telemetry fields in a sample */
+#define PROTO_NUM_FIELDS 5
+
+/* Telemetry fields, index into statusType.field */
+#define PROTO_FIELD_COUNTER 0 /**< 16 bits, unsigned, 1 count */
+#define PROTO_FIELD_TEMPERATURE 1 /**< 12 bits, signed, 0.0625 degC */
+#define PROTO_FIELD_VOLTAGE 2 /**< 10 bits, unsigned, 0.00489 V */
+#define PROTO_FIELD_STATUS 3 /**< 4 bits, unsigned, 1 raw */
+#define PROTO_FIELD_BOOT 4 /**< 4 bits, unsigned, 1 raw */
+
+/* Report profiles, the first one is the default */
+#define PROTO_PROFILE_LOW 0 /**< 32-byte reports every 10 ms */
+#define PROTO_LOW_REPORT_SIZE 32
+#define PROTO_LOW_INTERVAL_MS 10
+#define PROTO_PROFILE_HIGH 1 /**< 64-byte reports every 1 ms */
+#define PROTO_HIGH_REPORT_SIZE 64
+#define PROTO_HIGH_INTERVAL_MS 1
+#define PROTO_NUM_PROFILES 2
+
+/** Largest interrupt IN report of all profiles */
+#define PROTO_MAX_REPORT_SIZE 64
+
+/** Size of an interrupt OUT report */
+#define PROTO_CMD_REPORT_SIZE 32
+
+/** Mass storage interface (Bulk-Only Transport) and its bulk
+    IN and OUT endpoint */
+#define PROTO_MSC_INTERFACE 1
+#define PROTO_MSC_ENDPOINT 2
+#define PROTO_MSC_PACKET_SIZE 64
+
+/** Vendor interface, bound to WinUSB by the Microsoft OS 2.0
+    descriptor set, and its bulk IN and OUT endpoint */
+#define PROTO_VENDOR_INTERFACE 2
+#define PROTO_VENDOR_ENDPOINT 3
+#define PROTO_VENDOR_PACKET_SIZE 64
+/** Device interface GUID of the vendor interface */
+#define PROTO_VENDOR_GUID "{47258F10-5B93-4F84-84C5-2398883853B6}"
+
+/** Sample feature report: the fields packed LSB first, in field
+    order, each in its own width */
+#define PROTO_SAMPLE_BITS 46
+#define PROTO_SAMPLE_SIZE 6
+
+/** Pack a statusType *s into PROTO_SAMPLE_SIZE bytes at buf */
+#define PROTO_PACK_SAMPLE(buf, s) \
+    do { \
+        (buf)[0] = (unsigned char)((unsigned int)(s)->field[0]); \
+        (buf)[1] = (unsigned char)(((unsigned int)(s)->field[0] >> 8)); \
+        (buf)[2] = (unsigned char)((unsigned int)(s)->field[1]); \
+        (buf)[3] = (unsigned char)((((unsigned int)(s)->field[1] >> 8) & 0x0F) | (((unsigned int)(s)->field[2] & 0x0F) << 4)); \
+        (buf)[4] = (unsigned char)((((unsigned int)(s)->field[2] >> 4) & 0x3F) | (((unsigned int)(s)->field[3] & 0x03) << 6)); \
+        (buf)[5] = (unsigned char)((((unsigned int)(s)->field[3] >> 2) & 0x03) | (((unsigned int)(s)->field[4] & 0x0F) << 2)); \
+    } while (0)
+
+/** Unpack PROTO_SAMPLE_SIZE bytes at buf into a statusType *s */
+#define PROTO_UNPACK_SAMPLE(s, buf) \
+    do { \
+        (s)->field[0] = (short)((unsigned int)(unsigned char)(buf)[0] | ((unsigned int)(unsigned char)(buf)[1] << 8)); \
+        (s)->field[1] = (short)(((((unsigned int)(unsigned char)(buf)[2] | ((unsigned int)(unsigned char)(buf)[3] << 8)) & 0xFFF) ^ 0x800) - 0x800); \
+        (s)->field[2] = (short)((((unsigned int)(unsigned char)(buf)[3] >> 4) | ((unsigned int)(unsigned char)(buf)[4] << 4)) & 0x3FF); \
+        (s)->field[3] = (short)((((unsigned int)(unsigned char)(buf)[4] >> 6) | ((unsigned int)(unsigned char)(buf)[5] << 2)) & 0xF); \
+        (s)->field[4] = (short)((((unsigned int)(unsigned char)(buf)[5] >> 2)) & 0xF); \
+    } while (0)
+
+/* Descriptors of every profile. The configuration descriptor is
+   the header, the HID interface, the HID endpoints of the profile
+   and, with mass storage, PROTO_MSC_INTERFACE_DESCRIPTORS, then
+   PROTO_VENDOR_INTERFACE_DESCRIPTORS. */
+#define PROTO_HID_REPORT_DESCRIPTOR_SIZE 136
+
+#define PROTO_CONFIGURATION_HEADER \
+{ \
+    0x09,       /* Size in bytes */ \
+    0x02,       /* Configuration Descriptor */ \
+    0x00, 0x00, /* Total size in bytes, filled in when sent */ \
+    0x03,       /* Number of interfaces */ \
+    0x01,       /* Configuration index */ \
+    0x00,       /* Configuration string */ \
+    0x60,       /* Self-powered, remote wakeup */ \
+    0x32        /* 100 mA power consumption */ \
+}
+
+#define PROTO_HID_INTERFACE \
+{ \
+    0x09,       /* Size in bytes */ \
+    0x04,       /* Interface Descriptor */ \
+    0x00,       /* Interface number */ \
+    0x00,       /* Alternate setting number */ \
+    0x02,       /* Number of endpoints, excluding EP0 */ \
+    0x03,       /* HID Class */ \
+    0x00,       /* Subclass */ \
+    0x00,       /* Protocol */ \
+    0x00,       /* Interface string */ \
+    0x09,       /* Size in bytes */ \
+    0x21,       /* HID Descriptor */ \
+    0x01, 0x01, /* HID 1.1 Compliant */ \
+    0x00,       /* Country code (0 = not localized) */ \
+    0x01,       /* Number of subordinate descriptors */ \
+    0x22,       /* Descriptor type (report) */ \
+    0x88, 0x00  /* Report descriptor size in bytes */ \
+}
+
+#define PROTO_MSC_INTERFACE_DESCRIPTORS \
+{ \
+    0x09,       /* Size in bytes */ \
+    0x04,       /* Interface Descriptor */ \
+    0x01,       /* Interface number */ \
+    0x00,       /* Alternate setting number */ \
+    0x02,       /* Number of endpoints, excluding EP0 */ \
+    0x08,       /* Mass Storage Class */ \
+    0x06,       /* SCSI transparent command set */ \
+    0x50,       /* Bulk-Only Transport */ \
+    0x00,       /* Interface string */ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x82,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x02,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x40, 0x00, /* Max packet size (0-1023) */ \
+    0x00,       /* Polling interval, unused for Bulk */ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x02,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x02,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x40, 0x00, /* Max packet size (0-1023) */ \
+    0x00        /* Polling interval, unused for Bulk */ \
+}
+
+#define PROTO_VENDOR_INTERFACE_DESCRIPTORS \
+{ \
+    0x09,       /* Size in bytes */ \
+    0x04,       /* Interface Descriptor */ \
+    0x02,       /* Interface number */ \
+    0x00,       /* Alternate setting number */ \
+    0x02,       /* Number of endpoints, excluding EP0 */ \
+    0xFF,       /* Vendor Specific Class */ \
+    0x00,       /* Subclass */ \
+    0x00,       /* Protocol */ \
+    0x00,       /* Interface string */ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x83,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x02,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x40, 0x00, /* Max packet size (0-1023) */ \
+    0x00,       /* Polling interval, unused for Bulk */ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x03,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x02,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x40, 0x00, /* Max packet size (0-1023) */ \
+    0x00        /* Polling interval, unused for Bulk */ \
+}
+
+/** Microsoft OS 2.0 descriptor set, read with a vendor request */
+#define PROTO_MSOS20_DESCRIPTOR_SET_SIZE 178
+
+#define PROTO_MSOS20_DESCRIPTOR_SET \
+{ \
+    0x0A, 0x00,                                     /* Size in bytes */ \
+    0x00, 0x00,                                     /* MS_OS_20_SET_HEADER_DESCRIPTOR */ \
+    0x00, 0x00, 0x03, 0x06,                         /* Windows version */ \
+    0xB2, 0x00,                                     /* Total size in bytes */ \
+    0x08, 0x00,                                     /* Size in bytes */ \
+    0x01, 0x00,                                     /* MS_OS_20_SUBSET_HEADER_CONFIGURATION */ \
+    0x00,                                           /* Configuration index */ \
+    0x00,                                           /* Reserved */ \
+    0xA8, 0x00,                                     /* Configuration subset size in bytes */ \
+    0x08, 0x00,                                     /* Size in bytes */ \
+    0x02, 0x00,                                     /* MS_OS_20_SUBSET_HEADER_FUNCTION */ \
+    0x02,                                           /* First interface */ \
+    0x00,                                           /* Reserved */ \
+    0xA0, 0x00,                                     /* Function subset size in bytes */ \
+    0x14, 0x00,                                     /* Size in bytes */ \
+    0x03, 0x00,                                     /* MS_OS_20_FEATURE_COMPATIBLE_ID */ \
+    0x57, 0x49, 0x4E, 0x55, 0x53, 0x42, 0x00, 0x00, /* Compatible ID */ \
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* Sub-compatible ID */ \
+    0x84, 0x00,                                     /* Size in bytes */ \
+    0x04, 0x00,                                     /* MS_OS_20_FEATURE_REG_PROPERTY */ \
+    0x07, 0x00,                                     /* REG_MULTI_SZ */ \
+    0x2A, 0x00,                                     /* Property name size in bytes */ \
+    0x44, 0x00, 0x65, 0x00, 0x76, 0x00, 0x69, 0x00, /* DeviceInterfaceGUIDs */ \
+    0x63, 0x00, 0x65, 0x00, 0x49, 0x00, 0x6E, 0x00, \
+    0x74, 0x00, 0x65, 0x00, 0x72, 0x00, 0x66, 0x00, \
+    0x61, 0x00, 0x63, 0x00, 0x65, 0x00, 0x47, 0x00, \
+    0x55, 0x00, 0x49, 0x00, 0x44, 0x00, 0x73, 0x00, \
+    0x00, 0x00,                                     \
+    0x50, 0x00,                                     /* Property data size in bytes */ \
+    0x7B, 0x00, 0x34, 0x00, 0x37, 0x00, 0x32, 0x00, /* {47258F10-5B93-4F84-84C5-2398883853B6} */ \
+    0x35, 0x00, 0x38, 0x00, 0x46, 0x00, 0x31, 0x00, \
+    0x30, 0x00, 0x2D, 0x00, 0x35, 0x00, 0x42, 0x00, \
+    0x39, 0x00, 0x33, 0x00, 0x2D, 0x00, 0x34, 0x00, \
+    0x46, 0x00, 0x38, 0x00, 0x34, 0x00, 0x2D, 0x00, \
+    0x38, 0x00, 0x34, 0x00, 0x43, 0x00, 0x35, 0x00, \
+    0x2D, 0x00, 0x32, 0x00, 0x33, 0x00, 0x39, 0x00, \
+    0x38, 0x00, 0x38, 0x00, 0x38, 0x00, 0x33, 0x00, \
+    0x38, 0x00, 0x35, 0x00, 0x33, 0x00, 0x42, 0x00, \
+    0x36, 0x00, 0x7D, 0x00, 0x00, 0x00, 0x00, 0x00  \
+}
+
+#define PROTO_HID_REPORT_DESCRIPTOR_LOW \
+{ \
+    0x06, 0x00, 0xFF,             /* USAGE_PAGE (Vendor Defined Page 1) */ \
+    0x09, 0x01,                   /* USAGE (Vendor Usage 1) */ \
+    0xA1, 0x01,                   /* COLLECTION (Application) */ \
+    0x09, 0x02,                   /* USAGE (Vendor Usage 2) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x26, 0xFF, 0x00,             /* LOGICAL_MAXIMUM (255) */ \
+    0x95, 0x20,                   /* REPORT_COUNT (32) */ \
+    0x75, 0x08,                   /* REPORT_SIZE (8) */ \
+    0x81, 0x02,                   /* INPUT (Data,Var,Abs) */ \
+    0x09, 0x03,                   /* USAGE (Vendor Usage 3) */ \
+    0x95, 0x20,                   /* REPORT_COUNT (32) */ \
+    0x91, 0x02,                   /* OUTPUT (Data,Var,Abs) */ \
+    0x09, 0x10,                   /* USAGE (Vendor Usage 16) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x27, 0xFF, 0xFF, 0x00, 0x00, /* LOGICAL_MAXIMUM (65535) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x45, 0x00,                   /* PHYSICAL_MAXIMUM (0) */ \
+    0x55, 0x00,                   /* UNIT_EXPONENT (0) */ \
+    0x75, 0x10,                   /* REPORT_SIZE (16) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) counter */ \
+    0x09, 0x11,                   /* USAGE (Vendor Usage 17) */ \
+    0x16, 0x00, 0xF8,             /* LOGICAL_MINIMUM (-2048) */ \
+    0x26, 0xFF, 0x07,             /* LOGICAL_MAXIMUM (2047) */ \
+    0x37, 0x00, 0x78, 0xEC, 0xFF, /* PHYSICAL_MINIMUM (-1280000) */ \
+    0x47, 0x8F, 0x85, 0x13, 0x00, /* PHYSICAL_MAXIMUM (1279375) */ \
+    0x55, 0x0C,                   /* UNIT_EXPONENT (-4) */ \
+    0x75, 0x0C,                   /* REPORT_SIZE (12) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) temperature */ \
+    0x09, 0x12,                   /* USAGE (Vendor Usage 18) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x26, 0xFF, 0x03,             /* LOGICAL_MAXIMUM (1023) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x47, 0x17, 0xA2, 0x07, 0x00, /* PHYSICAL_MAXIMUM (500247) */ \
+    0x55, 0x0B,                   /* UNIT_EXPONENT (-5) */ \
+    0x75, 0x0A,                   /* REPORT_SIZE (10) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) voltage */ \
+    0x09, 0x13,                   /* USAGE (Vendor Usage 19) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x25, 0x0F,                   /* LOGICAL_MAXIMUM (15) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x45, 0x00,                   /* PHYSICAL_MAXIMUM (0) */ \
+    0x55, 0x00,                   /* UNIT_EXPONENT (0) */ \
+    0x75, 0x04,                   /* REPORT_SIZE (4) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) status */ \
+    0x09, 0x14,                   /* USAGE (Vendor Usage 20) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x25, 0x0F,                   /* LOGICAL_MAXIMUM (15) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x45, 0x00,                   /* PHYSICAL_MAXIMUM (0) */ \
+    0x55, 0x00,                   /* UNIT_EXPONENT (0) */ \
+    0x75, 0x04,                   /* REPORT_SIZE (4) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) boot */ \
+    0x75, 0x02,                   /* REPORT_SIZE (2) */ \
+    0xB1, 0x03,                   /* FEATURE (Cnst,Var,Abs) padding */ \
+    0xC0                          /* END_COLLECTION */ \
+}
+
+#define PROTO_HID_ENDPOINTS_LOW \
+{ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x81,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x03,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x20, 0x00, /* Max packet size (0-1023) */ \
+    0x0A,       /* Max polling latency, ms for Interrupt */ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x01,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x03,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x20, 0x00, /* Max packet size (0-1023) */ \
+    0x0A        /* Max polling latency, ms for Interrupt */ \
+}
+
+#define PROTO_HID_REPORT_DESCRIPTOR_HIGH \
+{ \
+    0x06, 0x00, 0xFF,             /* USAGE_PAGE (Vendor Defined Page 1) */ \
+    0x09, 0x01,                   /* USAGE (Vendor Usage 1) */ \
+    0xA1, 0x01,                   /* COLLECTION (Application) */ \
+    0x09, 0x02,                   /* USAGE (Vendor Usage 2) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x26, 0xFF, 0x00,             /* LOGICAL_MAXIMUM (255) */ \
+    0x95, 0x40,                   /* REPORT_COUNT (64) */ \
+    0x75, 0x08,                   /* REPORT_SIZE (8) */ \
+    0x81, 0x02,                   /* INPUT (Data,Var,Abs) */ \
+    0x09, 0x03,                   /* USAGE (Vendor Usage 3) */ \
+    0x95, 0x20,                   /* REPORT_COUNT (32) */ \
+    0x91, 0x02,                   /* OUTPUT (Data,Var,Abs) */ \
+    0x09, 0x10,                   /* USAGE (Vendor Usage 16) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x27, 0xFF, 0xFF, 0x00, 0x00, /* LOGICAL_MAXIMUM (65535) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x45, 0x00,                   /* PHYSICAL_MAXIMUM (0) */ \
+    0x55, 0x00,                   /* UNIT_EXPONENT (0) */ \
+    0x75, 0x10,                   /* REPORT_SIZE (16) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) counter */ \
+    0x09, 0x11,                   /* USAGE (Vendor Usage 17) */ \
+    0x16, 0x00, 0xF8,             /* LOGICAL_MINIMUM (-2048) */ \
+    0x26, 0xFF, 0x07,             /* LOGICAL_MAXIMUM (2047) */ \
+    0x37, 0x00, 0x78, 0xEC, 0xFF, /* PHYSICAL_MINIMUM (-1280000) */ \
+    0x47, 0x8F, 0x85, 0x13, 0x00, /* PHYSICAL_MAXIMUM (1279375) */ \
+    0x55, 0x0C,                   /* UNIT_EXPONENT (-4) */ \
+    0x75, 0x0C,                   /* REPORT_SIZE (12) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) temperature */ \
+    0x09, 0x12,                   /* USAGE (Vendor Usage 18) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x26, 0xFF, 0x03,             /* LOGICAL_MAXIMUM (1023) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x47, 0x17, 0xA2, 0x07, 0x00, /* PHYSICAL_MAXIMUM (500247) */ \
+    0x55, 0x0B,                   /* UNIT_EXPONENT (-5) */ \
+    0x75, 0x0A,                   /* REPORT_SIZE (10) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) voltage */ \
+    0x09, 0x13,                   /* USAGE (Vendor Usage 19) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x25, 0x0F,                   /* LOGICAL_MAXIMUM (15) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x45, 0x00,                   /* PHYSICAL_MAXIMUM (0) */ \
+    0x55, 0x00,                   /* UNIT_EXPONENT (0) */ \
+    0x75, 0x04,                   /* REPORT_SIZE (4) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) status */ \
+    0x09, 0x14,                   /* USAGE (Vendor Usage 20) */ \
+    0x15, 0x00,                   /* LOGICAL_MINIMUM (0) */ \
+    0x25, 0x0F,                   /* LOGICAL_MAXIMUM (15) */ \
+    0x35, 0x00,                   /* PHYSICAL_MINIMUM (0) */ \
+    0x45, 0x00,                   /* PHYSICAL_MAXIMUM (0) */ \
+    0x55, 0x00,                   /* UNIT_EXPONENT (0) */ \
+    0x75, 0x04,                   /* REPORT_SIZE (4) */ \
+    0x95, 0x01,                   /* REPORT_COUNT (1) */ \
+    0xB1, 0x02,                   /* FEATURE (Data,Var,Abs) boot */ \
+    0x75, 0x02,                   /* REPORT_SIZE (2) */ \
+    0xB1, 0x03,                   /* FEATURE (Cnst,Var,Abs) padding */ \
+    0xC0                          /* END_COLLECTION */ \
+}
+
+#define PROTO_HID_ENDPOINTS_HIGH \
+{ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x81,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x03,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x40, 0x00, /* Max packet size (0-1023) */ \
+    0x01,       /* Max polling latency, ms for Interrupt */ \
+    0x07,       /* Size in bytes */ \
+    0x05,       /* Endpoint Descriptor */ \
+    0x01,       /* Endpoint and direction. Bit 7: OUT=0, IN=1 */ \
+    0x03,       /* 0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt */ \
+    0x20, 0x00, /* Max packet size (0-1023) */ \
+    0x01        /* Max polling latency, ms for Interrupt */ \
+}
+
+#endif /* PROTOCOL_GEN_H */
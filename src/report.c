@@ -0,0 +1,158 @@
+/* Telemetry report encoder implementation */
+
+/* Samples are first sized, then written, so a sample that does not fit
+   leaves the report untouched. All arithmetic is on 16-bit unsigned values
+   so the differences wrap around exactly as the host expects. */
+
+#include <p18f2550.h>
+
+#include "report.h"
+
+#include "string.h"
+
+/** Every RPT_CFG_KEY_INTERVAL-th report is a key report */
+#define RPT_CFG_KEY_INTERVAL 16
+
+#if PROTO_NUM_FIELDS > 8
+#error "The change bits of a sample must fit in a byte"
+#endif
+
+typedef struct {
+    unsigned char *buf;
+    int size;
+    unsigned int bitPos; /**< Next bit to write */
+    unsigned char count; /**< Samples in the current report */
+    unsigned char seq; /**< Sequence number of the current report */
+    unsigned char reportsToKey; /**< Reports left until the next key report */
+    char key; /**< The current report is a key report */
+    statusType prev; /**< The sample the next one is coded against */
+} rptInternalState;
+
+static rptInternalState rptState;
+
+void rptInit(void)
+{
+    rptState.seq = 0;
+    rptState.reportsToKey = 0;
+    rptState.count = 0;
+}
+
+void rptBegin(char *buf, int size)
+{
+    rptState.buf = (unsigned char *)buf;
+    rptState.size = size;
+    rptState.bitPos = PROTO_HDR_SIZE * 8;
+    rptState.count = 0;
+    (void) memset((void *)buf, 0, size);
+
+    rptState.key = (0 == rptState.reportsToKey);
+    if (rptState.key) {
+        (void) memset((void *)&rptState.prev, 0, sizeof(statusType));
+    }
+}
+
+unsigned int rptZigzag(unsigned int diff)
+{
+    if (0 != (diff & 0x8000)) {
+        return (~diff << 1) | 1;
+    }
+    return diff << 1;
+}
+
+/* Number of bits taken by a varint */
+unsigned char rptVarintBits(unsigned int value)
+{
+    unsigned char bits = PROTO_VARINT_BITS + 1;
+
+    value >>= PROTO_VARINT_BITS;
+    while (0 != value) {
+        bits += PROTO_VARINT_BITS + 1;
+        value >>= PROTO_VARINT_BITS;
+    }
+    return bits;
+}
+
+/* Append up to 8 bits to the report, LSB first */
+void rptPutBits(unsigned char value, unsigned char count)
+{
+    unsigned char *p = rptState.buf + (rptState.bitPos >> 3);
+    unsigned char shift = rptState.bitPos & 7;
+
+    *p |= value << shift;
+    if (shift + count > 8) {
+        p[1] |= value >> (8 - shift);
+    }
+    rptState.bitPos += count;
+}
+
+void rptPutVarint(unsigned int value)
+{
+    unsigned char group;
+
+    do {
+        group = value & ((1 << PROTO_VARINT_BITS) - 1);
+        value >>= PROTO_VARINT_BITS;
+        if (0 != value) {
+            group |= PROTO_VARINT_CONT;
+        }
+        rptPutBits(group, PROTO_VARINT_BITS + 1);
+    } while (0 != value);
+}
+
+usbError rptAddSample(const statusType *sample)
+{
+    unsigned int diff[PROTO_NUM_FIELDS];
+    unsigned char changed = 0;
+    unsigned int bits = PROTO_NUM_FIELDS;
+    char i;
+
+    if ((unsigned char)0xFF == rptState.count) {
+        return USB_ENOMEM;
+    }
+
+    for (i = 0; i < PROTO_NUM_FIELDS; i++) {
+        diff[i] = rptZigzag((unsigned int)sample->field[i] -
+                            (unsigned int)rptState.prev.field[i]);
+        if (0 != diff[i]) {
+            changed |= (unsigned char)1 << i;
+            bits += rptVarintBits(diff[i]);
+        }
+    }
+
+    if (rptState.bitPos + bits > (unsigned int)rptState.size * 8) {
+        return USB_ENOMEM;
+    }
+
+    rptPutBits(changed, PROTO_NUM_FIELDS);
+    for (i = 0; i < PROTO_NUM_FIELDS; i++) {
+        if (0 != diff[i]) {
+            rptPutVarint(diff[i]);
+        }
+    }
+
+    rptState.prev = *sample;
+    rptState.count++;
+    return USB_SUCCESS;
+}
+
+unsigned char rptGetCount(void)
+{
+    return rptState.count;
+}
+
+int rptEnd(void)
+{
+    rptState.buf[0] = PROTO_RPT_TELEMETRY;
+    rptState.buf[1] = rptState.seq & PROTO_HDR_SEQ_MASK;
+    if (rptState.key) {
+        rptState.buf[1] |= PROTO_HDR_KEY;
+        rptState.reportsToKey = RPT_CFG_KEY_INTERVAL - 1;
+    } else {
+        rptState.reportsToKey--;
+    }
+    rptState.buf[2] = rptState.count;
+    rptState.seq++;
+
+    /* HID reports are always sent in full */
+    return rptState.size;
+}
@@ -0,0 +1,35 @@
+/** Telemetry report encoder header
+
+    Packs statusType samples into interrupt IN reports, using the delta and
+    varint coding described in protocol.h. Every RPT_CFG_KEY_INTERVAL-th
+    report is a key report.
+
+    Typical use: rptBegin() on a report buffer, rptAddSample() until it
+    returns USB_ENOMEM, then rptEnd() and send the report.
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "usb.h"
+#include "protocol.h"
+
+/** Reset the encoder. The next report will be a key report. */
+void rptInit(void);
+
+/** Start a new report in buf. The buffer is cleared. */
+void rptBegin(char *buf, int size);
+
+/** Append a sample to the current report.
+
+    Returns USB_ENOMEM, without changing the report, if the sample does not
+    fit. */
+usbError rptAddSample(const statusType *sample);
+
+/** Number of samples in the current report */
+unsigned char rptGetCount(void);
+
+/** Finish the current report. Returns the report size. */
+int rptEnd(void);
+
+#endif /* REPORT_H */
@@ -0,0 +1,166 @@
+/* Cooperative task scheduler implementation */
+
+/* Ready flags are kept in a single byte, one bit per task. The interrupt
+   handler sets bits with a single read-modify-write instruction (IORWF),
+   and tasks clear them with ANDWF, so neither side needs to disable
+   interrupts to update the flags. */
+
+#include <p18f2550.h>
+
+#include "sched.h"
+
+/** Max number of tasks, one bit of schedReady each */
+#define SCHED_CFG_NUM_TASKS 8
+
+/* Timer 2 setup for a 1 ms tick at Fosc = 48 MHz:
+   12 MHz instruction clock / prescale 16 / (PR2 + 1) / postscale 3 */
+#define SCHED_T2CON 0x16 /* postscale 1:3, TMR2ON, prescale 1:16 */
+#define SCHED_PR2 249
+
+typedef struct {
+    schedTaskFunc func;
+    schedTicks deadline; /**< Time of the next timer expiry */
+    schedTicks period; /**< Timer period, 0 for one-shot */
+    char timerActive;
+} schedTask;
+
+static schedTask schedTasks[SCHED_CFG_NUM_TASKS];
+static char schedNumTasks;
+static char schedDeepSleep;
+
+/* Bit n is set when task n is ready to run */
+static volatile unsigned char schedReady;
+
+/* Incremented from the interrupt handler */
+static volatile schedTicks schedTickCount;
+
+void schedInit(void)
+{
+    schedNumTasks = 0;
+    schedReady = 0;
+    schedDeepSleep = 0;
+    schedTickCount = 0;
+
+    TMR2 = 0;
+    PR2 = SCHED_PR2;
+    T2CON = SCHED_T2CON;
+    PIR1bits.TMR2IF = 0;
+    PIE1bits.TMR2IE = 1;
+}
+
+schedTaskId schedAddTask(schedTaskFunc func)
+{
+    schedTask *task;
+
+    if (schedNumTasks >= SCHED_CFG_NUM_TASKS) {
+        return SCHED_NO_TASK;
+    }
+
+    task = &schedTasks[schedNumTasks];
+    task->func = func;
+    task->timerActive = 0;
+    return schedNumTasks++;
+}
+
+void schedPostEvent(schedTaskId task)
+{
+    schedReady |= (unsigned char)1 << task;
+}
+
+schedTicks schedGetTicks(void)
+{
+    schedTicks now;
+
+    /* The tick count is two bytes wide, mask the tick interrupt while
+       reading it */
+    PIE1bits.TMR2IE = 0;
+    now = schedTickCount;
+    PIE1bits.TMR2IE = 1;
+    return now;
+}
+
+void schedStartTimer(schedTaskId task, schedTicks delay, schedTicks period)
+{
+    schedTasks[task].deadline = schedGetTicks() + delay;
+    schedTasks[task].period = period;
+    schedTasks[task].timerActive = 1;
+}
+
+void schedStopTimer(schedTaskId task)
+{
+    schedTasks[task].timerActive = 0;
+}
+
+/* Make the tasks whose timers have expired ready */
+void schedCheckTimers(void)
+{
+    schedTicks now = schedGetTicks();
+    schedTask *task = schedTasks;
+    unsigned char mask = 1;
+    char i;
+
+    for (i = 0; i < schedNumTasks; i++) {
+        /* Signed difference handles the tick count wraparound */
+        if (task->timerActive && ((int)(now - task->deadline) >= 0)) {
+            schedReady |= mask;
+            if (0 == task->period) {
+                task->timerActive = 0;
+            } else {
+                task->deadline = task->deadline + task->period;
+            }
+        }
+        task++;
+        mask <<= 1;
+    }
+}
+
+void schedSetDeepSleep(char deep)
+{
+    schedDeepSleep = deep;
+}
+
+void schedRun(void)
+{
+    schedTask *task;
+    unsigned char mask;
+    char i;
+
+    INTCONbits.PEIE = 1;
+    INTCONbits.GIE = 1;
+
+    while (1) {
+        schedCheckTimers();
+
+        /* With interrupts disabled, an interrupt that is already pending
+           makes SLEEP complete as a NOP, so an event posted between the
+           check and the SLEEP is never missed. The pending interrupt is
+           serviced as soon as GIE is set again. */
+        INTCONbits.GIE = 0;
+        if ((unsigned char)0 == schedReady) {
+            /* Idle mode keeps USB and timers running, Sleep mode stops the
+               oscillator */
+            OSCCONbits.IDLEN = schedDeepSleep ? 0 : 1;
+            Sleep();
+        }
+        INTCONbits.GIE = 1;
+
+        task = schedTasks;
+        mask = 1;
+        for (i = 0; i < schedNumTasks; i++) {
+            if ((unsigned char)0 != (schedReady & mask)) {
+                schedReady &= ~mask;
+                task->func();
+            }
+            task++;
+            mask <<= 1;
+        }
+    }
+}
+
+void schedInterruptHandler(void)
+{
+    if ((unsigned char)1 == PIR1bits.TMR2IF) {
+        PIR1bits.TMR2IF = 0;
+        schedTickCount++;
+    }
+}
@@ -0,0 +1,78 @@
+/** Cooperative task scheduler header
+
+    Tasks are plain functions that run to completion. A task becomes ready
+    when an event is posted to it (from an interrupt handler or from another
+    task) or when its timer expires. Ready tasks run in the order they were
+    added, so tasks added first have priority. When no task is ready, the CPU
+    is put into Idle mode until the next interrupt, or into Sleep mode in
+    deep sleep (schedSetDeepSleep).
+
+    Timer 2 is used to generate the scheduler tick.
+*/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+/** Scheduler tick rate */
+#define SCHED_TICKS_PER_SECOND 1000
+
+/** Convert milliseconds to scheduler ticks */
+#define SCHED_MS(ms) ((schedTicks)(ms))
+
+/** Returned by schedAddTask() when the task table is full */
+#define SCHED_NO_TASK ((schedTaskId)-1)
+
+/** Scheduler time, wraps around every 65.5 seconds */
+typedef unsigned int schedTicks;
+
+/** Task identifier, an index into the task table */
+typedef char schedTaskId;
+
+typedef void (*schedTaskFunc)(void);
+
+/** Initialize the scheduler and start the tick timer */
+void schedInit(void);
+
+/** Add a task to the scheduler.
+
+    Returns the task ID, or SCHED_NO_TASK if there is no room in the
+    task table. */
+schedTaskId schedAddTask(schedTaskFunc func);
+
+/** Make a task ready to run.
+
+    May be called from an interrupt handler. Events are not counted: posting
+    several events before the task runs will run it only once. */
+void schedPostEvent(schedTaskId task);
+
+/** Start (or restart) a task's timer.
+
+    The task becomes ready after delay ticks, and then every period ticks.
+    A zero period makes this a one-shot timer. Periodic deadlines are
+    computed from the previous deadline, not from the time the task
+    actually ran, so the rate does not drift. */
+void schedStartTimer(schedTaskId task, schedTicks delay, schedTicks period);
+
+/** Stop a task's timer. An already posted event is not cancelled. */
+void schedStopTimer(schedTaskId task);
+
+/** Enter or leave deep sleep.
+
+    In deep sleep, the CPU goes to Sleep mode instead of Idle mode when no
+    task is ready: the oscillator stops, and with it the tick and all
+    timers. Only interrupts that need no clock wake it up, such as USB
+    bus activity or an external pin. The scheduler time does not advance
+    while asleep. Meant for USB suspend, see USB_CB_SUSPEND. */
+void schedSetDeepSleep(char deep);
+
+/** Current scheduler time */
+schedTicks schedGetTicks(void);
+
+/** Run the tasks. Enables interrupts and never returns. */
+void schedRun(void);
+
+/** Scheduler interrupt handler, must be called from the high-priority
+    interrupt vector */
+void schedInterruptHandler(void);
+
+#endif /* SCHED_H */
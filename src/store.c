@@ -0,0 +1,223 @@
+/* Store-and-forward implementation */
+
+/* EEPROM log layout, from STORE_CFG_EEPROM_START:
+
+     byte 0      number of samples in the log
+     byte 1      boot number, counted up at every reset
+     byte 2...   the samples, PROTO_SAMPLE_SIZE bytes each
+
+   A sample is spilled by writing its bytes after the last one, then the
+   new count; until the count is written, the sample is still in the RAM
+   ring, so a reset halfway through loses nothing. An erased EEPROM reads
+   as a count of 0xFF, which is taken as an empty log.
+
+   An EEPROM byte write takes about 4 ms. The writer task polls for the
+   end of the previous write and starts the next one, so the main loop is
+   never blocked. All functions run in the main context. */
+
+#include <p18f2550.h>
+
+#include "store.h"
+#include "usb_ctl.h"
+#include "sched.h"
+
+#include "string.h"
+
+#if (STORE_CFG_RING_SIZE > 128) || \
+    (0 != (STORE_CFG_RING_SIZE & (STORE_CFG_RING_SIZE - 1)))
+#error "STORE_CFG_RING_SIZE must be a power of 2 up to 128"
+#endif
+
+#define STORE_MASK (STORE_CFG_RING_SIZE - 1)
+#define STORE_BOOT_ADDR (STORE_CFG_EEPROM_START + 1)
+#define STORE_MAX_SAMPLES ((STORE_CFG_EEPROM_SIZE - 2) / PROTO_SAMPLE_SIZE)
+#define STORE_SAMPLE_ADDR(index) \
+    ((unsigned char)(STORE_CFG_EEPROM_START + 2 + (index) * PROTO_SAMPLE_SIZE))
+
+typedef struct {
+    char ring[STORE_CFG_RING_SIZE][PROTO_SAMPLE_SIZE];
+    unsigned char head; /**< Next sample to write */
+    unsigned char tail; /**< Oldest sample */
+    unsigned char eepromCount; /**< Samples in the EEPROM log */
+    unsigned char eepromRead; /**< Samples taken out of the EEPROM log */
+    unsigned char spillByte; /**< Next byte of the ring tail to spill */
+    unsigned char boot;
+    char flushing;
+    char polling;
+    schedTaskId task;
+    storeStats stats;
+} storeInternalState;
+
+static storeInternalState storeState;
+
+#define STORE_RING_COUNT() ((unsigned char)(storeState.head - storeState.tail))
+
+void storeTask(void);
+void storeWriteEeprom(unsigned char address, unsigned char value);
+
+usbError storeInit(void)
+{
+    (void) memset((void *)&storeState, 0, sizeof(storeState));
+    storeState.eepromCount = usbCtlReadEeprom(STORE_CFG_EEPROM_START);
+    if (storeState.eepromCount > STORE_MAX_SAMPLES) {
+        storeState.eepromCount = 0;
+    }
+    storeState.stats.eepromSamples = storeState.eepromCount;
+
+    /* An erased EEPROM starts at boot 0. No write is in progress yet, the
+       writer task waits for this one to finish. */
+    storeState.boot = (usbCtlReadEeprom(STORE_BOOT_ADDR) + 1) % STORE_BOOT_MODULO;
+    storeWriteEeprom(STORE_BOOT_ADDR, storeState.boot);
+
+    storeState.task = schedAddTask(storeTask);
+    if (SCHED_NO_TASK == storeState.task) {
+        return USB_ENOMEM;
+    }
+    return USB_SUCCESS;
+}
+
+unsigned char storeGetBoot(void)
+{
+    return storeState.boot;
+}
+
+void storePoll(void)
+{
+    if (!storeState.polling) {
+        storeState.polling = 1;
+        schedStartTimer(storeState.task, SCHED_MS(STORE_CFG_POLL_MS),
+                        SCHED_MS(STORE_CFG_POLL_MS));
+    }
+}
+
+/* Start writing an EEPROM byte, unless it already holds the value. The
+   previous write must be done. */
+void storeWriteEeprom(unsigned char address, unsigned char value)
+{
+    unsigned char gie;
+
+    if (usbCtlReadEeprom(address) == value) {
+        return;
+    }
+    EEADR = address;
+    EEDATA = value;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    gie = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    INTCONbits.GIE = gie;
+    EECON1bits.WREN = 0;
+}
+
+usbError storePut(const statusType *sample)
+{
+    statusType backlog;
+
+    if (STORE_RING_COUNT() >= STORE_CFG_RING_SIZE) {
+        storeState.stats.dropped++;
+        return USB_ENOMEM;
+    }
+    backlog = *sample;
+    backlog.field[PROTO_FIELD_STATUS] |= PROTO_STATUS_BACKLOG;
+    PROTO_PACK_SAMPLE(storeState.ring[storeState.head & STORE_MASK], &backlog);
+    storeState.head++;
+    storeState.stats.stored++;
+    if (!storeState.flushing) {
+        storePoll();
+    }
+    return USB_SUCCESS;
+}
+
+void storeSetFlushing(char flushing)
+{
+    storeState.flushing = flushing;
+    if (flushing) {
+        /* A sample halfway spilled stays in the ring */
+        storeState.spillByte = 0;
+    } else {
+        /* Next time, the EEPROM log is sent from the start */
+        storeState.eepromRead = 0;
+    }
+    storePoll();
+}
+
+char storePeek(statusType *sample)
+{
+    char buf[PROTO_SAMPLE_SIZE];
+    unsigned char address;
+    char i;
+
+    if (storeState.eepromRead < storeState.eepromCount) {
+        address = STORE_SAMPLE_ADDR(storeState.eepromRead);
+        for (i = 0; i < PROTO_SAMPLE_SIZE; i++) {
+            buf[i] = usbCtlReadEeprom(address + i);
+        }
+        PROTO_UNPACK_SAMPLE(sample, buf);
+        return 1;
+    }
+    if (0 == STORE_RING_COUNT()) {
+        return 0;
+    }
+    PROTO_UNPACK_SAMPLE(sample, storeState.ring[storeState.tail & STORE_MASK]);
+    return 1;
+}
+
+void storeRelease(void)
+{
+    if (storeState.eepromRead < storeState.eepromCount) {
+        storeState.eepromRead++;
+        if (storeState.eepromRead == storeState.eepromCount) {
+            /* The writer empties the log */
+            storePoll();
+        }
+    } else if (0 != STORE_RING_COUNT()) {
+        storeState.tail++;
+    }
+}
+
+/* Writer task, one EEPROM byte per run */
+void storeTask(void)
+{
+    if ((unsigned char)1 == EECON1bits.WR) {
+        return;
+    }
+
+    if (storeState.flushing) {
+        if ((0 != storeState.eepromCount) &&
+            (storeState.eepromRead == storeState.eepromCount)) {
+            storeWriteEeprom(STORE_CFG_EEPROM_START, 0);
+            storeState.eepromCount = 0;
+            storeState.eepromRead = 0;
+            storeState.stats.eepromSamples = 0;
+            return;
+        }
+    } else if ((0 != STORE_RING_COUNT()) &&
+               (storeState.eepromCount < STORE_MAX_SAMPLES)) {
+        if (storeState.spillByte < PROTO_SAMPLE_SIZE) {
+            storeWriteEeprom(STORE_SAMPLE_ADDR(storeState.eepromCount) +
+                             storeState.spillByte,
+                             storeState.ring[storeState.tail & STORE_MASK][storeState.spillByte]);
+            storeState.spillByte++;
+            return;
+        }
+        /* All bytes written, commit the sample */
+        storeWriteEeprom(STORE_CFG_EEPROM_START, storeState.eepromCount + 1);
+        storeState.eepromCount++;
+        storeState.stats.eepromSamples = storeState.eepromCount;
+        storeState.tail++;
+        storeState.spillByte = 0;
+        return;
+    }
+
+    storeState.polling = 0;
+    schedStopTimer(storeState.task);
+}
+
+void storeGetStats(storeStats *stats)
+{
+    *stats = storeState.stats;
+}
@@ -0,0 +1,78 @@
+/** Store-and-forward header
+
+    While the device is not configured, telemetry samples are kept instead
+    of lost. They are packed (PROTO_PACK_SAMPLE) into a RAM ring, and a
+    writer task spills them one EEPROM byte at a time into the data
+    EEPROM log region, so they also survive a power cycle. Each stored
+    sample is marked with PROTO_STATUS_BACKLOG; its counter and boot
+    fields keep the sample number and the boot it was taken in, so the
+    host can put it back in place, also after a power cycle.
+
+    Once configured, the backlog is taken back out, EEPROM first, then the
+    RAM ring, and mixed into the reports after the live samples. When all
+    of it has been sent, the EEPROM log is emptied.
+
+    The store is bounded: when the RAM ring is full, new samples are
+    dropped (the writer takes about 25 ms per sample, slower than the
+    sample rate), and once the EEPROM log is full the ring is no longer
+    spilled. Dropping the newest samples rather than the oldest keeps the
+    EEPROM from being rewritten continuously while the device stays
+    detached.
+
+    If the device is detached again before the backlog is out, the
+    samples already sent from the EEPROM are sent again next time.
+*/
+
+#ifndef STORE_H
+#define STORE_H
+
+#include "usb.h"
+#include "protocol.h"
+
+/** RAM ring size in samples, a power of 2 up to 128 */
+#define STORE_CFG_RING_SIZE 16
+
+/** Data EEPROM log region: a record count byte, the boot number, then
+    the samples. It ends at the serial number (descriptors.c). */
+#define STORE_CFG_EEPROM_START 0
+#define STORE_CFG_EEPROM_SIZE 0xFC
+
+/** Boot numbers count modulo the range of the boot field */
+#define STORE_BOOT_MODULO 16
+
+/** Writer task poll period while there is something to write */
+#define STORE_CFG_POLL_MS 1
+
+/** Store counters */
+typedef struct {
+    unsigned int stored; /**< Samples put in the store */
+    unsigned int dropped; /**< Samples dropped, the store was full */
+    unsigned char eepromSamples; /**< Samples in the EEPROM log */
+} storeStats;
+
+/** Read the EEPROM log left from before, count the boot and add the
+    writer task. Called before any other store function. */
+usbError storeInit(void);
+
+/** Boot number of this run, stamped on every sample (PROTO_FIELD_BOOT) */
+unsigned char storeGetBoot(void);
+
+/** Keep a sample. Returns USB_ENOMEM if it was dropped. */
+usbError storePut(const statusType *sample);
+
+/** Stop or resume spilling the ring to the EEPROM. Spilling stops while
+    the backlog is taken out. */
+void storeSetFlushing(char flushing);
+
+/** Copy the oldest stored sample to sample. Returns 0 if the store is
+    empty. The sample stays in the store until storeRelease() is
+    called. */
+char storePeek(statusType *sample);
+
+/** Remove the oldest stored sample */
+void storeRelease(void);
+
+/** Get the store counters */
+void storeGetStats(storeStats *stats);
+
+#endif /* STORE_H */
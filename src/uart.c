@@ -0,0 +1,91 @@
+/* Buffered debug output implementation */
+
+/* The ring is filled by printf in the main context and drained by the
+   interrupt handler. Head and tail are single bytes, each written by one
+   side only, so they are read and updated atomically. The exception is
+   UART_DROP_OLDEST, where the writer advances the tail too; it masks the
+   transmit interrupt while doing so. The transmit interrupt is enabled
+   only while the ring holds data. */
+
+#include <p18f2550.h>
+#include <stdio.h>
+
+#include "uart.h"
+
+#if (UART_CFG_TX_BUFFER_SIZE > 128) || \
+    (0 != (UART_CFG_TX_BUFFER_SIZE & (UART_CFG_TX_BUFFER_SIZE - 1)))
+#error "UART_CFG_TX_BUFFER_SIZE must be a power of 2 up to 128"
+#endif
+
+#define UART_MASK (UART_CFG_TX_BUFFER_SIZE - 1)
+
+static char uartBuf[UART_CFG_TX_BUFFER_SIZE];
+static volatile unsigned char uartHead; /* Next byte to write */
+static volatile unsigned char uartTail; /* Next byte to send */
+static unsigned int uartDropped;
+
+#define UART_COUNT() ((unsigned char)(uartHead - uartTail))
+
+void uartInit(void)
+{
+    PIE1bits.TXIE = 0;
+    uartHead = 0;
+    uartTail = 0;
+    uartDropped = 0;
+    stdout = _H_USER;
+}
+
+unsigned int uartGetDropped(void)
+{
+    return uartDropped;
+}
+
+/* Send the next queued byte, or stop the transmit interrupt if there is
+   none. TXIF must be set. */
+void uartSendNext(void)
+{
+    if (uartHead == uartTail) {
+        PIE1bits.TXIE = 0;
+        return;
+    }
+    TXREG = uartBuf[uartTail & UART_MASK];
+    uartTail++;
+}
+
+int _user_putc(char c)
+{
+    if (UART_COUNT() >= UART_CFG_TX_BUFFER_SIZE) {
+#if (UART_CFG_OVERFLOW == UART_BLOCK)
+        /* Feed the USART directly, in case interrupts are disabled. The
+           transmit interrupt is masked first, so the handler cannot load
+           TXREG between the TXIF test and the write. */
+        PIE1bits.TXIE = 0;
+        while (UART_COUNT() >= UART_CFG_TX_BUFFER_SIZE) {
+            if ((unsigned char)1 == PIR1bits.TXIF) {
+                uartSendNext();
+            }
+        }
+        PIE1bits.TXIE = 1;
+#elif (UART_CFG_OVERFLOW == UART_DROP_OLDEST)
+        PIE1bits.TXIE = 0;
+        uartTail++;
+        uartDropped++;
+#else
+        uartDropped++;
+        return c;
+#endif
+    }
+
+    uartBuf[uartHead & UART_MASK] = c;
+    uartHead++;
+    PIE1bits.TXIE = 1;
+    return c;
+}
+
+void uartInterruptHandler(void)
+{
+    if (((unsigned char)1 == PIE1bits.TXIE) &&
+        ((unsigned char)1 == PIR1bits.TXIF)) {
+        uartSendNext();
+    }
+}
@@ -0,0 +1,39 @@
+/** Buffered debug output header
+
+    printf output is queued in a RAM ring and sent by the USART transmit
+    interrupt, so a debug line costs the caller only the formatting time
+    instead of the time it takes to shift out at the baud rate.
+
+    The USART itself is set up by the application with OpenUSART(), with
+    the transmit interrupt off; uartInit() then redirects stdout to the
+    ring. uartInterruptHandler() must be called from the high priority
+    interrupt.
+*/
+
+#ifndef UART_H
+#define UART_H
+
+/** What to do with output that does not fit in the ring */
+#define UART_DROP_NEWEST 0 /**< Drop the new characters */
+#define UART_DROP_OLDEST 1 /**< Drop the oldest queued characters */
+#define UART_BLOCK 2 /**< Wait for room, as the unbuffered USART output did */
+
+/** Overflow policy */
+#define UART_CFG_OVERFLOW UART_DROP_NEWEST
+
+/** Ring size in bytes, a power of 2 up to 128 */
+#define UART_CFG_TX_BUFFER_SIZE 128
+
+/** Redirect stdout to the ring */
+void uartInit(void);
+
+/** Number of characters dropped on overflow since uartInit() */
+unsigned int uartGetDropped(void);
+
+/** Feed the USART from the ring, call from the interrupt handler */
+void uartInterruptHandler(void);
+
+/** C18 stdout hook, called by printf for every character */
+int _user_putc(char c);
+
+#endif /* UART_H */
@@ -6,42 +6,124 @@
 #include "usb.h"
 #include "usb_bd.h"
 #include "usb_ctl.h"
-
-#define USB_CFG_NUM_ENDPOINTS 16
-
-/* 8 bytes min, 64 bytes max. Two buffers of this size are allocated -
-   one for IN and one for OUT directions. */
-#define USB_CFG_EP0_BUFFER_SIZE 8
+#include "sched.h"
+#include "usb_config.h"
+#include "usb_iso.h"
+#include "usb_chan.h"
+#include "usb_ring.h"
+
+#include "string.h"
+
+/** Depth of the USTAT FIFO: the SIE holds up to four completed
+    transactions */
+#define USB_USTAT_FIFO_DEPTH 4
+
+/* UEPn bits */
+#define USB_UEP_HSHK 0x10 /* Handshake enable */
+#define USB_UEP_CONDIS 0x08 /* Control (SETUP) transfers disabled */
+#define USB_UEP_OUTEN 0x04
+#define USB_UEP_INEN 0x02
+
+/* Configuration and endpoint descriptor fields */
+#define USB_DESC_CONFIGURATION 2
+#define USB_DESC_ENDPOINT 5
+#define USB_CONFIG_TOTAL_LENGTH 2 /* wTotalLength */
+#define USB_CONFIG_VALUE 5 /* bConfigurationValue */
+#define USB_EP_ADDRESS 2 /* bEndpointAddress, bit 7 set for IN */
+#define USB_EP_ATTRIBUTES 3 /* bmAttributes, transfer type in bits 0-1 */
+#define USB_EP_MAX_PACKET_SIZE 4 /* wMaxPacketSize, size in bits 0-10 */
+#define USB_EP_TYPE_CONTROL 0
+#define USB_EP_TYPE_ISO 1
+
+/* Index of an endpoint direction in the halt tables */
+#define USB_HALT_INDEX(ep, dir) (((ep) << 1) | (dir))
+
+/* The bus must be idle for 5 ms before a remote wakeup. Suspend is
+   detected after 3 ms, and the tick adds up to 1 ms of jitter. */
+#define USB_WAKEUP_MIN_IDLE_MS 3
 
 typedef enum {
     USB_ST_UNATTACHED,
+    USB_ST_SETTLING, /**< Module enabled, waiting for SE0 to clear */
     USB_ST_ATTACHED,
     USB_ST_DEFAULT,
     USB_ST_ADDRESSED,
-    USB_ST_CONFIGURED
+    USB_ST_CONFIGURED,
+    USB_ST_MAX
 } usbState;
 
+/** Remote wakeup progress */
+typedef enum {
+    USB_WAKEUP_NONE,
+    USB_WAKEUP_WAITING, /**< Waiting for the minimum bus idle time */
+    USB_WAKEUP_SIGNALING /**< Driving resume signaling */
+} usbWakeupStage;
+
 typedef struct {
     usbState state;
     usbEvent eventBuffer;
+    schedTaskId task;
+    char vbus; /**< Last VBUS sample */
+    char vbusStable; /**< VBUS has not changed for the debounce time */
+    char softDetached; /**< Detached by USB_EV_DETACHED */
+    schedTicks vbusMark; /**< When VBUS last changed */
+    schedTicks timeMark; /**< Start of the current attach stage */
+    usbAttachTimes times;
+    char suspended; /**< The bus is suspended */
+    usbWakeupStage wakeup;
+    schedTicks wakeupMark; /**< Start of the current remote wakeup stage */
+    char halted[USB_CFG_NUM_ENDPOINTS * 2]; /**< By USB_HALT_INDEX */
+    schedTicks haltMarks[USB_CFG_NUM_ENDPOINTS * 2]; /**< When halted */
+    usbHaltStats haltStats;
 } usbInternalState;
 
 static usbInternalState usbState;
 
-/* Handlers for various USB events */
-usbEventHandler eventHandlers[USB_EV_MAX];
-
 /* Application callbacks */
 usbCallback userCallbacks[USB_CB_MAX];
 
 usbError usbDetachHandler(void);
 usbError usbAttachHandler(void);
+void usbDisconnect(void);
+void usbConnect(void);
+void usbSettle(void);
+void usbAttachPoll(void);
 usbError usbResetHandler(void);
 usbError usbTransactionHandler(void);
+usbError usbSofHandler(void);
+usbError usbSuspendHandler(void);
+usbError usbResumeHandler(void);
+void usbLeaveSuspend(void);
+void usbWakeupPoll(void);
 usbError usbNop(void);
 
+/* Handlers for various USB events, per state */
+const rom usbEventHandler eventHandlers[USB_ST_MAX][USB_EV_MAX] =
+{
+    /* NONE, ATTACHED, DETACHED, RESET, TRANSACTION, SOF, SUSPEND, RESUME */
+    /* UNATTACHED */
+    {usbNop, usbAttachHandler, usbDetachHandler, usbNop, usbNop, usbNop, usbNop, usbNop},
+    /* SETTLING: SE0 looks like a reset until it clears */
+    {usbNop, usbAttachHandler, usbDetachHandler, usbNop, usbNop, usbNop, usbNop, usbNop},
+    /* ATTACHED */
+    {usbNop, usbAttachHandler, usbDetachHandler, usbResetHandler, usbNop, usbNop,
+     usbSuspendHandler, usbResumeHandler},
+    /* DEFAULT */
+    {usbNop, usbAttachHandler, usbDetachHandler, usbResetHandler, usbTransactionHandler, usbNop,
+     usbSuspendHandler, usbResumeHandler},
+    /* ADDRESSED */
+    {usbNop, usbAttachHandler, usbDetachHandler, usbResetHandler, usbTransactionHandler, usbNop,
+     usbSuspendHandler, usbResumeHandler},
+    /* CONFIGURED */
+    {usbNop, usbAttachHandler, usbDetachHandler, usbResetHandler, usbTransactionHandler, usbSofHandler,
+     usbSuspendHandler, usbResumeHandler}
+};
+
 void usbInitHardware(void);
 usbError usbCheckInterrupt(void);
+void usbFlushTransactions(void);
+void usbDisableEndpoints(void);
+usbError usbConfigureEndpoints(unsigned char config);
 
 /* This handler does nothing */
 usbError usbNop()
@@ -56,29 +138,39 @@ void usbInitHardware()
     UCON = 0;
 
     /* internal pullup enabled; high speed operation;
-       use on-chip transceiver; disable ping-pong */
-    UCFG = 0x14;
+       use on-chip transceiver; ping-pong mode from usb_config.h */
+    UCFG = 0x14 | USB_CFG_PING_PONG;
 
-    /* No interrupts */
+    /* Reset, transaction and idle interrupts only wake up usbTask, the
+       flags themselves are polled by usbCheckInterrupt. The activity
+       interrupt is enabled while suspended. */
     UIE = 0; UEIE = 0;
+    UIEbits.URSTIE = 1;
+    UIEbits.TRNIE = 1;
+    UIEbits.IDLEIE = 1;
+    PIR2bits.USBIF = 0;
+    PIE2bits.USBIE = 1;
 }
 
 usbError usbInit()
 {
-    int eventIndex, cbIndex;
+    int cbIndex;
     usbError ret;
 
-    printf("usb: Init\r\n");
+    printf("usb: Init, %d BDs, %d bytes of USB RAM saved\r\n",
+           USB_CFG_NUM_BDS, USB_CFG_BDT_BYTES_SAVED);
 
     usbInitHardware();
 
     /* Initialize the event buffer */
     usbState.eventBuffer = USB_EV_NONE;
 
-    /* Initialize event handlers */
-    for (eventIndex = 0; eventIndex < USB_EV_MAX; eventIndex++) {
-        eventHandlers[eventIndex] = usbNop;
+    usbState.task = schedAddTask(usbTask);
+    if (SCHED_NO_TASK == usbState.task) {
+        printf("usb: No room for the USB task!\r\n");
+        return USB_ENOMEM;
     }
+
     for (cbIndex = 0; cbIndex < USB_CB_MAX; cbIndex++) {
         userCallbacks[cbIndex] = 0;
     }
@@ -96,32 +188,63 @@ usbError usbInit()
         return ret;
     }
 
-    /* Move to detached state */
-    usbDetachHandler();
+    /* Move to detached state, VBUS is sampled from the first tick */
+    usbState.state = USB_ST_UNATTACHED;
+    usbState.suspended = 0;
+    usbState.wakeup = USB_WAKEUP_NONE;
+    (void) memset((void *)&usbState.haltStats, 0, sizeof(usbHaltStats));
+    usbDisconnect();
+    usbState.softDetached = 0;
+    usbState.vbus = 0;
+    usbState.vbusStable = 1;
+    (void) memset((void *)&usbState.times, 0, sizeof(usbAttachTimes));
+    schedStartTimer(usbState.task, SCHED_MS(USB_CFG_SENSE_PERIOD_MS),
+                    SCHED_MS(USB_CFG_SENSE_PERIOD_MS));
 
     return ret;
 }
 
-usbError usbDetachHandler()
+/* Attach sequence
+
+   UNATTACHED --VBUS stable--> SETTLING --SE0 clear--> ATTACHED --reset-->
+   DEFAULT... The task timer samples VBUS every USB_CFG_SENSE_PERIOD_MS,
+   and every millisecond while settling. Nothing waits for the bus. */
+
+/* Disable the module, the host sees the device go away */
+void usbDisconnect()
 {
-    printf("usb: State = UNATTACHED\r\n");
+    unsigned char config = 0;
+
+    if (USB_ST_CONFIGURED == usbState.state) {
+        /* Let the application know the configuration is gone */
+        (void) usbiCallback(USB_CB_CONFIG, (void *)&config);
+    }
+    if (USB_ST_UNATTACHED != usbState.state) {
+        printf("usb: State = UNATTACHED\r\n");
+    }
+
+    if (usbState.suspended) {
+        usbLeaveSuspend();
+    }
+    usbState.wakeup = USB_WAKEUP_NONE;
+
+    usbIsoStop();
+    usbDisableEndpoints();
 
     /* Disable the USB hardware */
+    UCONbits.RESUME = 0;
     UCONbits.SUSPND = 0;
     UCONbits.USBEN = 0;
 
     usbState.state = USB_ST_UNATTACHED;
-    eventHandlers[USB_EV_ATTACHED] = usbAttachHandler;
-    eventHandlers[USB_EV_DETACHED] = usbNop;
-    eventHandlers[USB_EV_RESET] = usbNop;
-    eventHandlers[USB_EV_TRANSACTION] = usbNop;
-
-    return USB_SUCCESS;
+    schedStartTimer(usbState.task, SCHED_MS(USB_CFG_SENSE_PERIOD_MS),
+                    SCHED_MS(USB_CFG_SENSE_PERIOD_MS));
 }
 
-usbError usbAttachHandler() 
+/* Enable the module, the bus settles before resets are taken */
+void usbConnect()
 {
-    printf("usb: State = ATTACHED\r\n");
+    printf("usb: State = SETTLING\r\n");
 
     /* Clear interrupt status */
     UIR = 0; UEIR = 0;
@@ -129,36 +252,124 @@ usbError usbAttachHandler()
     /* Enable the USB hardware */
     UCONbits.USBEN = 1;
 
-    /* Wait for the single-ended zero condition to clear - otherwise
-       we could mistake it for a Reset on the bus */
-    while ((unsigned char)0 != UCONbits.SE0) {
-        ;
+    usbState.state = USB_ST_SETTLING;
+    usbState.timeMark = schedGetTicks();
+    usbState.times.attachToReset = 0;
+    usbState.times.resetToAddress = 0;
+    usbState.times.addressToConfigured = 0;
+    schedStartTimer(usbState.task, SCHED_MS(1), SCHED_MS(1));
+}
+
+/* Wait for the single-ended zero condition to clear - otherwise we could
+   mistake it for a Reset on the bus */
+void usbSettle()
+{
+    schedTicks elapsed = schedGetTicks() - usbState.timeMark;
+
+    if ((unsigned char)0 == UCONbits.SE0) {
+        UIRbits.URSTIF = 0;
+        printf("usb: State = ATTACHED\r\n");
+        usbState.state = USB_ST_ATTACHED;
+        schedStartTimer(usbState.task, SCHED_MS(USB_CFG_SENSE_PERIOD_MS),
+                        SCHED_MS(USB_CFG_SENSE_PERIOD_MS));
+    } else if (elapsed >= SCHED_MS(USB_CFG_SE0_TIMEOUT_MS)) {
+        /* Retried after the next debounce time */
+        printf("usb: SE0 timeout\r\n");
+        usbState.times.se0Timeouts++;
+        usbDisconnect();
+        usbState.vbusMark = schedGetTicks();
+        usbState.vbusStable = 0;
     }
-    UIRbits.URSTIF = 0;
+}
 
-    usbState.state = USB_ST_ATTACHED;
-    eventHandlers[USB_EV_ATTACHED] = usbNop;
-    eventHandlers[USB_EV_DETACHED] = usbDetachHandler;
-    eventHandlers[USB_EV_RESET] = usbResetHandler;
+/* Runs on every wakeup of the USB task. A steady VBUS costs one port
+   read. */
+void usbAttachPoll()
+{
+    char vbus = (0 != USB_CFG_VBUS_SENSE());
 
+    if (vbus != usbState.vbus) {
+        usbState.vbus = vbus;
+        usbState.vbusMark = schedGetTicks();
+        usbState.vbusStable = 0;
+        return;
+    }
+
+    if (!usbState.vbusStable) {
+        if ((schedTicks)(schedGetTicks() - usbState.vbusMark) <
+            SCHED_MS(USB_CFG_SENSE_DEBOUNCE_MS)) {
+            return;
+        }
+        usbState.vbusStable = 1;
+        printf("usb: VBUS %s\r\n", vbus ? "on" : "off");
+        if (!vbus) {
+            usbDisconnect();
+        }
+    }
+
+    if (USB_ST_SETTLING == usbState.state) {
+        usbSettle();
+    } else if (vbus && !usbState.softDetached &&
+               (USB_ST_UNATTACHED == usbState.state)) {
+        usbConnect();
+    }
+}
+
+usbError usbDetachHandler()
+{
+    usbState.softDetached = 1;
+    usbDisconnect();
     return USB_SUCCESS;
 }
 
+usbError usbAttachHandler() 
+{
+    /* Connects on the next tick if VBUS is present */
+    usbState.softDetached = 0;
+    return USB_SUCCESS;
+}
+
+void usbGetAttachTimes(usbAttachTimes *times)
+{
+    *times = usbState.times;
+}
+
 usbError usbResetHandler()
 {
-    char ep; char *UEPnPtr = &UEP1;
+    unsigned char config = 0;
 
     printf("usb: Reset handler\r\n");
 
-    /* Disable all endpoints except EP0 */
-    for (ep = 1; ep < USB_CFG_NUM_ENDPOINTS; ep++) {
-        *UEPnPtr = 0;
-        UEPnPtr++;
+    if (USB_ST_CONFIGURED == usbState.state) {
+        /* Let the application know the configuration is gone */
+        (void) usbiCallback(USB_CB_CONFIG, (void *)&config);
+    }
+
+    /* Hosts reset the bus more than once, the address stage is timed
+       from the last reset */
+    if (USB_ST_ATTACHED == usbState.state) {
+        usbState.times.attachToReset = schedGetTicks() - usbState.timeMark;
     }
+    usbState.timeMark = schedGetTicks();
+
+    /* Reset signaling also ends a suspend */
+    if (usbState.suspended) {
+        usbLeaveSuspend();
+    }
+
+    usbIsoStop();
+    usbDisableEndpoints();
+
     /* Handshake enabled; IN+OUT; enable Control */
-    UEP0 = 0x16;
+    UEP0 = USB_UEP_HSHK | USB_UEP_OUTEN | USB_UEP_INEN;
 
-    // TODO clear the transaction buffer
+    /* Flush the USTAT FIFO; transactions queued before the reset refer
+       to the old configuration */
+    usbFlushTransactions();
+
+    /* Point the ping-pong buffer pointers back to the even BDs */
+    UCONbits.PPBRST = 1;
+    UCONbits.PPBRST = 0;
 
     /* Hand off EP0 */
     usbCtlInit();
@@ -168,21 +379,272 @@ usbError usbResetHandler()
 
     printf("usb: State = DEFAULT\r\n");
     usbState.state = USB_ST_DEFAULT;
-    eventHandlers[USB_EV_TRANSACTION] = usbTransactionHandler;
 
     return USB_SUCCESS;
 }
 
-usbError usbTransactionHandler()
+/* Disable all endpoints except EP0 and free their buffers. Endpoints
+   above USB_CFG_HIGHEST_ENDPOINT are never enabled. */
+void usbDisableEndpoints()
 {
-    usbBdHandle bdHandle;
-    usbCallback cbNonEP0 = userCallbacks[USB_CB_TRANSACTION];
+    char ep;
+    volatile unsigned char *uep = &UEP1;
+
+    usbChanStop();
+    usbRingStop();
+    for (ep = 1; ep < USB_CFG_NUM_ENDPOINTS; ep++) {
+        *uep = 0;
+        uep++;
+    }
+    usbBdFreeEndpoints();
+    (void) memset((void *)usbState.halted, 0, sizeof(usbState.halted));
+}
+
+/* Endpoint halt
+
+   A halted endpoint has its BDs handed to the SIE with BSTALL set. The
+   SIE answers STALL and keeps them, so the application cannot re-arm
+   them by mistake: usbBdReceive(), usbBdSend() and usbBdGetBuf() fail on
+   BDs owned by the SIE. Clearing the halt takes the BDs back and the
+   endpoint restarts at DATA0. Nothing else is reset, so the host
+   recovers a stalled pipe or a toggle mismatch with one control
+   transfer instead of a bus reset and re-enumeration. */
+
+/* The handle of an endpoint from its address. EP0 is always there, other
+   endpoints only if the configuration sets them up. */
+usbError usbFindEndpointHandle(unsigned char address, usbBdHandle *handle)
+{
+    char ep = address & 0x0F;
+    usbEndpointDirection dir = (0 != (address & 0x80)) ? USB_ED_IN : USB_ED_OUT;
+
+    if ((0 != (address & 0x70)) ||
+        (USB_SUCCESS != usbBdGetHandleForEndpoint(ep, dir, handle))) {
+        return USB_EBADPARM;
+    }
+    if ((0 != ep) && ((USB_ST_CONFIGURED != usbState.state) ||
+                      !usbBdFastIsSetUp(*handle))) {
+        return USB_EBADPARM;
+    }
+    return USB_SUCCESS;
+}
+
+usbError usbHaltEndpoint(unsigned char address)
+{
+    usbBdHandle handle, bd;
+    char ep = address & 0x0F;
+    usbEndpointDirection dir = (0 != (address & 0x80)) ? USB_ED_IN : USB_ED_OUT;
+    char index = USB_HALT_INDEX(ep, dir);
+
+    /* EP0 only stalls to reject a request, until the next SETUP */
+    if ((0 == ep) || (USB_SUCCESS != usbFindEndpointHandle(address, &handle))) {
+        return USB_EBADPARM;
+    }
+
+    if (!usbState.halted[index]) {
+        printf("usb: EP %x halted\r\n", (int)address);
+        usbState.halted[index] = 1;
+        usbState.haltMarks[index] = schedGetTicks();
+        usbState.haltStats.halts++;
+        if (USB_ED_IN == dir) {
+            usbChanHalt(ep);
+        } else {
+            usbRingHalt(ep);
+        }
+    }
+
+    /* Both BDs of a ping-pong pair */
+    bd = handle;
+    do {
+        (void) usbBdClaim(bd);
+        usbBdFastStall(bd);
+        bd = usbBdGetPingPong(bd);
+    } while (bd != handle);
+    return USB_SUCCESS;
+}
+
+usbError usbiClearHalt(unsigned char address)
+{
+    usbBdHandle handle, bd;
+    char ep = address & 0x0F;
+    usbEndpointDirection dir = (0 != (address & 0x80)) ? USB_ED_IN : USB_ED_OUT;
+    char index = USB_HALT_INDEX(ep, dir);
+    schedTicks recovery;
+
+    if (USB_SUCCESS != usbFindEndpointHandle(address, &handle)) {
+        return USB_EBADPARM;
+    }
+    if (0 == ep) {
+        return USB_SUCCESS;
+    }
+
+    if (usbState.halted[index]) {
+        recovery = schedGetTicks() - usbState.haltMarks[index];
+        usbState.halted[index] = 0;
+        usbState.haltStats.lastRecovery = recovery;
+        if (recovery > usbState.haltStats.maxRecovery) {
+            usbState.haltStats.maxRecovery = recovery;
+        }
+        printf("usb: EP %x recovered, halted %u ms\r\n", (int)address, recovery);
+    }
+    usbState.haltStats.clears++;
+
+    /* The BDs come back to the CPU, the owner arms them again at DATA0.
+       An endpoint that was not halted loses the packets armed on it. */
+    if (USB_ED_IN == dir) {
+        usbChanHalt(ep);
+    } else {
+        usbRingHalt(ep);
+    }
+    bd = handle;
+    do {
+        (void) usbBdReset(bd);
+        bd = usbBdGetPingPong(bd);
+    } while (bd != handle);
+
+    if (USB_ED_IN == dir) {
+        usbChanRestart(ep);
+    } else {
+        usbRingRestart(ep);
+    }
+    (void) usbiCallback(USB_CB_ENDPOINT_RESET, (void *)&handle);
+    return USB_SUCCESS;
+}
+
+usbError usbiGetHalt(unsigned char address, char *halted)
+{
+    usbBdHandle handle;
+    char ep = address & 0x0F;
+    usbEndpointDirection dir = (0 != (address & 0x80)) ? USB_ED_IN : USB_ED_OUT;
+
+    if (USB_SUCCESS != usbFindEndpointHandle(address, &handle)) {
+        return USB_EBADPARM;
+    }
+    *halted = usbState.halted[USB_HALT_INDEX(ep, dir)];
+    return USB_SUCCESS;
+}
+
+void usbGetHaltStats(usbHaltStats *stats)
+{
+    *stats = usbState.haltStats;
+}
+
+/* Find the configuration descriptor with the given bConfigurationValue */
+usbError usbFindConfigDescriptor(unsigned char config, usbCtlDescriptor *desc)
+{
+    desc->type = USB_DESC_CONFIGURATION;
+    desc->index = 0;
+    while (USB_SUCCESS == usbCtlFindDescriptor(desc)) {
+        if (config == usbCtlDescriptorByte(desc, USB_CONFIG_VALUE)) {
+            return USB_SUCCESS;
+        }
+        desc->index++;
+    }
+    return USB_EBADPARM;
+}
+
+/* Offset of the endpoint descriptor for an endpoint address within a
+   configuration descriptor, 0 if the configuration does not use it */
+int usbFindEndpointDescriptor(const usbCtlDescriptor *desc, unsigned char address)
+{
+    int offset = 0;
+    int totalLength = usbCtlDescriptorByte(desc, USB_CONFIG_TOTAL_LENGTH) |
+        ((int)usbCtlDescriptorByte(desc, USB_CONFIG_TOTAL_LENGTH + 1) << 8);
+    unsigned char length;
+
+    while (offset + 1 < totalLength) {
+        length = usbCtlDescriptorByte(desc, offset);
+        if ((unsigned char)0 == length) {
+            break; /* Malformed, do not loop forever */
+        }
+        if ((USB_DESC_ENDPOINT == usbCtlDescriptorByte(desc, offset + 1)) &&
+            (address == usbCtlDescriptorByte(desc, offset + USB_EP_ADDRESS))) {
+            return offset;
+        }
+        offset += length;
+    }
+    return 0;
+}
+
+/* Set up the BDs and UEPn registers of the endpoints declared by the
+   configuration descriptor. Buffers are allocated with exactly the
+   declared max packet size; endpoints not in the configuration get no
+   buffer and stay disabled. The buffers are allocated in usbBdSetup()
+   order, whatever the order of the endpoint descriptors. */
+usbError usbConfigureEndpoints(unsigned char config)
+{
+    usbCtlDescriptor desc;
+    volatile unsigned char *uep = &UEP1;
+    unsigned char uepVal, type, address;
+    unsigned int size;
+    int offset;
+    char ep, dir;
+    usbError ret;
+
+    if (USB_SUCCESS != usbFindConfigDescriptor(config, &desc)) {
+        printf("usb: No descriptor for config %d\r\n", config);
+        return USB_EBADPARM;
+    }
+
+    for (ep = 1; ep < USB_CFG_NUM_ENDPOINTS; ep++) {
+        uepVal = 0;
+        for (dir = USB_ED_OUT; dir <= USB_ED_IN; dir++) {
+            address = (USB_ED_IN == dir) ? (0x80 | ep) : ep;
+            offset = usbFindEndpointDescriptor(&desc, address);
+            if (0 == offset) {
+                continue;
+            }
 
-    bdHandle = usbBdGetHandleForTransaction();
+            size = (usbCtlDescriptorByte(&desc, offset + USB_EP_MAX_PACKET_SIZE) |
+                    ((unsigned int)usbCtlDescriptorByte(&desc,
+                        offset + USB_EP_MAX_PACKET_SIZE + 1) << 8)) & 0x7FF;
+            ret = usbBdSetup(ep, dir, size);
+            if (USB_SUCCESS != ret) {
+                printf("usb: EP%d BD Setup failed! ret=%d\r\n", ep, ret);
+                return ret;
+            }
 
-    if (0 == usbBdGetEndpoint(bdHandle)) {
+            type = usbCtlDescriptorByte(&desc, offset + USB_EP_ATTRIBUTES) & 0x03;
+            uepVal |= (USB_ED_IN == dir) ? USB_UEP_INEN : USB_UEP_OUTEN;
+            /* Isochronous endpoints are never acknowledged */
+            if (USB_EP_TYPE_ISO != type) {
+                uepVal |= USB_UEP_HSHK;
+            }
+            if (USB_EP_TYPE_CONTROL != type) {
+                uepVal |= USB_UEP_CONDIS;
+            }
+        }
+        *uep = uepVal;
+        uep++;
+    }
+    return USB_SUCCESS;
+}
+
+void usbFlushTransactions()
+{
+    char i;
+
+    for (i = 0; i < USB_USTAT_FIFO_DEPTH; i++) {
+        if ((unsigned char)0 == UIRbits.TRNIF) {
+            break;
+        }
+        UIRbits.TRNIF = 0;
+        /* TRNIF is set again after a few cycles if USTAT has more entries */
+        Nop(); Nop(); Nop(); Nop(); Nop(); Nop();
+    }
+}
+
+void usbDispatchTransaction(usbBdHandle bdHandle)
+{
+    usbCallback cbNonEP0 = userCallbacks[USB_CB_TRANSACTION];
+    char ep = usbBdFastEndpoint(bdHandle);
+
+    if (0 == ep) {
         /* Transactions on EP0 are handled by the USB library */
         usbCtlHandleTransaction(bdHandle);
+    } else if (usbIsoIsIsoEndpoint(ep)) {
+        /* Isochronous buffers are serviced on Start-of-Frame */
+    } else if (usbRingHandleTransaction(bdHandle)) {
+        /* Received into a slot of an OUT ring */
     } else {
         /* Non-EP0 transactions should be handled by the user */
         if (USB_ST_CONFIGURED != usbState.state) {
@@ -196,18 +658,140 @@ usbError usbTransactionHandler()
             }
         }
     }
+}
 
-    /* Finished with the transaction, advance the transaction FIFO */
-    UIRbits.TRNIF = 0;
+usbError usbTransactionHandler()
+{
+    usbBdHandle bdHandle;
+    char i;
+
+    /* Handle every transaction queued in the USTAT FIFO. The BD stays
+       with the CPU until it is released, so USTAT is advanced as soon as
+       it is read: the SIE can then queue the next transaction while this
+       one is being processed. */
+    for (i = 0; i < USB_USTAT_FIFO_DEPTH; i++) {
+        if ((unsigned char)0 == UIRbits.TRNIF) {
+            break;
+        }
+        bdHandle = usbBdFastTransactionHandle();
+        UIRbits.TRNIF = 0;
+        usbDispatchTransaction(bdHandle);
+    }
+
+    /* Refill the IN channels the host has emptied, by priority */
+    usbChanService();
     return USB_SUCCESS;
 }
 
+usbError usbSofHandler()
+{
+    usbIsoHandleSof();
+    return USB_SUCCESS;
+}
+
+/* Suspend and resume
+
+   The SIE raises IDLEIF after 3 ms without bus activity. The transceiver
+   is then suspended and ACTVIF, raised by the next bus activity, is
+   enabled. usbInterruptHandler takes the transceiver out of suspend as
+   soon as ACTVIF is raised, before the task runs: if the CPU was asleep,
+   the oscillator start-up is then the only resume latency. */
+
+usbError usbSuspendHandler()
+{
+    unsigned char suspended = 1;
+
+    if (usbState.suspended) {
+        return USB_SUCCESS;
+    }
+    printf("usb: Suspend\r\n");
+
+    /* ACTVIF is still set from the last bus activity */
+    UIRbits.ACTVIF = 0;
+    UIEbits.ACTVIE = 1;
+    UCONbits.SUSPND = 1;
+    usbState.suspended = 1;
+    usbState.wakeupMark = schedGetTicks();
+
+    (void) usbiCallback(USB_CB_SUSPEND, (void *)&suspended);
+    return USB_SUCCESS;
+}
+
+/* Resume the transceiver and let the application know */
+void usbLeaveSuspend()
+{
+    unsigned char suspended = 0;
+
+    UCONbits.SUSPND = 0;
+    UIEbits.ACTVIE = 0;
+    /* ACTVIF can only be cleared once the transceiver is running */
+    while ((unsigned char)1 == UIRbits.ACTVIF) {
+        UIRbits.ACTVIF = 0;
+    }
+    usbState.suspended = 0;
+
+    (void) usbiCallback(USB_CB_SUSPEND, (void *)&suspended);
+}
+
+usbError usbResumeHandler()
+{
+    if (usbState.suspended) {
+        printf("usb: Resume\r\n");
+        usbLeaveSuspend();
+    }
+    return USB_SUCCESS;
+}
+
+usbError usbRemoteWakeup(void)
+{
+    if (!usbState.suspended || !usbCtlGetRemoteWakeup()) {
+        return USB_EBADSTATE;
+    }
+    printf("usb: Remote wakeup\r\n");
+
+    usbLeaveSuspend();
+    usbState.wakeup = USB_WAKEUP_WAITING;
+    schedStartTimer(usbState.task, SCHED_MS(1), SCHED_MS(1));
+    return USB_SUCCESS;
+}
+
+/* Runs on every wakeup of the USB task during a remote wakeup. Resume
+   signaling is driven once the bus has been idle long enough. */
+void usbWakeupPoll()
+{
+    schedTicks elapsed = schedGetTicks() - usbState.wakeupMark;
+
+    if (USB_WAKEUP_WAITING == usbState.wakeup) {
+        if ((unsigned char)1 == UIRbits.ACTVIF) {
+            /* The host resumed the bus first */
+            usbState.wakeup = USB_WAKEUP_NONE;
+        } else if (elapsed >= SCHED_MS(USB_WAKEUP_MIN_IDLE_MS)) {
+            UCONbits.RESUME = 1;
+            usbState.wakeupMark = schedGetTicks();
+            usbState.wakeup = USB_WAKEUP_SIGNALING;
+        }
+    } else if (elapsed >= SCHED_MS(USB_CFG_RESUME_SIGNAL_MS)) {
+        /* The host takes over resume signaling for 20 ms */
+        UCONbits.RESUME = 0;
+        usbState.wakeup = USB_WAKEUP_NONE;
+    }
+
+    if (USB_WAKEUP_NONE == usbState.wakeup) {
+        schedStartTimer(usbState.task, SCHED_MS(USB_CFG_SENSE_PERIOD_MS),
+                        SCHED_MS(USB_CFG_SENSE_PERIOD_MS));
+    }
+}
+
 usbError usbiSetAddress(char address)
 {
     if ((USB_ST_DEFAULT == usbState.state) || 
         (USB_ST_ADDRESSED == usbState.state)) {
         if ((address > 0) && (address < 128)) {
             UADDR = address;
+            if (USB_ST_DEFAULT == usbState.state) {
+                usbState.times.resetToAddress = schedGetTicks() - usbState.timeMark;
+                usbState.timeMark = schedGetTicks();
+            }
             usbState.state = USB_ST_ADDRESSED;
             printf("usb: State = ADDRESSED\r\n");
             return USB_SUCCESS;
@@ -225,6 +809,7 @@ usbError usbPostEvent(usbEvent ev)
 {
     if (USB_EV_NONE == usbState.eventBuffer) {
         usbState.eventBuffer = ev;
+        schedPostEvent(usbState.task);
         return USB_SUCCESS;
     } else {
         printf("usb: Event Buffer Overflown!\r\n");
@@ -254,6 +839,33 @@ usbError usbCheckInterrupt()
             usbPostEvent(USB_EV_TRANSACTION);
             return USB_SUCCESS;
         }
+
+        if ((unsigned char)1 == UIRbits.SOFIF) {
+            /* Start-of-Frame is only of interest when enabled */
+            UIRbits.SOFIF = 0;
+            if ((unsigned char)1 == UIEbits.SOFIE) {
+                usbPostEvent(USB_EV_SOF);
+            }
+            return USB_SUCCESS;
+        }
+
+        if ((unsigned char)1 == UIRbits.IDLEIF) {
+            UIRbits.IDLEIF = 0;
+            usbPostEvent(USB_EV_SUSPEND);
+            return USB_SUCCESS;
+        }
+
+        if ((unsigned char)1 == UIRbits.ACTVIF) {
+            /* Bus activity is only of interest while suspended; the
+               resume handler clears the flag */
+            if ((unsigned char)1 == UIEbits.ACTVIE) {
+                usbPostEvent(USB_EV_RESUME);
+            } else if (USB_WAKEUP_WAITING != usbState.wakeup) {
+                /* Left set while waiting, see usbWakeupPoll */
+                UIRbits.ACTVIF = 0;
+            }
+            return USB_SUCCESS;
+        }
         /* TODO actually handle all interrupts */
         printf("usb: Unhandled Interrupt!\r\n");
     }
@@ -269,7 +881,7 @@ usbError usbWork()
     do {
         usbGetEvent(&ev);
         if (USB_EV_NONE != ev) {
-            ret = eventHandlers[ev]();
+            ret = eventHandlers[usbState.state][ev]();
             if (USB_SUCCESS != ret) {
                 printf("usb: EventHandler Failed! ev=%d ret=%d\r\n", ev, ret);
                 return ret;
@@ -282,6 +894,38 @@ usbError usbWork()
     return USB_SUCCESS;
 }
 
+void usbTask(void)
+{
+    (void)usbWork();
+    usbAttachPoll();
+    if (USB_WAKEUP_NONE != usbState.wakeup) {
+        usbWakeupPoll();
+    }
+
+    /* Unmask the USB interrupt. Flags raised after usbWork's last check
+       must not be lost, so run again if any enabled flag is still set. */
+    PIR2bits.USBIF = 0;
+    PIE2bits.USBIE = 1;
+    if ((unsigned char)0 != (UIR & UIE)) {
+        schedPostEvent(usbState.task);
+    }
+}
+
+void usbInterruptHandler(void)
+{
+    if (((unsigned char)1 == PIE2bits.USBIE) &&
+        ((unsigned char)1 == PIR2bits.USBIF)) {
+        /* Fast resume: the transceiver comes out of suspend right away */
+        if (((unsigned char)1 == UIEbits.ACTVIE) &&
+            ((unsigned char)1 == UIRbits.ACTVIF)) {
+            UCONbits.SUSPND = 0;
+        }
+        /* Keep the interrupt masked until usbTask has processed the flags */
+        PIE2bits.USBIE = 0;
+        schedPostEvent(usbState.task);
+    }
+}
+
 void usbSetPowerState(usbPowerState powerState)
 {
     /* Only the control EP handler cares */
@@ -290,7 +934,7 @@ void usbSetPowerState(usbPowerState powerState)
 
 usbError usbSetCallback(usbCallbackEvent cbEvent, usbCallback callback)
 {
-    if ((cbEvent < 0) || (cbEvent > USB_CB_MAX)) {
+    if ((cbEvent < 0) || (cbEvent >= USB_CB_MAX)) {
         printf("usb: invalid callback event %d\r\n", cbEvent);
         return USB_EBADPARM;
     }
@@ -298,6 +942,16 @@ usbError usbSetCallback(usbCallbackEvent cbEvent, usbCallback callback)
     return USB_SUCCESS;
 }
 
+usbError usbiCallback(usbCallbackEvent cbEvent, void *param)
+{
+    usbCallback cb = userCallbacks[cbEvent];
+
+    if (0 == cb) {
+        return USB_ENOIMP;
+    }
+    return cb(param);
+}
+
 usbError usbiSetConfig(unsigned char config)
 {
     usbCallback cbConfig = userCallbacks[USB_CB_CONFIG];
@@ -314,22 +968,45 @@ usbError usbiSetConfig(unsigned char config)
         return USB_ENOIMP;
     }
 
-    cbRet = cbConfig((void *)&config);
+    /* The endpoints of the previous configuration go away in any case */
+    usbIsoStop();
+    usbDisableEndpoints();
 
     if ((unsigned char)0 == config) {
+        (void) cbConfig((void *)&config);
         /* Go back to addressed state */
         printf("usb: State = ADDRESSED\r\n");
         usbState.state = USB_ST_ADDRESSED;
         return USB_SUCCESS;
     } else {
+        /* The endpoints are ready by the time the application sees the
+           new configuration */
+        cbRet = usbConfigureEndpoints(config);
         if (USB_SUCCESS == cbRet) {
+            usbChanStart();
+            usbRingStart();
+            cbRet = cbConfig((void *)&config);
+        }
+        if (USB_SUCCESS == cbRet) {
+            if (USB_ST_ADDRESSED == usbState.state) {
+                usbState.times.addressToConfigured =
+                    schedGetTicks() - usbState.timeMark;
+                printf("usb: Enumerated, reset %u ms, address %u ms, config %u ms\r\n",
+                       usbState.times.attachToReset,
+                       usbState.times.resetToAddress,
+                       usbState.times.addressToConfigured);
+            }
             printf("usb: State = CONFIGURED\r\n");
             usbState.state = USB_ST_CONFIGURED;
+            usbIsoStart();
             return USB_SUCCESS;
         } else {
             printf("usb: user callback did not succeed for config %d\r\n",
                    config);
-            /* Assuming this configuration is not supported - no state change */
+            /* Assuming this configuration is not supported. The old
+               endpoints are gone, so fall back to the addressed state. */
+            usbDisableEndpoints();
+            usbState.state = USB_ST_ADDRESSED;
             return cbRet;
         }
     }
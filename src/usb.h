@@ -20,10 +20,16 @@ typedef enum {
 
 typedef enum {
     USB_EV_NONE, /**< No event (empty event) */
-    USB_EV_ATTACHED, /**< USB plugged into the host. Posted from application. */
-    USB_EV_DETACHED, /**< USB disconnected from the host. Posted from application. */
+    USB_EV_ATTACHED, /**< Connect to the host again after USB_EV_DETACHED,
+                          once VBUS is present. Posted from application. */
+    USB_EV_DETACHED, /**< Disconnect from the host until USB_EV_ATTACHED, whatever
+                          the VBUS state. Posted from application. */
     USB_EV_RESET, /**< Reset command received from the host. Posted from interrupt. */
-    USB_EV_TRANSACTION, /**< USB transaction has completed. Posted from interrupt. */
+    USB_EV_TRANSACTION, /**< USB transactions have completed, all queued ones
+                             are handled in one pass. Posted from interrupt. */
+    USB_EV_SOF, /**< Start of a 1 ms frame. Posted from interrupt. */
+    USB_EV_SUSPEND, /**< The bus has been idle for 3 ms. Posted from interrupt. */
+    USB_EV_RESUME, /**< Bus activity while suspended. Posted from interrupt. */
     USB_EV_MAX
 } usbEvent;
 
@@ -41,6 +47,53 @@ typedef enum {
         receives an endpoint handle (usbBdHandle *) on which the transaction
         has occurred. */
     USB_CB_TRANSACTION,
+
+    /** Get_Descriptor request received from the host. The callback
+        receives the requested descriptor (usbCtlDescriptor *) with its type
+        and index filled in. To serve a descriptor that is not in
+        usbCtlDescriptorList, or that changes at runtime, the callback sets
+        the size and (ROM) data of the descriptor and returns USB_SUCCESS.
+        On any other return value the descriptor list is searched. */
+    USB_CB_GET_DESCRIPTOR,
+
+    /** Vendor request received on EP0. The callback receives the request
+        (usbCtlRequest *). For a device-to-host request, the callback sets
+        the data to return in the data stage. For a host-to-device request
+        with a data stage, it sets the RAM buffer to receive the data into.
+        If the callback does not return USB_SUCCESS, the request is
+        stalled. */
+    USB_CB_VENDOR_REQUEST,
+
+    /** The data stage of a host-to-device vendor or class request has
+        been received into the buffer set by USB_CB_VENDOR_REQUEST or
+        USB_CB_CLASS_REQUEST; setup->type tells which. The callback
+        receives the request (usbCtlRequest *) with size set to the number
+        of bytes received. If the callback does not return USB_SUCCESS, the
+        status stage is stalled. */
+    USB_CB_VENDOR_DATA,
+
+    /** Class request received on EP0, such as HID Get_Report. Handled
+        like USB_CB_VENDOR_REQUEST; the data stage of a host-to-device
+        request is passed to USB_CB_VENDOR_DATA. */
+    USB_CB_CLASS_REQUEST,
+
+    /** The bus was suspended or resumed. The callback receives the new
+        state (unsigned char *), 1 when suspended. While suspended, the
+        device must draw no more than the suspend current: the callback
+        should stop what it can and may put the scheduler into deep sleep
+        (schedSetDeepSleep). Deep sleep stops the VBUS sensing, so a
+        self-powered device that can be detached while suspended should
+        stay in Idle mode. It is called with 0 on bus activity, on
+        usbRemoteWakeup() and when the device is detached. */
+    USB_CB_SUSPEND,
+
+    /** The host has cleared the halt of an endpoint (CLEAR_FEATURE
+        (ENDPOINT_HALT)), which also resets its data toggle: the next
+        packet in either direction is DATA0. The callback receives the
+        handle of the endpoint (usbBdHandle *); its BDs are owned by the
+        CPU. The callback resets its toggle tracking and re-arms an OUT
+        endpoint. IN channels (usb_chan.h) are restarted by the stack. */
+    USB_CB_ENDPOINT_RESET,
     USB_CB_MAX
 } usbCallbackEvent;
 
@@ -78,9 +131,65 @@ void usbSetPowerState(usbPowerState powerState);
     callback may be registered for the particular event. */
 usbError usbSetCallback(usbCallbackEvent cbEvent, usbCallback callback);
 
+/** Enumeration times of the last attach, in milliseconds. A time is 0
+    until its stage has completed. */
+typedef struct {
+    unsigned int attachToReset; /**< Module enabled to the first bus reset */
+    unsigned int resetToAddress; /**< Last bus reset to SET_ADDRESS */
+    unsigned int addressToConfigured; /**< SET_ADDRESS to SET_CONFIGURATION */
+    unsigned int se0Timeouts; /**< Attaches abandoned, see USB_CFG_SE0_TIMEOUT_MS */
+} usbAttachTimes;
+
+/** Get the enumeration times of the last attach */
+void usbGetAttachTimes(usbAttachTimes *times);
+
+/** Wake the host up from suspend (remote wakeup)
+
+    Only allowed while the bus is suspended and the host has enabled
+    remote wakeup, otherwise USB_EBADSTATE is returned. The transceiver
+    is resumed at once, and resume signaling is driven for
+    USB_CFG_RESUME_SIGNAL_MS by the USB task, once the bus has been idle
+    for the 5 ms the spec requires; the call does not wait. */
+usbError usbRemoteWakeup(void);
+
+/** Halt an endpoint (functional stall)
+
+    address is the endpoint address, bit 7 set for IN. The endpoint
+    answers every token with STALL until the host clears the halt, which
+    is reported through USB_CB_ENDPOINT_RESET; a packet armed on it is
+    dropped. Returns USB_EBADPARM if the endpoint is EP0 or not part of
+    the configuration. */
+usbError usbHaltEndpoint(unsigned char address);
+
+/** Endpoint halt counters. Recovery is the time from the halt to the
+    host clearing it, in milliseconds. */
+typedef struct {
+    unsigned int halts; /**< Endpoints halted, by the host or the device */
+    unsigned int clears; /**< Halts cleared, and toggle resets of endpoints
+                              that were not halted */
+    unsigned int lastRecovery; /**< Recovery of the last halt cleared */
+    unsigned int maxRecovery; /**< Longest recovery */
+} usbHaltStats;
+
+/** Get the endpoint halt counters */
+void usbGetHaltStats(usbHaltStats *stats);
+
 /** Call this function often to perform USB tasks */
 usbError usbWork(void);
 
+/** Scheduler task for the USB stack.
+
+    The task is added to the scheduler by usbInit() and runs usbWork()
+    whenever the USB module raises an interrupt or an event is posted. Its
+    timer samples VBUS and times the attach sequence, which never waits
+    for the bus. */
+void usbTask(void);
+
+/** USB interrupt handler, must be called from the high-priority interrupt
+    vector. Only wakes up usbTask, and takes the transceiver out of
+    suspend on bus activity; all other processing is done by the task. */
+void usbInterruptHandler(void);
+
 /* The following functions are internal to the USB library and should not
    be called by the application directly.*/
 
@@ -93,9 +202,26 @@ usbError usbiSetAddress(char address);
 
 /** Change the device's configuration
     
-    This is done by the control transfer handler. The function will call the
-    user callback for USB_CB_CONFIG and, if successful, the configuration
-    will be changed. */
+    This is done by the control transfer handler. The endpoints declared in
+    the configuration descriptor get their buffers and UEPn settings before
+    the user callback for USB_CB_CONFIG is called; if the callback
+    succeeds, the configuration is changed. */
 usbError usbiSetConfig(unsigned char config);
 
+/** Clear the halt of an endpoint and reset its data toggle, for
+    CLEAR_FEATURE(ENDPOINT_HALT). Works whether or not the endpoint is
+    halted. Returns USB_EBADPARM if the endpoint is not part of the
+    configuration. */
+usbError usbiClearHalt(unsigned char address);
+
+/** Get the halt state of an endpoint, for GET_STATUS. Returns
+    USB_EBADPARM if the endpoint is not part of the configuration. */
+usbError usbiGetHalt(unsigned char address, char *halted);
+
+/** Call the user callback for an event
+    
+    Returns USB_ENOIMP if no callback is registered for the event,
+    otherwise the callback's return value. */
+usbError usbiCallback(usbCallbackEvent cbEvent, void *param);
+
 #endif /* USB_H */
@@ -1,78 +1,66 @@
 /* USB Buffer Descriptor (BD) management implementation */
 
-/* TODO Assumes no ping-pong on any endpoint. */
-
 /* usbBdHandle is just an index into the usbBdt. It depends
    on endpoint, in/out direction, and whether ping-pong is
    enabled (and when it is, on whether it's an even or odd transfer ) */
 
+/* The BDT only has entries up to USB_CFG_HIGHEST_ENDPOINT. With
+   USB_CFG_PPB_ALL_BUT_EP0, EP0 has one BD per direction and every other
+   endpoint direction has an even BD followed by an odd BD:
+
+     0: EP0 OUT, 1: EP0 IN, 2: EP1 OUT even, 3: EP1 OUT odd, 4: EP1 IN even...
+*/
+
 #include <p18f2550.h>
+#include <stdio.h>
 
 #include "usb_bd.h"
 #include "usb.h"
+#include "usb_config.h"
 
 #include "string.h"
 
-/** Max number of buffer descriptors */
-#define USB_CFG_NUM_BDS 32 /* up to 64 with ping pong */
-
-/** Start of the USB endpoint memory buffer, past the BDT */
-/* This is not optimal because in many cases, most of BDT is empty */
-#define USB_CFG_ENDPOINT_BUFFER_ORIGIN 0x500
+/** Start of the USB endpoint memory buffer, right past the BDT */
+#define USB_CFG_ENDPOINT_BUFFER_ORIGIN (0x400 + USB_CFG_BDT_BYTES)
 
-/** USB endpoint memory buffer size */
-#define USB_CFG_ENDPOINT_BUFFER_SIZE 0x300
-
-/* Extract the endpoint number from the USTAT register */
-#define USTAT_EP ((USTAT & 0x78) >> 3)
+/** USB endpoint memory buffer size, up to the RAM kept for the OUT rings
+    at the end of USB RAM (bank 7) */
+#define USB_CFG_ENDPOINT_BUFFER_SIZE \
+    (USB_CFG_RING_RAM_START - USB_CFG_ENDPOINT_BUFFER_ORIGIN)
 
 #define MIN(a,b) ((a)<(b))?(a):(b)
 
-/** Buffer Descriptor Status register (BDnSTAT) */
-typedef union {
-    unsigned char val; /**< Entire register */
-
-    /* CPU mode */
-    struct {
-        unsigned BC:2;     /**< BC8, BC9 - byte count */
-        unsigned BSTALL:1; /**< Buffer Stall Enable */
-        unsigned DTSEN:1;  /**< Data Toggle Sync Enable */
-        unsigned INCDIS:1; /**< Address Increment Disable (SPP only) */
-        unsigned KEN:1;    /**< BD Keep Enable (SPP only) */
-        unsigned DTS:1;    /**< Data Toggle Sync (ignored unless DTSEN = 1) */
-        unsigned UOWN:1;   /**< 0 - CPU owns this BD */
-    };
-
-    /* SIE mode */
-    struct {
-        unsigned BC:2;     /**< BC8, BC9 - byte count */
-        unsigned PID:4;    /**< Token PID of the last transfer */
-        unsigned :1;
-        unsigned UOWN:1;   /**< 1 - SIE owns this BD */
-    };
-} usbBdStat;
-
-/** Buffer Descriptor (BD) structure */
-typedef struct {
-    usbBdStat stat; /**< BDnSTAT - status */
-    unsigned char cnt; /**< BDnCNT - byte count (+2 bits in stat) */
-    char *addr; /**< BDnADRL, BDnADRH - buffer address */
-} usbBd;
-
 /* Define the USB Buffer Descriptor table in memory */
 #pragma udata usb4=0x400
     volatile usbBd usbBdt[USB_CFG_NUM_BDS];
 #pragma udata
 
 char *endOfAllocatedBuffer;
-/* This is the highest EP that has been set up. It is used to calculate size */
+/* This is the highest EP that has been set up, buffers are allocated in
+   handle order */
 usbBdHandle highestSetupBD;
 
+/* Buffer size of every BD. The size cannot be derived from the distance
+   to the next BD's buffer, since an OUT ring (usb_ring.h) re-points its
+   BDs at buffers outside the endpoint pool. */
+unsigned int usbBdSizes[USB_CFG_NUM_BDS];
+
+/* Number of BDs of an endpoint direction */
+char usbBdCount(char endpoint)
+{
+#if (USB_CFG_PING_PONG == USB_CFG_PPB_ALL_BUT_EP0)
+    if (0 != endpoint) {
+        return 2;
+    }
+#endif
+    return 1;
+}
+
 usbError usbBdGetHandleForEndpoint(char endpoint, usbEndpointDirection dir, char *handle)
 {
     char endpointIndex;
 
-    if (endpoint >= USB_MAX_ENDPOINTS) {
+    if (endpoint >= USB_CFG_NUM_ENDPOINTS) {
         return USB_EBADPARM;
     }
 
@@ -80,58 +68,57 @@ usbError usbBdGetHandleForEndpoint(char endpoint, usbEndpointDirection dir, char
     if (USB_ED_IN == dir) {
         endpointIndex++;
     }
+#if (USB_CFG_PING_PONG == USB_CFG_PPB_ALL_BUT_EP0)
+    if (0 != endpoint) {
+        endpointIndex = endpointIndex*2 - 2;
+    }
+#endif
     *handle = endpointIndex;
     return USB_SUCCESS;
 }
 
 usbBdHandle usbBdGetHandleForTransaction()
 {
-    unsigned char ep = USTAT_EP;
-    return ep*2 + USTATbits.DIR;
+    return usbBdFastTransactionHandle();
+}
+
+usbBdHandle usbBdGetPingPong(usbBdHandle handle)
+{
+#if (USB_CFG_PING_PONG == USB_CFG_PPB_ALL_BUT_EP0)
+    if (handle >= 2) {
+        return handle ^ 1;
+    }
+#endif
+    return handle;
 }
 
 void usbBdInit()
 {
     (void) memset((void *)usbBdt, 0, sizeof(usbBd)*USB_CFG_NUM_BDS);
+    (void) memset((void *)usbBdSizes, 0, sizeof(usbBdSizes));
     endOfAllocatedBuffer = (char *)USB_CFG_ENDPOINT_BUFFER_ORIGIN;
     highestSetupBD = 0;
 }
 
-/* The size is the difference between this BD's address and the next
-   allocated BD's address. For the last allocated BD, this is the difference
-   between its address and end of allocated buffer. This works because of
-   sequential setup requirement. If there are few gaps in the BDT, it is
-   also relatively efficient, and saves storage by not storing the size
-   explicitly for each BD. */
 int usbBdGetSize(usbBdHandle handle)
 {
-    int size = endOfAllocatedBuffer - usbBdt[handle].addr;
-    usbBdHandle loopHandle = handle + 1;
-
-    while (loopHandle <= highestSetupBD) {
-        if (0 != usbBdt[loopHandle].addr) {
-            size = usbBdt[loopHandle].addr - usbBdt[handle].addr;
-            break;
-        }
-    }
-
-    return size;
+    return usbBdSizes[handle];
 }
 
 void usbBdResetSize(usbBdHandle handle)
 {
     int size = usbBdGetSize(handle);
 
-    usbBdt[handle].cnt = size & 0xFF;
-    usbBdt[handle].stat.BC = size >> 8;
+    usbBdFastSetCount(handle, size);
 }
 
 usbError usbBdSetup(char endpoint, usbEndpointDirection dir, unsigned int size)
 {
     usbBdHandle handle;
     unsigned int allocatedBufferSize;
+    char count, i;
 
-    if ((endpoint >= USB_MAX_ENDPOINTS) || ((unsigned char)0 == size)) {
+    if ((endpoint >= USB_CFG_NUM_ENDPOINTS) || ((unsigned char)0 == size)) {
         return USB_EBADPARM;
     }
 
@@ -146,20 +133,46 @@ usbError usbBdSetup(char endpoint, usbEndpointDirection dir, unsigned int size)
         return USB_ERROR;
     }
 
+    /* Ping-pong endpoints get an even and an odd buffer */
+    count = usbBdCount(endpoint);
     allocatedBufferSize = endOfAllocatedBuffer - (char *)USB_CFG_ENDPOINT_BUFFER_ORIGIN;
-    if (USB_CFG_ENDPOINT_BUFFER_SIZE - allocatedBufferSize < size) {
+    if (USB_CFG_ENDPOINT_BUFFER_SIZE - allocatedBufferSize < size * count) {
         return USB_ENOMEM;
     }
 
-    usbBdt[handle].addr = endOfAllocatedBuffer;
-
-    endOfAllocatedBuffer = endOfAllocatedBuffer + size;
-    highestSetupBD = handle;
+    for (i = 0; i < count; i++) {
+        usbBdt[handle + i].addr = endOfAllocatedBuffer;
+        usbBdSizes[handle + i] = size;
+        endOfAllocatedBuffer = endOfAllocatedBuffer + size;
+    }
+    highestSetupBD = handle + count - 1;
 
-    usbBdResetSize(handle);
+    for (i = 0; i < count; i++) {
+        usbBdResetSize(handle + i);
+    }
     return USB_SUCCESS;
 }
 
+void usbBdFreeEndpoints(void)
+{
+    /* EP0 always has handles 0 (OUT) and 1 (IN) */
+    endOfAllocatedBuffer = usbBdt[1].addr + usbBdGetSize(1);
+    (void) memset((void *)&usbBdt[2], 0, sizeof(usbBd)*(USB_CFG_NUM_BDS - 2));
+    (void) memset((void *)&usbBdSizes[2], 0,
+                  sizeof(unsigned int)*(USB_CFG_NUM_BDS - 2));
+    highestSetupBD = 1;
+}
+
+#if USB_CFG_DEBUG
+void usbBdAssertFailed(usbBdHandle handle, int line)
+{
+    printf("bd: Check failed, handle=%d, line=%d\r\n", handle, line);
+    while (1) {
+        ;
+    }
+}
+#endif
+
 usbError usbBdGetPID(usbBdHandle bdHandle, char *pid)
 {
     if ((bdHandle >= USB_CFG_NUM_BDS)) {
@@ -169,14 +182,14 @@ usbError usbBdGetPID(usbBdHandle bdHandle, char *pid)
     if (usbBdt[bdHandle].stat.UOWN == (unsigned char)1) {
         return USB_EACCESS;
     } else {
-        *pid = usbBdt[bdHandle].stat.PID;
+        *pid = usbBdFastPID(bdHandle);
         return USB_SUCCESS;
     }
 }
 
 usbError usbBdRelease(usbBdHandle handle)
 {
-    usbBdt[handle].stat.UOWN = 1;
+    usbBdFastRelease(handle);
     return USB_SUCCESS;
 }
 
@@ -189,24 +202,29 @@ usbError usbBdClaim(usbBdHandle handle)
     return USB_SUCCESS;
 }
 
-usbEndpointDirection usbBdGetDirection(usbBdHandle handle)
+usbError usbBdReset(usbBdHandle handle)
 {
-    if (0 == (handle & 1)) {
-        return USB_ED_OUT;
-    } else {
-        return USB_ED_IN;
+    if ((handle >= USB_CFG_NUM_BDS)) {
+        return USB_EBADPARM;
     }
+    usbBdt[handle].stat.UOWN = 0;
+    usbBdt[handle].stat.BSTALL = 0;
+    usbBdResetSize(handle);
+    return USB_SUCCESS;
+}
+
+usbEndpointDirection usbBdGetDirection(usbBdHandle handle)
+{
+    return usbBdFastDirection(handle);
 }
 
 char usbBdGetEndpoint(usbBdHandle handle)
 {
-    return handle >> 1;
+    return usbBdFastEndpoint(handle);
 }
 
 usbError usbBdGetBuf(usbBdHandle handle, char **buf, int *size)
 {
-    int bc;
-
     if ((handle >= USB_CFG_NUM_BDS)) {
         return USB_EBADPARM;
     }
@@ -219,10 +237,9 @@ usbError usbBdGetBuf(usbBdHandle handle, char **buf, int *size)
         return USB_ERROR; /* This BD has not been initialized */
     }
 
-    *buf = usbBdt[handle].addr;
+    *buf = usbBdFastBuf(handle);
     if (USB_ED_OUT == usbBdGetDirection(handle)) {
-        bc = usbBdt[handle].stat.BC;
-        *size = usbBdt[handle].cnt + (bc << 8);
+        *size = usbBdFastCount(handle);
     } else {
         *size = usbBdGetSize(handle);
     }
@@ -239,7 +256,7 @@ usbError usbBdGetSent(usbBdHandle handle, int *size)
         return USB_EACCESS;
     }
 
-    *size = (usbBdt[handle].stat.BC << 8) + usbBdt[handle].cnt;
+    *size = usbBdFastCount(handle);
     return USB_SUCCESS;
 }
 
@@ -253,16 +270,12 @@ usbError usbBdStall(usbBdHandle handle)
         return USB_EACCESS;
     }
 
-    usbBdt[handle].stat.BSTALL = 1;
-
-    usbBdResetSize(handle);
-    return usbBdRelease(handle);
+    usbBdFastStall(handle);
+    return USB_SUCCESS;
 }
 
 usbError usbBdReceive(usbBdHandle handle)
 {
-    int size;
-
     if ((handle >= USB_CFG_NUM_BDS) || (USB_ED_OUT != usbBdGetDirection(handle))) {
         return USB_EBADPARM;
     }
@@ -271,14 +284,8 @@ usbError usbBdReceive(usbBdHandle handle)
         return USB_EACCESS;
     }
     
-    size = usbBdGetSize(handle);
-    
-    usbBdt[handle].cnt = size & 0xFF;
-    usbBdt[handle].stat.BC = size >> 8;
-    usbBdt[handle].stat.BSTALL = 0;
-    usbBdRelease(handle);
-
-    return USB_SUCCESS;    
+    usbBdFastReceive(handle);
+    return USB_SUCCESS;
 }
 
 usbError usbBdSend(usbBdHandle handle, int size)
@@ -297,12 +304,8 @@ usbError usbBdSend(usbBdHandle handle, int size)
     if (epSize < size) {
         return USB_EBADPARM;
     }
-    
-    usbBdt[handle].cnt = size & 0xFF;
-    usbBdt[handle].stat.BC = size >> 8;
-    usbBdt[handle].stat.BSTALL = 0;
-    usbBdRelease(handle);
 
+    usbBdFastSend(handle, size);
     return USB_SUCCESS;
 }
 
@@ -316,9 +319,7 @@ usbError usbBdSetSync(usbBdHandle handle, usbBdSyncMode mode, usbBdSyncVal value
         return USB_EACCESS;
     }
 
-    usbBdt[handle].stat.DTSEN = mode;
-    usbBdt[handle].stat.DTS = value;
-
+    usbBdFastSetSync(handle, mode, value);
     return USB_SUCCESS;
 }
 
@@ -8,6 +8,7 @@
 #define USB_BD_H
 
 #include "usb.h"
+#include "usb_config.h"
 
 typedef enum {
     USB_DTS_ON = 1,
@@ -22,6 +23,43 @@ typedef enum {
 /** An opaque Buffer Descriptor handle. */
 typedef char usbBdHandle;
 
+/** Buffer Descriptor Status register (BDnSTAT) */
+typedef union {
+    unsigned char val; /**< Entire register */
+
+    /* CPU mode */
+    struct {
+        unsigned BC:2;     /**< BC8, BC9 - byte count */
+        unsigned BSTALL:1; /**< Buffer Stall Enable */
+        unsigned DTSEN:1;  /**< Data Toggle Sync Enable */
+        unsigned INCDIS:1; /**< Address Increment Disable (SPP only) */
+        unsigned KEN:1;    /**< BD Keep Enable (SPP only) */
+        unsigned DTS:1;    /**< Data Toggle Sync (ignored unless DTSEN = 1) */
+        unsigned UOWN:1;   /**< 0 - CPU owns this BD */
+    };
+
+    /* SIE mode */
+    struct {
+        unsigned BC:2;     /**< BC8, BC9 - byte count */
+        unsigned PID:4;    /**< Token PID of the last transfer */
+        unsigned :1;
+        unsigned UOWN:1;   /**< 1 - SIE owns this BD */
+    };
+} usbBdStat;
+
+/** Buffer Descriptor (BD) structure */
+typedef struct {
+    usbBdStat stat; /**< BDnSTAT - status */
+    unsigned char cnt; /**< BDnCNT - byte count (+2 bits in stat) */
+    char *addr; /**< BDnADRL, BDnADRH - buffer address */
+} usbBd;
+
+/** The Buffer Descriptor Table, only for the fast-path accessors below */
+extern volatile usbBd usbBdt[USB_CFG_NUM_BDS];
+
+/** Buffer size of every BD, only for the fast-path accessors below */
+extern unsigned int usbBdSizes[USB_CFG_NUM_BDS];
+
 /** Power-up initialization (zeroing) of the BD Table
  
     The 2550 datasheet says the UOWN bit of each BD must be
@@ -33,17 +71,30 @@ void usbBdInit(void);
  
     The setup should be performed only once. The setup must be
     performed sequentially (rising order of endpoints, out
-    direction first).
+    direction first). With ping-pong buffering, both the even and the
+    odd BD get a buffer of the given size.
 */
 usbError usbBdSetup(char endpoint, usbEndpointDirection dir, unsigned int size);
 
+/** Release the buffers and clear the BDs of all endpoints but EP0, so
+    they can be set up again for a new configuration */
+void usbBdFreeEndpoints(void);
+
 /** Returns the endpoint handle used in the currently
     processed transaction */
 usbBdHandle usbBdGetHandleForTransaction(void);
 
-/** Returns the endpoint handle */
+/** Returns the endpoint handle
+
+    With ping-pong buffering, this is the handle of the even BD. */
 usbError usbBdGetHandleForEndpoint(char endpoint, usbEndpointDirection dir, usbBdHandle *handle);
 
+/** Returns the other BD of a ping-pong pair
+
+    For an endpoint without ping-pong buffering, the handle itself is
+    returned. */
+usbBdHandle usbBdGetPingPong(usbBdHandle handle);
+
 /** Get the direction (OUT/IN) for a handle */
 usbEndpointDirection usbBdGetDirection(usbBdHandle handle);
 
@@ -87,4 +138,140 @@ usbError usbBdSetSync(usbBdHandle handle, usbBdSyncMode mode, usbBdSyncVal value
     Ensure SIE is not processing packets when this is called. */
 usbError usbBdClaim(usbBdHandle bdHandle);
 
+/** Take a BD back from the SIE and clear its stall, when an endpoint
+    halt is cleared. The data toggle is set when the BD is armed again. */
+usbError usbBdReset(usbBdHandle handle);
+
+/* Fast-path accessors
+
+   The functions above validate the handle, the BD ownership and the
+   direction on every call. The macros below do the same work without the
+   checks or the call, for code that holds a set-up BD owned by the CPU:
+   typically the handle of a transaction that has just completed, or a BD
+   the code has claimed. A macro's arguments may be evaluated more than
+   once.
+
+   With USB_CFG_DEBUG, the checks are made anyway and a failed check
+   halts in usbBdAssertFailed(). */
+
+/** Direction argument of usbBdFastCheck() for either direction */
+#define USB_BD_ANY_DIR 2
+
+#if USB_CFG_DEBUG
+/** Report a failed BD check and halt */
+void usbBdAssertFailed(usbBdHandle handle, int line);
+#define usbBdAssert(cond, handle) \
+    ((cond) ? (void)0 : usbBdAssertFailed((handle), __LINE__))
+#else
+#define usbBdAssert(cond, handle) ((void)0)
+#endif
+
+/** Endpoint number and direction of a handle, see usbBdGetEndpoint() */
+#if (USB_CFG_PING_PONG == USB_CFG_PPB_ALL_BUT_EP0)
+#define usbBdFastEndpoint(handle) \
+    (((handle) >= 2) ? (((handle) + 2) >> 2) : ((handle) >> 1))
+#define usbBdFastDirection(handle) \
+    ((usbEndpointDirection)((((handle) >= 2) ? (((handle) + 2) >> 1) : (handle)) & 1))
+#else
+#define usbBdFastEndpoint(handle) ((handle) >> 1)
+#define usbBdFastDirection(handle) ((usbEndpointDirection)((handle) & 1))
+#endif
+
+/** Handle of the transaction at the head of the USTAT FIFO, see
+    usbBdGetHandleForTransaction(). USTAT is ENDP3:0, DIR, PPBI from bit 6
+    down to bit 1; the BDT has no odd BDs for EP0. */
+#if (USB_CFG_PING_PONG == USB_CFG_PPB_ALL_BUT_EP0)
+#define usbBdFastTransactionHandle() \
+    ((usbBdHandle)((0 != (USTAT & 0x78)) ? ((USTAT >> 1) - 2) : (USTAT >> 2)))
+#else
+#define usbBdFastTransactionHandle() ((usbBdHandle)(USTAT >> 2))
+#endif
+
+/** Non-zero if a BD has a buffer, i.e. its endpoint is set up */
+#define usbBdFastIsSetUp(handle) (0 != usbBdt[handle].addr)
+
+/** The checks the functions make, as assertions */
+#define usbBdFastCheck(handle, dir) \
+    (usbBdAssert((handle) < USB_CFG_NUM_BDS, handle), \
+     usbBdAssert(0 != usbBdt[handle].addr, handle), \
+     usbBdAssert(0 == usbBdt[handle].stat.UOWN, handle), \
+     usbBdAssert((USB_BD_ANY_DIR == (dir)) || \
+                 ((dir) == usbBdFastDirection(handle)), handle))
+
+/** The buffer of a BD, see usbBdGetBuf() */
+#define usbBdFastBuf(handle) \
+    (usbBdFastCheck(handle, USB_BD_ANY_DIR), usbBdt[handle].addr)
+
+/** Bytes received (OUT) or sent (IN) in the last transaction */
+#define usbBdFastCount(handle) \
+    (usbBdFastCheck(handle, USB_BD_ANY_DIR), \
+     (int)usbBdt[handle].cnt + ((int)usbBdt[handle].stat.BC << 8))
+
+/** Token PID of the last transaction, see usbBdGetPID() */
+#define usbBdFastPID(handle) \
+    (usbBdFastCheck(handle, USB_BD_ANY_DIR), usbBdt[handle].stat.PID)
+
+/** See usbBdSetSync() */
+#define usbBdFastSetSync(handle, mode, value) \
+    do { \
+        usbBdFastCheck(handle, USB_BD_ANY_DIR); \
+        usbBdt[handle].stat.DTSEN = (mode); \
+        usbBdt[handle].stat.DTS = (value); \
+    } while (0)
+
+/** Hand a BD to the SIE. The SIE leaves the last PID in KEN and INCDIS. */
+#define usbBdFastRelease(handle) \
+    do { \
+        usbBdt[handle].stat.KEN = 0; \
+        usbBdt[handle].stat.INCDIS = 0; \
+        usbBdt[handle].stat.UOWN = 1; \
+    } while (0)
+
+/** Set the byte count of a BD */
+#define usbBdFastSetCount(handle, size) \
+    do { \
+        usbBdt[handle].cnt = (size) & 0xFF; \
+        usbBdt[handle].stat.BC = (size) >> 8; \
+    } while (0)
+
+/** See usbBdSend() */
+#define usbBdFastSend(handle, size) \
+    do { \
+        usbBdFastCheck(handle, USB_ED_IN); \
+        usbBdAssert((size) <= usbBdSizes[handle], handle); \
+        usbBdFastSetCount(handle, size); \
+        usbBdt[handle].stat.BSTALL = 0; \
+        usbBdFastRelease(handle); \
+    } while (0)
+
+/** See usbBdReceive() */
+#define usbBdFastReceive(handle) \
+    do { \
+        usbBdFastCheck(handle, USB_ED_OUT); \
+        usbBdFastSetCount(handle, usbBdSizes[handle]); \
+        usbBdt[handle].stat.BSTALL = 0; \
+        usbBdFastRelease(handle); \
+    } while (0)
+
+/** See usbBdStall() */
+#define usbBdFastStall(handle) \
+    do { \
+        usbBdFastCheck(handle, USB_BD_ANY_DIR); \
+        usbBdt[handle].stat.BSTALL = 1; \
+        usbBdFastSetCount(handle, usbBdSizes[handle]); \
+        usbBdFastRelease(handle); \
+    } while (0)
+
+/** Point a BD at another buffer of at least the BD's size, in USB RAM.
+    Used by the OUT rings (usb_ring.h) to receive straight into the
+    application's slots. */
+#define usbBdFastSetBuf(handle, buf) \
+    do { \
+        usbBdFastCheck(handle, USB_BD_ANY_DIR); \
+        usbBdt[handle].addr = (buf); \
+    } while (0)
+
+/** Size of a BD's buffer, the max packet size of its endpoint */
+int usbBdGetSize(usbBdHandle handle);
+
 #endif /* USB_BD_H */
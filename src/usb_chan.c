@@ -0,0 +1,171 @@
+/* USB IN channel implementation */
+
+/* The channel table is kept sorted by priority at open time, so the
+   refill pass is a single walk. Each channel keeps the BD it fills next;
+   without ping-pong buffering this is always the same BD. A BD is free
+   when usbBdGetBuf() succeeds on it: owned by the CPU and set up by the
+   active configuration. */
+
+#include <p18f2550.h>
+#include <stdio.h>
+
+#include "usb_chan.h"
+#include "usb_bd.h"
+
+#if (USB_CFG_NUM_CHANNELS > 0)
+
+typedef struct {
+    char endpoint; /**< 0 if this entry is not used */
+    unsigned char priority;
+    char ready; /**< The application has data */
+    char started; /**< The device is configured */
+    usbBdHandle next; /**< The BD to fill next */
+    usbBdSyncVal sync; /**< Data toggle of the next packet */
+    usbChanFill fill;
+} usbChannel;
+
+static usbChannel usbChannels[USB_CFG_NUM_CHANNELS];
+static char usbChanCount;
+
+usbChannel *usbChanFind(char endpoint)
+{
+    char i;
+
+    for (i = 0; i < usbChanCount; i++) {
+        if (endpoint == usbChannels[i].endpoint) {
+            return &usbChannels[i];
+        }
+    }
+    return 0;
+}
+
+usbError usbChanOpen(char endpoint, unsigned char priority, usbChanFill fill)
+{
+    char i;
+
+    if ((0 == endpoint) || (endpoint >= USB_CFG_NUM_ENDPOINTS) ||
+        (0 == fill) || (0 != usbChanFind(endpoint))) {
+        return USB_EBADPARM;
+    }
+    if (usbChanCount >= USB_CFG_NUM_CHANNELS) {
+        printf("chan: No free entries\r\n");
+        return USB_ENOMEM;
+    }
+
+    /* Insert in priority order, after channels of the same priority */
+    i = usbChanCount;
+    while ((i > 0) && (usbChannels[i - 1].priority > priority)) {
+        usbChannels[i] = usbChannels[i - 1];
+        i--;
+    }
+    usbChannels[i].endpoint = endpoint;
+    usbChannels[i].priority = priority;
+    usbChannels[i].ready = 0;
+    usbChannels[i].started = 0;
+    usbChannels[i].fill = fill;
+    usbChanCount++;
+    return USB_SUCCESS;
+}
+
+/* Fill and send packets while the channel has data and a free BD */
+void usbChanRefill(usbChannel *chan)
+{
+    char *buf;
+    int size;
+
+    while (chan->ready && (USB_SUCCESS == usbBdGetBuf(chan->next, &buf, &size))) {
+        if (USB_SUCCESS != chan->fill(buf, &size)) {
+            chan->ready = 0;
+            return;
+        }
+        usbBdFastSetSync(chan->next, USB_DTS_ON, chan->sync);
+        usbBdFastSend(chan->next, size);
+        chan->sync = (USB_DTS_DATA0 == chan->sync) ? USB_DTS_DATA1 : USB_DTS_DATA0;
+        chan->next = usbBdGetPingPong(chan->next);
+    }
+}
+
+usbError usbChanReady(char endpoint)
+{
+    usbChannel *chan = usbChanFind(endpoint);
+
+    if (0 == chan) {
+        return USB_EBADPARM;
+    }
+    chan->ready = 1;
+    if (chan->started) {
+        usbChanRefill(chan);
+    }
+    return USB_SUCCESS;
+}
+
+void usbChanStart(void)
+{
+    char i;
+    usbChannel *chan = usbChannels;
+
+    for (i = 0; i < usbChanCount; i++) {
+        /* Fresh BDs are owned by the CPU */
+        (void) usbBdGetHandleForEndpoint(chan->endpoint, USB_ED_IN, &chan->next);
+        chan->sync = USB_DTS_DATA0;
+        chan->started = 1;
+        chan++;
+    }
+}
+
+void usbChanStop(void)
+{
+    char i;
+
+    for (i = 0; i < usbChanCount; i++) {
+        usbChannels[i].started = 0;
+    }
+}
+
+void usbChanService(void)
+{
+    char i;
+    usbChannel *chan = usbChannels;
+
+    for (i = 0; i < usbChanCount; i++) {
+        if (chan->started) {
+            usbChanRefill(chan);
+        }
+        chan++;
+    }
+}
+
+void usbChanHalt(char endpoint)
+{
+    usbChannel *chan = usbChanFind(endpoint);
+    usbBdHandle other;
+    char *buf;
+    int size;
+
+    if ((0 == chan) || !chan->started) {
+        return;
+    }
+
+    /* The packets armed on the endpoint are dropped. With ping-pong
+       buffering, the SIE takes the BDs in turn: if only the other BD is
+       armed, the SIE expects that one next, and it is refilled first. */
+    other = usbBdGetPingPong(chan->next);
+    if ((other != chan->next) &&
+        (USB_SUCCESS == usbBdGetBuf(chan->next, &buf, &size)) &&
+        (USB_EACCESS == usbBdGetBuf(other, &buf, &size))) {
+        chan->next = other;
+    }
+}
+
+void usbChanRestart(char endpoint)
+{
+    usbChannel *chan = usbChanFind(endpoint);
+
+    if ((0 == chan) || !chan->started) {
+        return;
+    }
+    chan->sync = USB_DTS_DATA0;
+    usbChanRefill(chan);
+}
+
+#endif /* USB_CFG_NUM_CHANNELS */
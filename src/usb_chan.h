@@ -0,0 +1,69 @@
+/** USB IN channel header
+
+    A channel is a device-to-host data stream on its own interrupt or bulk
+    IN endpoint. The endpoint's buffer and UEPn setting come from the
+    configuration descriptor; the channel fills the buffer through the
+    application's callback and keeps track of the data toggle.
+
+    When a channel has data, the application marks it ready. Every BD the
+    host has emptied is refilled at the end of the USB task's transaction
+    pass, channels with a lower priority value first, so an urgent channel
+    is armed before a bulk one and does not wait behind it. With ping-pong
+    buffering, both BDs of an endpoint are kept filled.
+
+    Transactions on channel endpoints are still passed to the
+    USB_CB_TRANSACTION callback before the refill.
+*/
+
+#ifndef USB_CHAN_H
+#define USB_CHAN_H
+
+#include "usb.h"
+#include "usb_config.h"
+
+/** Fill callback. buf is the endpoint buffer and size its size on entry;
+    the callback writes a packet and sets size to its length. Any return
+    value other than USB_SUCCESS means there is no more data, and the
+    channel stops being refilled until usbChanReady() is called. */
+typedef usbError (*usbChanFill)(char *buf, int *size);
+
+#if (USB_CFG_NUM_CHANNELS > 0)
+
+/** Open a channel on an IN endpoint. Lower priority values are refilled
+    first. The channel starts when the device is configured; if the
+    configuration does not declare the endpoint, it stays idle. */
+usbError usbChanOpen(char endpoint, unsigned char priority, usbChanFill fill);
+
+/** The application has data for a channel. If the endpoint buffer is
+    free, it is filled right away. */
+usbError usbChanReady(char endpoint);
+
+/* The following functions are internal to the USB library */
+
+/** Start the channels, called once the endpoints are set up */
+void usbChanStart(void);
+
+/** Stop the channels, their endpoints are going away */
+void usbChanStop(void);
+
+/** Refill the free endpoint buffers of the ready channels */
+void usbChanService(void);
+
+/** The endpoint of a channel is about to be halted, its BDs taken from
+    the SIE */
+void usbChanHalt(char endpoint);
+
+/** The halt of the endpoint has been cleared: restart at DATA0 */
+void usbChanRestart(char endpoint);
+
+#else
+
+#define usbChanStart()
+#define usbChanStop()
+#define usbChanService()
+#define usbChanHalt(endpoint)
+#define usbChanRestart(endpoint)
+
+#endif /* USB_CFG_NUM_CHANNELS */
+
+#endif /* USB_CHAN_H */
@@ -0,0 +1,96 @@
+/** USB stack configuration
+
+    Set these values to match the application. The Buffer Descriptor Table
+    and the stack's endpoint tables are sized from them at compile time.
+*/
+
+#ifndef USB_CONFIG_H
+#define USB_CONFIG_H
+
+/** Highest endpoint number used by the application (0-15) */
+#define USB_CFG_HIGHEST_ENDPOINT 3
+
+/** Ping-pong buffering modes, values of UCFG.PPB */
+#define USB_CFG_PPB_NONE 0 /**< No ping-pong buffers */
+#define USB_CFG_PPB_ALL_BUT_EP0 3 /**< Ping-pong on all endpoints except EP0 */
+/* PPB modes 1 and 2 put EP0 OUT into ping-pong mode, which the control
+   transfer handler does not support. */
+
+/** Ping-pong buffering mode */
+#define USB_CFG_PING_PONG USB_CFG_PPB_NONE
+
+/** EP0 buffer size, 8 bytes min, 64 bytes max. Two buffers of this size
+    are allocated - one for IN and one for OUT directions. */
+#define USB_CFG_EP0_BUFFER_SIZE 8
+
+/** Max number of isochronous endpoints (usb_iso.h), 0 to leave the
+    isochronous support out. Requires USB_CFG_PPB_ALL_BUT_EP0. */
+#define USB_CFG_NUM_ISO 0
+
+/** Max number of IN channels (usb_chan.h), 0 to leave them out */
+#define USB_CFG_NUM_CHANNELS 3
+
+/** Max number of OUT rings (usb_ring.h), 0 to leave them out */
+#define USB_CFG_NUM_RINGS 1
+
+/** USB RAM at the end of bank 7 kept out of the endpoint buffers, for
+    the slots of the OUT rings. The application places the slots there
+    with #pragma udata, from USB_CFG_RING_RAM_START. */
+#define USB_CFG_RING_RAM_BYTES 256
+
+/** Vendor request code (bMS_VendorCode of the BOS descriptor) the host
+    reads the Microsoft OS 2.0 descriptor set with, 0 to leave the
+    support out. The set is the USB_CTL_DESC_MSOS20 entry of the
+    descriptor list. The code must not be used by other vendor requests
+    of the application. */
+#define USB_CFG_MSOS20_VENDOR_CODE 10
+
+/** VBUS sense input, non-zero while the host powers the bus. A
+    bus-powered device is always attached: define it as 1. */
+#define USB_CFG_VBUS_SENSE() (PORTCbits.RC0)
+
+/** VBUS is sampled every USB_CFG_SENSE_PERIOD_MS; a change is acted on
+    once the level has been stable for USB_CFG_SENSE_DEBOUNCE_MS */
+#define USB_CFG_SENSE_PERIOD_MS 10
+#define USB_CFG_SENSE_DEBOUNCE_MS 100
+
+/** Once the module is enabled, the bus must leave the single-ended zero
+    state within USB_CFG_SE0_TIMEOUT_MS, otherwise the module is disabled
+    and the attach is retried */
+#define USB_CFG_SE0_TIMEOUT_MS 100
+
+/** Resume signaling time of a remote wakeup, 1-15 ms per the spec */
+#define USB_CFG_RESUME_SIGNAL_MS 5
+
+/** Non-zero to turn the checks of the fast-path BD accessors (usb_bd.h)
+    into assertions. Costs code space and time on every transaction. */
+#define USB_CFG_DEBUG 0
+
+/* Derived values, do not edit */
+
+#define USB_CFG_NUM_ENDPOINTS (USB_CFG_HIGHEST_ENDPOINT + 1)
+
+#if (USB_CFG_PING_PONG == USB_CFG_PPB_NONE)
+#define USB_CFG_NUM_BDS (USB_CFG_NUM_ENDPOINTS * 2)
+#elif (USB_CFG_PING_PONG == USB_CFG_PPB_ALL_BUT_EP0)
+#define USB_CFG_NUM_BDS (USB_CFG_NUM_ENDPOINTS * 4 - 2)
+#else
+#error "Unsupported USB_CFG_PING_PONG mode"
+#endif
+
+#if (USB_CFG_HIGHEST_ENDPOINT > 15)
+#error "USB_CFG_HIGHEST_ENDPOINT must be 15 or less"
+#endif
+
+/** Start of the OUT ring slots in USB RAM */
+#define USB_CFG_RING_RAM_START (0x800 - USB_CFG_RING_RAM_BYTES)
+
+/** Size of one Buffer Descriptor in bytes */
+#define USB_CFG_BD_SIZE 4
+
+/** USB RAM (banks 4-7) taken by the BDT, and saved compared to a full
+    64-entry table */
+#define USB_CFG_BDT_BYTES (USB_CFG_NUM_BDS * USB_CFG_BD_SIZE)
+#define USB_CFG_BDT_BYTES_SAVED (64 * USB_CFG_BD_SIZE - USB_CFG_BDT_BYTES)
+
+#endif /* USB_CONFIG_H */
@@ -9,6 +9,7 @@
 #include "usb_ctl.h"
 #include "usb.h"
 #include "usb_bd.h"
+#include "usb_config.h"
 
 #include "string.h"
 
@@ -27,11 +28,6 @@ typedef enum {
     USB_CTL_DIR_IN = 1
 } usbCtlDir;
 
-typedef enum {
-    USB_CTL_FROM_ROM,
-    USB_CTL_FROM_RAM
-} usbCtlSource;
-
 /** Values for usbCtlRequestType.requestType */
 typedef enum {
     USB_CTL_REQ_STANDARD = 0,
@@ -62,6 +58,25 @@ typedef enum {
     USB_CTL_STD_SYNCH_FRAME = 12
 } usbCtlStandardRequestType;
 
+/** Standard feature selectors */
+#define USB_CTL_FEATURE_ENDPOINT_HALT 0
+#define USB_CTL_FEATURE_DEVICE_REMOTE_WAKEUP 1
+
+/** GET_STATUS(device) bits */
+#define USB_CTL_STATUS_REMOTE_WAKEUP 0x02
+
+/** Descriptor types */
+#define USB_CTL_DESC_CONFIGURATION 2
+#define USB_CTL_DESC_STRING 3
+#define USB_CTL_DESC_BOS 15
+
+/** wIndex of the vendor request reading the Microsoft OS 2.0 descriptor
+    set (MS_OS_20_DESCRIPTOR_INDEX) */
+#define USB_CTL_MSOS20_DESCRIPTOR_INDEX 7
+
+/** wTotalLength of configuration and BOS descriptors */
+#define USB_CTL_TOTAL_LENGTH 2
+
 /* Non-NULL dataPtr and a zero bytesToTransfer - zero-length packet needs to
    be sent.
  
@@ -76,28 +91,31 @@ typedef struct {
     usbCtlSource dataSource;
     char *dataPtr;
     int bytesToTransfer;
+    /** Offset of the next byte to send from dataPtr; for strings, in the
+        expanded descriptor */
+    int dataOffset;
+    /** String sources: number of source characters or bytes; fragment
+        lists: number of fragments */
+    int stringSize;
+    /** Fragment lists: type of the descriptor and its size */
+    char descType;
+    int descSize;
     usbPowerState powerState;
+    /** Remote wakeup enabled by the host */
+    char remoteWakeup;
     char getStatusBuf[2];
     /** Stores the new device address until the Status stage completes */
     char newAddress;
+    /** Control writes: the Setup packet, kept for USB_CB_VENDOR_DATA as
+        the EP0 buffer is reused by the data stage, and the data toggle of
+        the next OUT packet */
+    usbCtlSetupPacket setup;
+    usbBdSyncVal outSync;
+    /** The application holds the status stage of the control write, see
+        usbCtlDeferStatus() */
+    char statusDeferred;
 } usbCtlInternalState;
 
-/** Request Type bitfield in a Setup packet */
-typedef struct {
-    unsigned recipient:5;
-    unsigned requestType:2;
-    unsigned dir:1;
-} usbCtlRequestType;
-
-/** Setup packet structure */
-typedef struct {
-    usbCtlRequestType type;
-    unsigned char request;
-    unsigned int data;
-    unsigned int index;
-    unsigned int length;
-} usbCtlSetupPacket;
-
 static usbCtlInternalState ctlState;
 
 void usbCtlInit(void)
@@ -111,6 +129,8 @@ void usbCtlInit(void)
     ctlState.getStatusBuf[0] = 0;
     ctlState.getStatusBuf[1] = 0;
     ctlState.newAddress = 0;
+    ctlState.remoteWakeup = 0;
+    ctlState.statusDeferred = 0;
 
     (void) usbBdGetHandleForEndpoint(0, USB_ED_OUT, &ctlState.outHandle);
     (void) usbBdGetHandleForEndpoint(0, USB_ED_IN, &ctlState.inHandle);
@@ -132,44 +152,241 @@ void usbCtlAbortTransaction(void)
     ctlState.state = USB_CTL_SETUP;
     ctlState.dataPtr = 0;
     ctlState.bytesToTransfer = 0;
+    ctlState.dataOffset = 0;
+    /* A status stage still held by the application is dropped */
+    ctlState.statusDeferred = 0;
     usbBdStall(ctlState.inHandle);
 }
 
-usbError usbCtlGetDescriptor(usbCtlSetupPacket *bufPtr)
+/* Sum of the fragment sizes of a fragment list */
+int usbCtlFragmentsSize(const rom usbCtlFragment *list, int count)
+{
+    int size = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        size += list[i].size;
+    }
+    return size;
+}
+
+/* Copy size bytes of a fragment list, from offset, then fill in
+   wTotalLength if the descriptor has one. total is the descriptor size. */
+void usbCtlCopyFragments(const rom usbCtlFragment *list, int count,
+                         char type, int total, int offset, char *buf, int size)
+{
+    char *dst = buf;
+    int start = offset;
+    int left = size;
+    int piece;
+    int i;
+
+    for (i = 0; (i < count) && (0 != left); i++) {
+        if (offset >= list[i].size) {
+            offset -= list[i].size;
+            continue;
+        }
+        piece = MIN(left, list[i].size - offset);
+        if (USB_CTL_FROM_RAM == list[i].source) {
+            memcpy((void *)dst, (void *)(list[i].data + offset), piece);
+        } else {
+            memcpypgm2ram((void *)dst, (const rom void *)(list[i].data + offset),
+                          piece);
+        }
+        dst += piece;
+        left -= piece;
+        offset = 0;
+    }
+
+    if ((USB_CTL_DESC_CONFIGURATION != type) && (USB_CTL_DESC_BOS != type)) {
+        return;
+    }
+    for (i = USB_CTL_TOTAL_LENGTH; i < USB_CTL_TOTAL_LENGTH + 2; i++) {
+        if ((i >= start) && (i < start + size)) {
+            buf[i - start] = (USB_CTL_TOTAL_LENGTH == i) ?
+                             (char)total : (char)(total >> 8);
+        }
+    }
+}
+
+/* Size of a descriptor once expanded from its source */
+int usbCtlDescriptorSize(const usbCtlDescriptor *desc)
+{
+    switch (desc->source) {
+    case USB_CTL_FROM_ROM_STRING:
+        return 2 + desc->totalSize * 2;
+    case USB_CTL_FROM_EEPROM_HEX:
+        return 2 + desc->totalSize * 4;
+    case USB_CTL_FROM_FRAGMENTS:
+        return usbCtlFragmentsSize((const rom usbCtlFragment *)desc->data,
+                                   desc->totalSize);
+    default:
+        return desc->totalSize;
+    }
+}
+
+/* Start the data stage with a descriptor */
+void usbCtlSetDescriptorData(const usbCtlDescriptor *desc, unsigned int length)
+{
+    int size = usbCtlDescriptorSize(desc);
+
+    ctlState.dataSource = desc->source;
+    ctlState.dataPtr = desc->data;
+    ctlState.stringSize = desc->totalSize;
+    ctlState.descType = desc->type;
+    ctlState.descSize = size;
+    ctlState.dataOffset = 0;
+    ctlState.bytesToTransfer = MIN((int)length, size);
+    ctlState.state = USB_CTL_DATA;
+}
+
+unsigned char usbCtlReadEeprom(unsigned char address)
+{
+    /* Wait for a write in progress (store.c) */
+    while ((unsigned char)1 == EECON1bits.WR) {
+    }
+    EEADR = address;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.RD = 1;
+    return EEDATA;
+}
+
+/* Byte at an offset of a string descriptor expanded from its source */
+char usbCtlGetStringByte(int offset)
+{
+    unsigned char c;
+
+    if (0 == offset) {
+        return (USB_CTL_FROM_ROM_STRING == ctlState.dataSource) ?
+               2 + ctlState.stringSize * 2 : 2 + ctlState.stringSize * 4;
+    }
+    if (1 == offset) {
+        return USB_CTL_DESC_STRING;
+    }
+
+    /* UTF-16LE: the high byte of every character is 0 */
+    offset -= 2;
+    if (0 != (offset & 1)) {
+        return 0;
+    }
+    offset >>= 1;
+
+    if (USB_CTL_FROM_ROM_STRING == ctlState.dataSource) {
+        return ((const rom char *)ctlState.dataPtr)[offset];
+    }
+
+    /* Two hex digits per EEPROM byte, high nibble first */
+    c = usbCtlReadEeprom((unsigned char)ctlState.dataPtr + (offset >> 1));
+    if (0 == (offset & 1)) {
+        c >>= 4;
+    }
+    c &= 0x0F;
+    return (c < 10) ? '0' + c : 'A' - 10 + c;
+}
+
+usbError usbCtlFindDescriptor(usbCtlDescriptor *desc)
 {
     char i;
-    usbError ret;
-    char descType = bufPtr->data >> 8;
-    char descIndex = bufPtr->data & 0xFF;
+
+    /* The application may override the descriptor table */
+    desc->source = USB_CTL_FROM_ROM;
+    if (USB_SUCCESS == usbiCallback(USB_CB_GET_DESCRIPTOR, (void *)desc)) {
+        return USB_SUCCESS;
+    }
 
     /* Find the descriptor in the descriptor table */
     for (i=0; i<usbCtlDescriptorCount; i++) {
-        if ((usbCtlDescriptorList[i].type == descType) &&
-            (usbCtlDescriptorList[i].index == descIndex)) {
-           printf("ctl: GetDescriptor, type=%d, index=%d\r\n",
-                  descType, descIndex);
-
-           ctlState.dataSource = USB_CTL_FROM_ROM;
-           ctlState.dataPtr = usbCtlDescriptorList[i].data;
-           ctlState.bytesToTransfer = MIN((int)bufPtr->length,
-                                          usbCtlDescriptorList[i].totalSize);
-           ctlState.state = USB_CTL_DATA;
-           return USB_SUCCESS;
+        if ((usbCtlDescriptorList[i].type == desc->type) &&
+            (usbCtlDescriptorList[i].index == desc->index)) {
+            *desc = usbCtlDescriptorList[i];
+            return USB_SUCCESS;
         }
     }
-    /* Not found */
-    printf("ctl: Descriptor not found! Type=%d, index=%d\r\n",
-           descType, descIndex);
     return USB_EBADPARM;
 }
 
+unsigned char usbCtlDescriptorByte(const usbCtlDescriptor *desc, int offset)
+{
+    char c;
+
+    if (USB_CTL_FROM_RAM == desc->source) {
+        return desc->data[offset];
+    }
+    if (USB_CTL_FROM_FRAGMENTS == desc->source) {
+        usbCtlCopyFragments((const rom usbCtlFragment *)desc->data,
+                            desc->totalSize, desc->type,
+                            usbCtlDescriptorSize(desc), offset, &c, 1);
+        return c;
+    }
+    return ((const rom char *)desc->data)[offset];
+}
+
+usbError usbCtlGetDescriptor(usbCtlSetupPacket *bufPtr)
+{
+    usbCtlDescriptor desc;
+
+    desc.type = bufPtr->data >> 8;
+    desc.index = bufPtr->data & 0xFF;
+    if ((USB_CTL_DESC_MSOS20 == desc.type) ||
+        (USB_SUCCESS != usbCtlFindDescriptor(&desc))) {
+        printf("ctl: Descriptor not found! Type=%d, index=%d\r\n",
+               desc.type, desc.index);
+        return USB_EBADPARM;
+    }
+
+    printf("ctl: GetDescriptor, type=%d, index=%d\r\n", desc.type, desc.index);
+    usbCtlSetDescriptorData(&desc, bufPtr->length);
+    return USB_SUCCESS;
+}
+
+#if (USB_CFG_MSOS20_VENDOR_CODE != 0)
+/* The vendor request reading the Microsoft OS 2.0 descriptor set. Windows
+   sends it to the device once it has read the BOS descriptor. */
+usbError usbCtlGetMsOs20Descriptor(usbCtlSetupPacket *bufPtr)
+{
+    usbCtlDescriptor desc;
+
+    if ((USB_CTL_DIR_IN != bufPtr->type.dir) ||
+        (USB_CTL_REC_DEVICE != bufPtr->type.recipient)) {
+        return USB_EBADPARM;
+    }
+    desc.type = USB_CTL_DESC_MSOS20;
+    desc.index = 0;
+    if (USB_SUCCESS != usbCtlFindDescriptor(&desc)) {
+        printf("ctl: No MS OS 2.0 descriptor set\r\n");
+        return USB_EBADPARM;
+    }
+
+    printf("ctl: Get MS OS 2.0 descriptor set\r\n");
+    usbCtlSetDescriptorData(&desc, bufPtr->length);
+    return USB_SUCCESS;
+}
+#endif
+
 usbError usbCtlGetStatus(usbCtlSetupPacket *bufPtr)
 {
+    char halted;
+
+    ctlState.getStatusBuf[0] = 0;
+    ctlState.getStatusBuf[1] = 0;
     switch (bufPtr->type.recipient) {
     case USB_CTL_REC_DEVICE:
         printf("ctl: GetStatus(dev)");
         ctlState.getStatusBuf[0] = ctlState.powerState;
-        /* Remote wakeup is not supported */
+        if (ctlState.remoteWakeup) {
+            ctlState.getStatusBuf[0] |= USB_CTL_STATUS_REMOTE_WAKEUP;
+        }
+        break;
+    case USB_CTL_REC_INTERFACE:
+        /* Interfaces have no status bits */
+        break;
+    case USB_CTL_REC_ENDPOINT:
+        if (USB_SUCCESS != usbiGetHalt((unsigned char)bufPtr->index, &halted)) {
+            printf("ctl: GetStatus, no endpoint %x\r\n", bufPtr->index);
+            return USB_EBADPARM;
+        }
+        ctlState.getStatusBuf[0] = halted;
         break;
     default:
         printf("ctl: GetStatus, recipient not supported (%d)",
@@ -184,6 +401,35 @@ usbError usbCtlGetStatus(usbCtlSetupPacket *bufPtr)
     return USB_SUCCESS;
 }
 
+/* SET_FEATURE and CLEAR_FEATURE */
+usbError usbCtlSetFeature(usbCtlSetupPacket *bufPtr, char set)
+{
+    usbError ret;
+
+    if ((USB_CTL_REC_DEVICE == bufPtr->type.recipient) &&
+        (USB_CTL_FEATURE_DEVICE_REMOTE_WAKEUP == bufPtr->data)) {
+        printf("ctl: Remote wakeup %s\r\n", set ? "enabled" : "disabled");
+        ctlState.remoteWakeup = set;
+        ctlState.state = USB_CTL_STATUS;
+        return USB_SUCCESS;
+    }
+
+    if ((USB_CTL_REC_ENDPOINT == bufPtr->type.recipient) &&
+        (USB_CTL_FEATURE_ENDPOINT_HALT == bufPtr->data)) {
+        /* The endpoint is reset right away, the status stage is on EP0 */
+        ret = set ? usbHaltEndpoint((unsigned char)bufPtr->index) :
+                    usbiClearHalt((unsigned char)bufPtr->index);
+        if (USB_SUCCESS == ret) {
+            ctlState.state = USB_CTL_STATUS;
+        }
+        return ret;
+    }
+
+    printf("ctl: Feature not supported, recipient=%d feature=%d\r\n",
+           bufPtr->type.recipient, bufPtr->data);
+    return USB_EBADPARM;
+}
+
 usbError usbCtlSetAddress(usbCtlSetupPacket *bufPtr)
 {
     if ((bufPtr->data > (unsigned)0) && (bufPtr->data < (unsigned)128)) {
@@ -199,17 +445,55 @@ usbError usbCtlSetAddress(usbCtlSetupPacket *bufPtr)
     }
 }
 
+/* Vendor and class requests are passed to the application, event is the
+   callback to call */
+usbError usbCtlAppRequest(usbCtlSetupPacket *bufPtr, usbCallbackEvent event)
+{
+    usbCtlRequest req;
+    usbError ret;
+
+    req.setup = bufPtr;
+    req.source = USB_CTL_FROM_RAM;
+    req.data = 0;
+    req.size = 0;
+
+    ret = usbiCallback(event, (void *)&req);
+    if (USB_SUCCESS != ret) {
+        printf("ctl: App request failed, rt=%d r=%d ret=%d\r\n",
+               bufPtr->type.requestType, bufPtr->request, ret);
+        return ret;
+    }
+
+    if (USB_CTL_DIR_IN == bufPtr->type.dir) {
+        ctlState.dataSource = req.source;
+        ctlState.dataPtr = req.data;
+        ctlState.bytesToTransfer = MIN((int)bufPtr->length, req.size);
+        ctlState.state = USB_CTL_DATA;
+    } else if (0 != bufPtr->length) {
+        /* Control write, the data goes to the buffer set by the callback */
+        if ((0 == req.data) || (req.size < (int)bufPtr->length)) {
+            printf("ctl: No room for request data, r=%d\r\n", bufPtr->request);
+            return USB_ENOMEM;
+        }
+        ctlState.setup = *bufPtr;
+        ctlState.dataSource = USB_CTL_FROM_RAM;
+        ctlState.dataPtr = req.data;
+        ctlState.bytesToTransfer = bufPtr->length;
+        ctlState.outSync = USB_DTS_DATA1;
+        ctlState.state = USB_CTL_DATA;
+    }
+    return USB_SUCCESS;
+}
+
 usbError usbCtlHandleSetup(void)
 {
     usbCtlSetupPacket *bufPtr;
     int size;
     usbError ret = USB_SUCCESS;
 
-    ret = usbBdGetBuf(ctlState.outHandle, (char **)&bufPtr, &size);
-    if (USB_SUCCESS != ret) {
-        printf("ctl: GetBuf Failed\r\n");
-        return ret;
-    }
+    /* The Setup packet has just been received, the CPU owns the BD */
+    bufPtr = (usbCtlSetupPacket *)usbBdFastBuf(ctlState.outHandle);
+    size = usbBdFastCount(ctlState.outHandle);
     if (sizeof(usbCtlSetupPacket) != (unsigned int)size) {
         printf("ctl: Bad Setup Packet, size=%d\r\n", size);
         return USB_EBADDATA;
@@ -226,6 +510,12 @@ usbError usbCtlHandleSetup(void)
         case USB_CTL_STD_SET_ADDRESS:
             ret = usbCtlSetAddress(bufPtr);
             break;
+        case USB_CTL_STD_SET_FEATURE:
+            ret = usbCtlSetFeature(bufPtr, 1);
+            break;
+        case USB_CTL_STD_CLEAR_FEATURE:
+            ret = usbCtlSetFeature(bufPtr, 0);
+            break;
         case USB_CTL_STD_GET_DESCRIPTOR:
             ret = usbCtlGetDescriptor(bufPtr);
             break;
@@ -236,6 +526,19 @@ usbError usbCtlHandleSetup(void)
             printf("ctl: Not Handled, r=%d\r\n", bufPtr->request);
         }
         break;
+    case USB_CTL_REQ_CLASS:
+        ret = usbCtlAppRequest(bufPtr, USB_CB_CLASS_REQUEST);
+        break;
+    case USB_CTL_REQ_VENDOR:
+#if (USB_CFG_MSOS20_VENDOR_CODE != 0)
+        if ((USB_CFG_MSOS20_VENDOR_CODE == bufPtr->request) &&
+            (USB_CTL_MSOS20_DESCRIPTOR_INDEX == bufPtr->index)) {
+            ret = usbCtlGetMsOs20Descriptor(bufPtr);
+            break;
+        }
+#endif
+        ret = usbCtlAppRequest(bufPtr, USB_CB_VENDOR_REQUEST);
+        break;
     default:
         printf("ctl: Not Handled, rt=%d, r=%d\r\n", bufPtr->type.requestType,
                bufPtr->request);
@@ -248,12 +551,33 @@ usbError usbCtlHandleSetup(void)
 usbError usbCtlLoadBufAndSend(char *buf, int bufSize)
 {
     int sizeToSend = MIN(bufSize, ctlState.bytesToTransfer);
-    if (USB_CTL_FROM_ROM == ctlState.dataSource) {
-        memcpypgm2ram((void *)buf, (void *)ctlState.dataPtr, sizeToSend);
-    } else {
-        memcpy((void *)buf, (void *)ctlState.dataPtr, sizeToSend);
+    int i;
+
+    switch (ctlState.dataSource) {
+    case USB_CTL_FROM_ROM:
+        memcpypgm2ram((void *)buf, (void *)(ctlState.dataPtr + ctlState.dataOffset),
+                      sizeToSend);
+        break;
+    case USB_CTL_FROM_RAM:
+        memcpy((void *)buf, (void *)(ctlState.dataPtr + ctlState.dataOffset),
+               sizeToSend);
+        break;
+    case USB_CTL_FROM_FRAGMENTS:
+        usbCtlCopyFragments((const rom usbCtlFragment *)ctlState.dataPtr,
+                            ctlState.stringSize, ctlState.descType,
+                            ctlState.descSize, ctlState.dataOffset, buf,
+                            sizeToSend);
+        break;
+    default:
+        /* Strings are expanded straight into the EP0 buffer */
+        for (i = 0; i < sizeToSend; i++) {
+            buf[i] = usbCtlGetStringByte(ctlState.dataOffset + i);
+        }
+        break;
     }
-    return usbBdSend(ctlState.inHandle, sizeToSend);
+    /* bufSize is the size of the IN buffer, so the data always fits */
+    usbBdFastSend(ctlState.inHandle, sizeToSend);
+    return USB_SUCCESS;
 }
 
 void usbCtlHandleIn(void)
@@ -264,8 +588,9 @@ void usbCtlHandleIn(void)
     switch (ctlState.state) {
     case USB_CTL_DATA:
         if (USB_CTL_DIR_IN == ctlState.dir) {
-            usbBdGetSent(ctlState.inHandle, &sentSize);
-            usbBdGetBuf(ctlState.inHandle, &buf, &bufSize);
+            sentSize = usbBdFastCount(ctlState.inHandle);
+            buf = usbBdFastBuf(ctlState.inHandle);
+            bufSize = usbBdGetSize(ctlState.inHandle);
             if (sentSize < bufSize) {
                 if (sentSize == ctlState.bytesToTransfer) {
                     /* Data stage complete */
@@ -277,13 +602,13 @@ void usbCtlHandleIn(void)
                     printf("ctl: Unexpected condition\r\n");
                     ctlState.state = USB_CTL_SETUP;
                 }
-                usbBdStall(ctlState.inHandle);
+                usbBdFastStall(ctlState.inHandle);
                 return;
             }
 
             /* Data stage continues, more data or 0-length packet to send */
             ctlState.bytesToTransfer = ctlState.bytesToTransfer - sentSize;
-            ctlState.dataPtr = ctlState.dataPtr + sentSize;
+            ctlState.dataOffset = ctlState.dataOffset + sentSize;
 
             if (USB_SUCCESS != usbCtlLoadBufAndSend(buf, bufSize)) {
                 printf("ctl: Send failed\r\n");
@@ -314,24 +639,64 @@ void usbCtlHandleIn(void)
     case USB_CTL_SETUP:
         /* Wrong state of the transfer, SETUP should always start on OUT EP */
         printf("ctl: Stalling\r\n");
-        usbBdStall(ctlState.inHandle);
+        usbBdFastStall(ctlState.inHandle);
     }
 }
 
-void usbCtlHandleOut(void)
+/* Data stage of a control write: store a packet. Returns non-zero while
+   more data is expected. */
+char usbCtlReceiveData(char *buf, int size)
 {
-    char *buf;
-    int size;
+    usbCtlRequest req;
 
-    if (USB_SUCCESS != usbBdGetBuf(ctlState.outHandle, &buf, &size)) {
-        printf("ctl: HandleOut GetBuf failed");
+    size = MIN(size, ctlState.bytesToTransfer);
+    memcpy((void *)(ctlState.dataPtr + ctlState.dataOffset), (void *)buf, size);
+    ctlState.dataOffset = ctlState.dataOffset + size;
+    ctlState.bytesToTransfer = ctlState.bytesToTransfer - size;
+    ctlState.outSync = (USB_DTS_DATA0 == ctlState.outSync) ? USB_DTS_DATA1 : USB_DTS_DATA0;
+
+    /* A short packet also ends the data stage */
+    if ((0 != ctlState.bytesToTransfer) && (USB_CFG_EP0_BUFFER_SIZE == size)) {
+        return 1;
+    }
+
+    /* Last packet, hand the data to the application */
+    req.setup = &ctlState.setup;
+    req.source = USB_CTL_FROM_RAM;
+    req.data = ctlState.dataPtr;
+    req.size = ctlState.dataOffset;
+    if (USB_SUCCESS != usbiCallback(USB_CB_VENDOR_DATA, (void *)&req)) {
+        printf("ctl: Vendor data rejected, r=%d\r\n", ctlState.setup.request);
+        ctlState.state = USB_CTL_SETUP;
+        usbBdFastStall(ctlState.inHandle);
+        return 0;
+    }
+
+    /* Status stage: zero-length IN packet. The IN BD has stayed with the
+       CPU during the data stage, and stays there (NAK) while the
+       application holds the status stage. */
+    ctlState.state = USB_CTL_STATUS;
+    if (ctlState.statusDeferred) {
+        return 0;
     }
+    usbBdFastSetSync(ctlState.inHandle, USB_DTS_ON, USB_DTS_DATA1);
+    usbBdFastSend(ctlState.inHandle, 0);
+    return 0;
+}
+
+void usbCtlHandleOut(void)
+{
+    char *buf = usbBdFastBuf(ctlState.outHandle);
+    int size = usbBdFastCount(ctlState.outHandle);
 
     switch (ctlState.state) {
     case USB_CTL_DATA:
         if (USB_CTL_DIR_OUT == ctlState.dir) {
-            printf("ctl: TODO HandleOut\r\n");
-            /* TODO */
+            if (usbCtlReceiveData(buf, size)) {
+                usbBdFastSetSync(ctlState.outHandle, USB_DTS_ON, ctlState.outSync);
+                usbBdFastReceive(ctlState.outHandle);
+                return;
+            }
         } else {
             /* Premature end of IN control transfer */
             printf("ctl: IN Aborted\r\n");
@@ -346,53 +711,56 @@ void usbCtlHandleOut(void)
             ctlState.state = USB_CTL_SETUP;        
         } 
     }
-    usbBdStall(ctlState.outHandle);
+    usbBdFastStall(ctlState.outHandle);
 }
 
 usbError usbCtlHandleTransaction(usbBdHandle bdHandle)
 {
-    int size;
     char *buf;
-    char pid;
 
-    if (0 != usbBdGetEndpoint(bdHandle)) {
+    if (0 != usbBdFastEndpoint(bdHandle)) {
         return USB_ENOIMP;
     }
 
+    /* bdHandle is the BD of a completed transaction, owned by the CPU */
     if (ctlState.inHandle == bdHandle) {
         usbCtlHandleIn();
     } else {
-        usbBdGetPID(bdHandle, &pid);
-        if (USB_PID_SETUP == pid) {
+        if (USB_PID_SETUP == usbBdFastPID(bdHandle)) {
             /* A new control transfer is starting */
             usbCtlAbortTransaction();
             if (USB_SUCCESS != usbCtlHandleSetup()) {
-                usbBdStall(ctlState.outHandle);
+                usbBdFastStall(ctlState.outHandle);
             } else {
                 /* Initialize the endpoints, corresponding to stage */
                 usbBdClaim(ctlState.inHandle);
                 if (USB_CTL_DATA == ctlState.state) {
                     if (USB_CTL_DIR_IN == ctlState.dir) {
                         /* Load the IN endpoint with data */
-                        usbBdGetBuf(ctlState.inHandle, &buf, &size);
-                        usbBdSetSync(ctlState.inHandle, USB_DTS_ON, USB_DTS_DATA1);
-                        if (USB_SUCCESS != usbCtlLoadBufAndSend(buf, size)) {
+                        buf = usbBdFastBuf(ctlState.inHandle);
+                        usbBdFastSetSync(ctlState.inHandle, USB_DTS_ON, USB_DTS_DATA1);
+                        if (USB_SUCCESS != usbCtlLoadBufAndSend(buf,
+                                               usbBdGetSize(ctlState.inHandle))) {
                             printf("ctl: Send failed\r\n");
                         }
-                    } else {
-                        printf("ctl: 328\r\n");
-                        /* ? */
                     }
+                    /* For a control write, the IN endpoint stays with the
+                       CPU (NAK) until the data stage is complete */
                     /* The OUT endpoint must be ready to accept status or
                        next SETUP token */
-                    usbBdSetSync(ctlState.outHandle, USB_DTS_ON, USB_DTS_DATA1);
-                    usbBdReceive(ctlState.outHandle);
+                    usbBdFastSetSync(ctlState.outHandle, USB_DTS_ON, USB_DTS_DATA1);
+                    usbBdFastReceive(ctlState.outHandle);
                 } else {
                     /* Control write with no data stage. Prepare the in endpoint
-                       to acknowledge the write, stall the out endpoint to
-                       accept the next SETUP token */
-                    usbBdSend(ctlState.inHandle, 0);
-                    usbBdStall(ctlState.outHandle);
+                       to acknowledge the write, unless the application holds
+                       the status stage, stall the out endpoint to accept the
+                       next SETUP token */
+                    if (ctlState.statusDeferred) {
+                        ctlState.state = USB_CTL_STATUS;
+                    } else {
+                        usbBdFastSend(ctlState.inHandle, 0);
+                    }
+                    usbBdFastStall(ctlState.outHandle);
                 }
             }
             UCONbits.PKTDIS = 0; /* was set when the setup token was received */
@@ -403,7 +771,35 @@ usbError usbCtlHandleTransaction(usbBdHandle bdHandle)
     return USB_SUCCESS;
 }
 
+void usbCtlDeferStatus(void)
+{
+    ctlState.statusDeferred = 1;
+}
+
+void usbCtlFinishStatus(usbError ret)
+{
+    if (!ctlState.statusDeferred) {
+        /* The host has moved on to another control transfer */
+        return;
+    }
+    ctlState.statusDeferred = 0;
+
+    if (USB_SUCCESS != ret) {
+        printf("ctl: Deferred request failed\r\n");
+        ctlState.state = USB_CTL_SETUP;
+        usbBdFastStall(ctlState.inHandle);
+        return;
+    }
+    usbBdFastSetSync(ctlState.inHandle, USB_DTS_ON, USB_DTS_DATA1);
+    usbBdFastSend(ctlState.inHandle, 0);
+}
+
 void usbCtlSetPowerState(usbPowerState powerState)
 {
     ctlState.powerState = powerState;
 }
+
+char usbCtlGetRemoteWakeup(void)
+{
+    return ctlState.remoteWakeup;
+}
@@ -6,13 +6,82 @@
 #include "usb.h"
 #include "usb_bd.h"
 
+/** Where the data stage of a control read comes from */
+typedef enum {
+    USB_CTL_FROM_ROM,
+    USB_CTL_FROM_RAM,
+    /** String descriptor from 8-bit text in ROM, expanded to UTF-16LE as it
+        is sent. The size is the number of characters. */
+    USB_CTL_FROM_ROM_STRING,
+    /** String descriptor made of the hex digits of data EEPROM bytes, e.g.
+        a serial number. data is the EEPROM address and the size is the
+        number of bytes, each one giving two characters. */
+    USB_CTL_FROM_EEPROM_HEX,
+    /** Descriptor made of a list of usbCtlFragment in ROM, sent one after
+        the other. The size is the number of fragments. */
+    USB_CTL_FROM_FRAGMENTS
+} usbCtlSource;
+
+/** A descriptor. source may be left out of an initializer, which makes it
+    USB_CTL_FROM_ROM. */
 typedef struct {
     char type;
     char index;
     int totalSize;
     char *data;
+    usbCtlSource source;
 } usbCtlDescriptor;
 
+/** A piece of a USB_CTL_FROM_FRAGMENTS descriptor
+
+    Fragments let a descriptor be put together from ROM blocks shared by
+    several descriptors (e.g. one block per interface of a composite
+    configuration) and RAM blocks the application changes at runtime.
+    Packets are filled straight from the fragments, across their
+    boundaries. source is USB_CTL_FROM_ROM or USB_CTL_FROM_RAM.
+
+    In configuration and BOS descriptors, wTotalLength (bytes 2-3) is
+    filled in with the sum of the fragment sizes, whatever the first
+    fragment holds there. */
+typedef struct {
+    usbCtlSource source;
+    char *data;
+    int size;
+} usbCtlFragment;
+
+/** Request Type bitfield in a Setup packet */
+typedef struct {
+    unsigned recipient:5;
+    unsigned requestType:2;
+    unsigned dir:1;
+} usbCtlRequestType;
+
+/** Setup packet structure */
+typedef struct {
+    usbCtlRequestType type;
+    unsigned char request;
+    unsigned int data;
+    unsigned int index;
+    unsigned int length;
+} usbCtlSetupPacket;
+
+/** A request handled by the application (USB_CB_VENDOR_REQUEST,
+    USB_CB_CLASS_REQUEST, USB_CB_VENDOR_DATA) */
+typedef struct {
+    const usbCtlSetupPacket *setup; /**< The received Setup packet */
+    usbCtlSource source; /**< Set by the callback: memory type of data */
+    /** Set by the callback: data to return to the host, or the RAM buffer
+        for the data sent by the host */
+    char *data;
+    int size; /**< Set by the callback: size of data */
+} usbCtlRequest;
+
+/** Pseudo descriptor type of the Microsoft OS 2.0 descriptor set in the
+    descriptor list. The set is not read with GET_DESCRIPTOR but with a
+    vendor request, see USB_CFG_MSOS20_VENDOR_CODE; type 0 is reserved by
+    the USB spec, so it cannot clash with a real descriptor. */
+#define USB_CTL_DESC_MSOS20 0
+
 /** The descriptor list
    
     This is a symbol you must define in your program. Without the list
@@ -23,12 +92,37 @@ typedef struct {
 extern const rom usbCtlDescriptor usbCtlDescriptorList[];
 extern const rom char usbCtlDescriptorCount;
 
+/** Find a descriptor by type and index, in the application's
+    USB_CB_GET_DESCRIPTOR callback first, then in usbCtlDescriptorList */
+usbError usbCtlFindDescriptor(usbCtlDescriptor *desc);
+
+/** Read a byte of a ROM, RAM or fragment list descriptor */
+unsigned char usbCtlDescriptorByte(const usbCtlDescriptor *desc, int offset);
+
+/** Read a byte of the data EEPROM */
+unsigned char usbCtlReadEeprom(unsigned char address);
+
 /** Initialize the control transactions state */
 void usbCtlInit(void);
 
+/** Hold the status stage of the current control write, called from its
+    USB_CB_VENDOR_REQUEST (no data stage) or USB_CB_VENDOR_DATA callback.
+    The host is NAKed until usbCtlFinishStatus() is called, so slow work
+    can be done from a task instead of the callback. */
+void usbCtlDeferStatus(void);
+
+/** Finish a status stage held by usbCtlDeferStatus(): acknowledged if ret
+    is USB_SUCCESS, stalled otherwise. Ignored if the host has started
+    another control transfer in the meantime. */
+void usbCtlFinishStatus(usbError ret);
+
 /** Tell the ctl handler whether the device is self-powered or bus-powered */
 void usbCtlSetPowerState(usbPowerState powerState);
 
+/** Non-zero if the host has enabled remote wakeup (SET_FEATURE). Cleared
+    by a bus reset. */
+char usbCtlGetRemoteWakeup(void);
+
 /** Process a EP0 transaction that may be a part of control transfer */
 usbError usbCtlHandleTransaction(usbBdHandle bdHandle);
 
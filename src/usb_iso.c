@@ -0,0 +1,205 @@
+/* USB Isochronous endpoint implementation */
+
+/* Each endpoint keeps track of the BD the SIE is going to use next
+   (next). The SIE alternates between the even and the odd BD, and so do
+   we. On Start-of-Frame:
+
+   IN  - every BD owned by the CPU, starting at next, has been sent:
+         refill and arm it. In steady state one packet is sent per frame
+         and the other one stays queued. If both were owned by the CPU,
+         the SIE ran out of packets (underrun). The first Start-of-Frame
+         fills both.
+   OUT - every BD owned by the CPU, starting at next, holds a received
+         packet: pass it to the callback and arm it again. If both were
+         owned by the CPU, the SIE had no buffer for the last frame
+         (overrun).
+*/
+
+#include <p18f2550.h>
+#include <stdio.h>
+
+#include "usb_iso.h"
+#include "usb_bd.h"
+
+#if (USB_CFG_NUM_ISO > 0)
+
+typedef struct {
+    char endpoint; /**< 0 if this entry is not used */
+    usbBdHandle next; /**< The BD the SIE uses next */
+    usbIsoCallback callback;
+    char primed; /**< IN: both packets have been queued since start */
+    usbIsoStats stats;
+} usbIsoEndpoint;
+
+static usbIsoEndpoint usbIsoEndpoints[USB_CFG_NUM_ISO];
+
+usbIsoEndpoint *usbIsoFind(char endpoint, usbEndpointDirection dir)
+{
+    char i;
+    usbIsoEndpoint *iso = usbIsoEndpoints;
+
+    for (i = 0; i < USB_CFG_NUM_ISO; i++) {
+        if ((endpoint == iso->endpoint) &&
+            (dir == usbBdGetDirection(iso->next))) {
+            return iso;
+        }
+        iso++;
+    }
+    return 0;
+}
+
+usbError usbIsoOpen(char endpoint, usbEndpointDirection dir,
+                    usbIsoCallback callback)
+{
+    usbIsoEndpoint *iso;
+
+    if ((0 == endpoint) || (endpoint >= USB_CFG_NUM_ENDPOINTS) ||
+        (0 == callback)) {
+        return USB_EBADPARM;
+    }
+
+    /* Unused entries have endpoint 0 */
+    iso = usbIsoEndpoints;
+    while (0 != iso->endpoint) {
+        iso++;
+        if (iso == usbIsoEndpoints + USB_CFG_NUM_ISO) {
+            printf("iso: No free entries\r\n");
+            return USB_ENOMEM;
+        }
+    }
+
+    iso->endpoint = endpoint;
+    (void) usbBdGetHandleForEndpoint(endpoint, dir, &iso->next);
+    iso->callback = callback;
+    iso->stats.underruns = 0;
+    iso->stats.overruns = 0;
+    return USB_SUCCESS;
+}
+
+usbError usbIsoGetStats(char endpoint, usbEndpointDirection dir,
+                        usbIsoStats *stats)
+{
+    usbIsoEndpoint *iso = usbIsoFind(endpoint, dir);
+
+    if ((0 == endpoint) || (0 == iso)) {
+        return USB_EBADPARM;
+    }
+    *stats = iso->stats;
+    return USB_SUCCESS;
+}
+
+char usbIsoIsIsoEndpoint(char endpoint)
+{
+    return (0 != endpoint) && ((0 != usbIsoFind(endpoint, USB_ED_OUT)) ||
+                               (0 != usbIsoFind(endpoint, USB_ED_IN)));
+}
+
+/* Arm a BD for an isochronous transfer. Isochronous packets are always
+   DATA0 and are never acknowledged. */
+void usbIsoArm(usbIsoEndpoint *iso, usbBdHandle handle, int size)
+{
+    (void) usbBdSetSync(handle, USB_DTS_OFF, USB_DTS_DATA0);
+    if (USB_ED_IN == usbBdGetDirection(handle)) {
+        (void) usbBdSend(handle, size);
+    } else {
+        (void) usbBdReceive(handle);
+    }
+}
+
+void usbIsoStart(void)
+{
+    char i;
+    usbIsoEndpoint *iso = usbIsoEndpoints;
+    usbBdHandle even;
+    char *buf;
+    int size;
+
+    /* UEPn has been set up from the endpoint descriptors */
+    for (i = 0; i < USB_CFG_NUM_ISO; i++) {
+        if (0 != iso->endpoint) {
+            (void) usbBdGetHandleForEndpoint(iso->endpoint,
+                                             usbBdGetDirection(iso->next),
+                                             &even);
+            (void) usbBdClaim(even);
+            (void) usbBdClaim(usbBdGetPingPong(even));
+            iso->next = even;
+            iso->primed = 0;
+
+            /* Not declared by this configuration, no buffers */
+            if (USB_SUCCESS != usbBdGetBuf(even, &buf, &size)) {
+                /* Nothing to do */
+            } else if (USB_ED_OUT == usbBdGetDirection(even)) {
+                /* Both buffers are ready to receive from the first frame */
+                usbIsoArm(iso, even, 0);
+                usbIsoArm(iso, usbBdGetPingPong(even), 0);
+            }
+            /* IN buffers are filled on Start-of-Frame */
+        }
+        iso++;
+    }
+
+    UIRbits.SOFIF = 0;
+    UIEbits.SOFIE = 1;
+}
+
+void usbIsoStop(void)
+{
+    UIEbits.SOFIE = 0;
+}
+
+void usbIsoRefillIn(usbIsoEndpoint *iso)
+{
+    char *buf;
+    int size;
+    char filled = 0;
+
+    while (USB_SUCCESS == usbBdGetBuf(iso->next, &buf, &size)) {
+        if ((1 == filled) && iso->primed) {
+            /* Both packets were sent, the SIE ran dry */
+            iso->stats.underruns++;
+        }
+        /* For an IN BD, size is the max packet size */
+        iso->callback(buf, &size);
+        usbIsoArm(iso, iso->next, size);
+        iso->next = usbBdGetPingPong(iso->next);
+        filled++;
+    }
+    iso->primed = 1;
+}
+
+void usbIsoDrainOut(usbIsoEndpoint *iso)
+{
+    char *buf;
+    int size;
+    char drained = 0;
+
+    while (USB_SUCCESS == usbBdGetBuf(iso->next, &buf, &size)) {
+        iso->callback(buf, &size);
+        usbIsoArm(iso, iso->next, 0);
+        iso->next = usbBdGetPingPong(iso->next);
+        drained++;
+        if (2 == drained) {
+            iso->stats.overruns++;
+            break;
+        }
+    }
+}
+
+void usbIsoHandleSof(void)
+{
+    char i;
+    usbIsoEndpoint *iso = usbIsoEndpoints;
+
+    for (i = 0; i < USB_CFG_NUM_ISO; i++) {
+        if (0 != iso->endpoint) {
+            if (USB_ED_IN == usbBdGetDirection(iso->next)) {
+                usbIsoRefillIn(iso);
+            } else {
+                usbIsoDrainOut(iso);
+            }
+        }
+        iso++;
+    }
+}
+
+#endif /* USB_CFG_NUM_ISO */
@@ -0,0 +1,82 @@
+/** USB Isochronous endpoint header
+
+    Isochronous endpoints move one packet per 1 ms frame, with no
+    handshakes and no retries. The stack calls the endpoint's callback
+    once per frame, on Start-of-Frame: for an IN endpoint, the callback
+    fills the next packet; for an OUT endpoint, it consumes the packet
+    received in the previous frame.
+
+    Isochronous endpoints require ping-pong buffering
+    (USB_CFG_PPB_ALL_BUT_EP0): the SIE streams from one BD while the other
+    one is refilled. An endpoint number used for isochronous transfers
+    should not be used for other transfer types in the other direction,
+    since UEPn handshaking is shared by both directions.
+*/
+
+#ifndef USB_ISO_H
+#define USB_ISO_H
+
+#include "usb.h"
+#include "usb_config.h"
+
+/** Max isochronous packet size, defined by USB spec. The USB RAM of the
+    2550 limits the actual size much further, as both ping-pong buffers
+    must fit. */
+#define USB_ISO_MAX_PACKET_SIZE 1023
+
+/** Per-frame callback.
+
+    For an IN endpoint, size is the max packet size on entry and the
+    callback sets it to the number of bytes it wrote to buf (0 sends a
+    zero-length packet). For an OUT endpoint, buf and size describe the
+    received packet. */
+typedef void (*usbIsoCallback)(char *buf, int *size);
+
+/** Streaming error counters */
+typedef struct {
+    unsigned int underruns; /**< IN: frames with no packet ready to send */
+    unsigned int overruns; /**< OUT: frames with no buffer ready to receive */
+} usbIsoStats;
+
+#if (USB_CFG_NUM_ISO > 0)
+
+#if (USB_CFG_PING_PONG != USB_CFG_PPB_ALL_BUT_EP0)
+#error "Isochronous endpoints need USB_CFG_PPB_ALL_BUT_EP0"
+#endif
+
+/** Open an isochronous endpoint
+
+    The buffers are allocated from the endpoint descriptor when the device
+    is configured, and the endpoint starts streaming then. An endpoint the
+    active configuration does not declare stays idle. */
+usbError usbIsoOpen(char endpoint, usbEndpointDirection dir,
+                    usbIsoCallback callback);
+
+/** Get the error counters of an isochronous endpoint */
+usbError usbIsoGetStats(char endpoint, usbEndpointDirection dir,
+                        usbIsoStats *stats);
+
+/* The following functions are internal to the USB library */
+
+/** Enable the isochronous endpoints, called once configured */
+void usbIsoStart(void);
+
+/** Disable the isochronous endpoints */
+void usbIsoStop(void);
+
+/** Refill IN and drain OUT buffers, called on every Start-of-Frame */
+void usbIsoHandleSof(void);
+
+/** Returns non-zero if the endpoint is isochronous */
+char usbIsoIsIsoEndpoint(char endpoint);
+
+#else
+
+#define usbIsoStart()
+#define usbIsoStop()
+#define usbIsoHandleSof()
+#define usbIsoIsIsoEndpoint(endpoint) 0
+
+#endif /* USB_CFG_NUM_ISO */
+
+#endif /* USB_ISO_H */
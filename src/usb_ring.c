@@ -0,0 +1,248 @@
+/* USB OUT ring implementation */
+
+/* Slots are taken in order: next is the next slot to point a BD at, tail
+   the oldest slot the application holds. The slots from tail to next are
+   in use, held by the application or pointed at by an armed BD; the
+   armed ones are always the newest. A BD that completes while no slot is
+   free is left with the CPU ("waiting") and armed again on release. The
+   SIE fills ping-pong BDs in turn, so head, the BD the SIE fills next,
+   is followed by the other armed BD, then by the waiting ones. */
+
+#include <p18f2550.h>
+#include <stdio.h>
+
+#include "usb_ring.h"
+#include "usb_bd.h"
+
+#if (USB_CFG_NUM_RINGS > 0)
+
+typedef struct {
+    char endpoint; /**< 0 if this entry is not used */
+    char *slots;
+    unsigned char mask; /**< Number of slots - 1 */
+    unsigned char slotSize;
+    unsigned char next; /**< Next slot to point a BD at */
+    unsigned char tail; /**< Oldest slot held by the application */
+    unsigned char held; /**< Slots held by the application */
+    char started; /**< The device is configured */
+    char halted;
+    usbBdHandle head; /**< The BD the SIE fills next */
+    unsigned char waiting; /**< BDs left with the CPU */
+    usbBdSyncVal sync; /**< Data toggle of the next BD armed */
+    usbRingConsume consume;
+    usbRingStats stats;
+} usbRing;
+
+static usbRing usbRings[USB_CFG_NUM_RINGS];
+static char usbRingCount;
+
+#define USB_RING_IN_USE(ring) ((unsigned char)((ring)->next - (ring)->tail))
+#define USB_RING_HAS_FREE(ring) (USB_RING_IN_USE(ring) <= (ring)->mask)
+
+usbRing *usbRingFind(char endpoint)
+{
+    char i;
+
+    for (i = 0; i < usbRingCount; i++) {
+        if (endpoint == usbRings[i].endpoint) {
+            return &usbRings[i];
+        }
+    }
+    return 0;
+}
+
+/* Number of BDs of the ring's endpoint */
+unsigned char usbRingBdCount(usbRing *ring)
+{
+    return (usbBdGetPingPong(ring->head) != ring->head) ? 2 : 1;
+}
+
+usbError usbRingOpen(char endpoint, char *slots, unsigned char count,
+                     unsigned char slotSize, usbRingConsume consume)
+{
+    usbRing *ring;
+
+    if ((0 == endpoint) || (endpoint >= USB_CFG_NUM_ENDPOINTS) ||
+        (0 == consume) || (0 != usbRingFind(endpoint)) ||
+        (0 == count) || (count > 128) || (0 != (count & (count - 1))) ||
+        ((unsigned int)slots < USB_CFG_RING_RAM_START) ||
+        ((unsigned int)slots + (unsigned int)count * slotSize > 0x800)) {
+        return USB_EBADPARM;
+    }
+    if (usbRingCount >= USB_CFG_NUM_RINGS) {
+        printf("ring: No free entries\r\n");
+        return USB_ENOMEM;
+    }
+
+    ring = &usbRings[usbRingCount++];
+    ring->endpoint = endpoint;
+    ring->slots = slots;
+    ring->mask = count - 1;
+    ring->slotSize = slotSize;
+    ring->consume = consume;
+    ring->started = 0;
+    return USB_SUCCESS;
+}
+
+/* Point a BD owned by the CPU at the next slot and hand it to the SIE */
+void usbRingArm(usbRing *ring, usbBdHandle handle)
+{
+    usbBdFastSetBuf(handle, ring->slots +
+                    (unsigned int)(ring->next & ring->mask) * ring->slotSize);
+    usbBdFastSetSync(handle, USB_DTS_ON, ring->sync);
+    usbBdFastReceive(handle);
+    ring->sync = (USB_DTS_DATA0 == ring->sync) ? USB_DTS_DATA1 : USB_DTS_DATA0;
+    ring->next++;
+}
+
+/* Arm every BD of the endpoint, from head, while there are free slots */
+void usbRingArmAll(usbRing *ring)
+{
+    usbBdHandle handle = ring->head;
+
+    ring->waiting = 0;
+    do {
+        if (USB_RING_HAS_FREE(ring)) {
+            usbRingArm(ring, handle);
+        } else {
+            ring->waiting++;
+        }
+        handle = usbBdGetPingPong(handle);
+    } while (handle != ring->head);
+}
+
+void usbRingStart(void)
+{
+    char i;
+    usbRing *ring = usbRings;
+
+    for (i = 0; i < usbRingCount; i++) {
+        (void) usbBdGetHandleForEndpoint(ring->endpoint, USB_ED_OUT, &ring->head);
+        if (!usbBdFastIsSetUp(ring->head)) {
+            /* Not part of this configuration */
+            ring++;
+            continue;
+        }
+        if (usbBdGetSize(ring->head) > ring->slotSize) {
+            printf("ring: EP%d slots too small\r\n", (int)ring->endpoint);
+            ring++;
+            continue;
+        }
+        ring->next = 0;
+        ring->tail = 0;
+        ring->held = 0;
+        ring->halted = 0;
+        ring->sync = USB_DTS_DATA0;
+        usbRingArmAll(ring);
+        ring->started = 1;
+        ring++;
+    }
+}
+
+void usbRingStop(void)
+{
+    char i;
+
+    for (i = 0; i < usbRingCount; i++) {
+        usbRings[i].started = 0;
+    }
+}
+
+char usbRingHandleTransaction(usbBdHandle handle)
+{
+    usbRing *ring;
+    char *slot;
+    int size;
+
+    if (USB_ED_OUT != usbBdFastDirection(handle)) {
+        return 0;
+    }
+    ring = usbRingFind(usbBdFastEndpoint(handle));
+    if (0 == ring) {
+        return 0;
+    }
+    if (!ring->started || ring->halted) {
+        /* Completed as the endpoint was being halted, dropped */
+        return 1;
+    }
+
+    slot = usbBdFastBuf(handle);
+    size = usbBdFastCount(handle);
+    ring->head = usbBdGetPingPong(handle);
+    ring->held++;
+    ring->stats.packets++;
+
+    /* Re-arm first, the host may already be sending the next packet */
+    if (USB_RING_HAS_FREE(ring)) {
+        usbRingArm(ring, handle);
+    } else {
+        ring->waiting++;
+        ring->stats.full++;
+    }
+
+    ring->consume(slot, size);
+    return 1;
+}
+
+usbError usbRingRelease(char endpoint)
+{
+    usbRing *ring = usbRingFind(endpoint);
+    usbBdHandle handle;
+
+    if (0 == ring) {
+        return USB_EBADPARM;
+    }
+    if (!ring->started || (0 == ring->held)) {
+        return USB_EBADSTATE;
+    }
+    ring->held--;
+    ring->tail++;
+
+    if (!ring->halted && (0 != ring->waiting)) {
+        /* The first waiting BD comes after the armed ones */
+        handle = (ring->waiting == usbRingBdCount(ring)) ?
+                 ring->head : usbBdGetPingPong(ring->head);
+        usbRingArm(ring, handle);
+        ring->waiting--;
+    }
+    return USB_SUCCESS;
+}
+
+void usbRingHalt(char endpoint)
+{
+    usbRing *ring = usbRingFind(endpoint);
+
+    if ((0 == ring) || !ring->started || ring->halted) {
+        return;
+    }
+
+    /* The slots of the armed BDs are the newest, they are taken back */
+    ring->next -= usbRingBdCount(ring) - ring->waiting;
+    ring->waiting = usbRingBdCount(ring);
+    ring->halted = 1;
+}
+
+void usbRingRestart(char endpoint)
+{
+    usbRing *ring = usbRingFind(endpoint);
+
+    if ((0 == ring) || !ring->started) {
+        return;
+    }
+    ring->halted = 0;
+    ring->sync = USB_DTS_DATA0;
+    usbRingArmAll(ring);
+}
+
+usbError usbRingGetStats(char endpoint, usbRingStats *stats)
+{
+    usbRing *ring = usbRingFind(endpoint);
+
+    if (0 == ring) {
+        return USB_EBADPARM;
+    }
+    *stats = ring->stats;
+    return USB_SUCCESS;
+}
+
+#endif /* USB_CFG_NUM_RINGS */
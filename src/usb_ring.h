@@ -0,0 +1,86 @@
+/** USB OUT ring header
+
+    A ring is a host-to-device stream on its own bulk or interrupt OUT
+    endpoint, received without copying. The application provides a ring
+    of packet-sized slots in USB RAM (USB_CFG_RING_RAM_START); the
+    endpoint's BDs are pointed at free slots instead of their own buffer.
+
+    When a packet has been received, the BD is re-pointed at the next free
+    slot and handed back to the SIE at once, then the filled slot is
+    passed to the application's consume callback. The application reads
+    the data in place, now or later, and gives the slots back in the order
+    it got them with usbRingRelease(). While every slot is held by the
+    application, the BD stays with the CPU and the host is NAKed; the
+    endpoint is re-armed as soon as a slot is released.
+
+    Transactions on ring endpoints are not passed to the
+    USB_CB_TRANSACTION callback. A halt of the endpoint keeps the slots
+    the application holds; the ring restarts at DATA0 when the halt is
+    cleared.
+*/
+
+#ifndef USB_RING_H
+#define USB_RING_H
+
+#include "usb.h"
+#include "usb_bd.h"
+#include "usb_config.h"
+
+/** Consume callback, called from the USB task with a received packet.
+    The slot belongs to the application until it is released. */
+typedef void (*usbRingConsume)(char *slot, int size);
+
+/** Ring counters */
+typedef struct {
+    unsigned long packets; /**< Packets received */
+    unsigned int full; /**< Times the host was NAKed, every slot was held */
+} usbRingStats;
+
+#if (USB_CFG_NUM_RINGS > 0)
+
+/** Open a ring on an OUT endpoint
+
+    count slots of slotSize bytes each, back to back from slots, in USB
+    RAM from USB_CFG_RING_RAM_START. count is a power of 2 up to 128, and
+    slotSize at least the endpoint's max packet size. The ring starts when
+    the device is configured; if the configuration does not declare the
+    endpoint, it stays idle. */
+usbError usbRingOpen(char endpoint, char *slots, unsigned char count,
+                     unsigned char slotSize, usbRingConsume consume);
+
+/** Give back the oldest slot passed to the consume callback */
+usbError usbRingRelease(char endpoint);
+
+/** Get the counters of a ring */
+usbError usbRingGetStats(char endpoint, usbRingStats *stats);
+
+/* The following functions are internal to the USB library */
+
+/** Point the BDs at the first slots and arm them, called once the
+    endpoints are set up */
+void usbRingStart(void);
+
+/** Stop the rings, their endpoints are going away */
+void usbRingStop(void);
+
+/** Handle a completed OUT transaction. Returns non-zero if the BD
+    belongs to a ring. */
+char usbRingHandleTransaction(usbBdHandle handle);
+
+/** The endpoint of a ring is about to be halted */
+void usbRingHalt(char endpoint);
+
+/** The halt of the endpoint has been cleared: restart at DATA0 */
+void usbRingRestart(char endpoint);
+
+#else
+
+#define usbRingStart()
+#define usbRingStop()
+#define usbRingHandleTransaction(handle) 0
+#define usbRingHalt(endpoint)
+#define usbRingRestart(endpoint)
+
+#endif /* USB_CFG_NUM_RINGS */
+
+#endif /* USB_RING_H */
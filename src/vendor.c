@@ -0,0 +1,124 @@
+/* Vendor bulk interface implementation */
+
+/* OUT packets are received into the slots of an OUT ring (usb_ring.h),
+   the IN channel's fill callback copies the oldest one to the IN BD and
+   gives its slot back. While every slot waits for the IN endpoint, the
+   host is NAKed, which throttles it to the rate it reads back. */
+
+#include <p18f2550.h>
+
+#include "vendor.h"
+#include "usb_chan.h"
+#include "usb_ring.h"
+
+#include "string.h"
+
+#ifdef PROTO_VENDOR_ENDPOINT
+
+#if (VND_CFG_RING_SLOTS * PROTO_VENDOR_PACKET_SIZE > USB_CFG_RING_RAM_BYTES)
+#error "The vendor ring does not fit in USB_CFG_RING_RAM_BYTES"
+#endif
+
+/* #pragma udata takes a literal address */
+#if (USB_CFG_RING_RAM_START != 0x700)
+#error "Update the address of vnd_ring to USB_CFG_RING_RAM_START"
+#endif
+
+/* The ring slots, at USB_CFG_RING_RAM_START */
+#pragma udata vnd_ring=0x700
+static char vndRing[VND_CFG_RING_SLOTS][PROTO_VENDOR_PACKET_SIZE];
+#pragma udata
+
+typedef struct {
+    char *slots[VND_CFG_RING_SLOTS]; /**< Received packets, oldest first */
+    unsigned char sizes[VND_CFG_RING_SLOTS];
+    unsigned char first;
+    unsigned char count;
+    vndStats stats;
+} vndInternalState;
+
+static vndInternalState vndState;
+
+usbError vndFill(char *buf, int *size);
+void vndConsume(char *slot, int size);
+
+usbError vndInit(void)
+{
+    usbError ret;
+
+    (void) memset((void *)&vndState, 0, sizeof(vndState));
+    ret = usbRingOpen(VND_CFG_ENDPOINT, &vndRing[0][0], VND_CFG_RING_SLOTS,
+                      PROTO_VENDOR_PACKET_SIZE, vndConsume);
+    if (USB_SUCCESS != ret) {
+        return ret;
+    }
+    return usbChanOpen(VND_CFG_ENDPOINT, VND_CFG_PRIORITY, vndFill);
+}
+
+void vndStart(void)
+{
+    /* The ring starts over empty */
+    vndState.first = 0;
+    vndState.count = 0;
+}
+
+/* OUT ring consume callback: queue the packet for the IN channel */
+void vndConsume(char *slot, int size)
+{
+    unsigned char i = (vndState.first + vndState.count) & (VND_CFG_RING_SLOTS - 1);
+
+    vndState.slots[i] = slot;
+    vndState.sizes[i] = (unsigned char)size;
+    vndState.count++;
+    (void) usbChanReady(VND_CFG_ENDPOINT);
+}
+
+usbError vndHandleTransaction(usbBdHandle handle)
+{
+    if (VND_CFG_ENDPOINT != usbBdGetEndpoint(handle)) {
+        return USB_EBADPARM;
+    }
+    /* Only IN completions get here, they belong to the channel */
+    return USB_SUCCESS;
+}
+
+/* IN channel fill callback: the oldest packet in the ring */
+usbError vndFill(char *buf, int *size)
+{
+    int count;
+
+    if (0 == vndState.count) {
+        return USB_EBADSTATE;
+    }
+
+    count = vndState.sizes[vndState.first];
+    if (count > *size) {
+        count = *size;
+    }
+    memcpy((void *)buf, (void *)vndState.slots[vndState.first], count);
+    *size = count;
+    vndState.stats.packets++;
+    vndState.stats.bytes += count;
+
+    vndState.first = (vndState.first + 1) & (VND_CFG_RING_SLOTS - 1);
+    vndState.count--;
+    (void) usbRingRelease(VND_CFG_ENDPOINT);
+    return USB_SUCCESS;
+}
+
+usbError vndEndpointReset(usbBdHandle handle)
+{
+    if (VND_CFG_ENDPOINT != usbBdGetEndpoint(handle)) {
+        return USB_EBADPARM;
+    }
+    /* The ring re-arms the OUT endpoint itself and keeps the packets
+       queued, the IN channel restarts with them */
+    return USB_SUCCESS;
+}
+
+void vndGetStats(vndStats *stats)
+{
+    *stats = vndState.stats;
+}
+
+#endif /* PROTO_VENDOR_ENDPOINT */
@@ -0,0 +1,77 @@
+/** Vendor bulk interface header
+
+    A vendor-specific interface with a bulk IN and OUT endpoint, next to
+    the HID interface. On Windows, the Microsoft OS 2.0 descriptors bind
+    it to WinUSB, so applications open it by the device interface GUID
+    (PROTO_VENDOR_GUID) without installing a driver; elsewhere it is
+    reached with libusb.
+
+    Every OUT packet is sent back as is on the IN endpoint (loopback), so
+    a host can check the bulk path and measure its throughput. OUT
+    packets are received without copying into a ring of
+    VND_CFG_RING_SLOTS slots (usb_ring.h) and wait there until the IN
+    channel has taken them; the host is NAKed while the ring is full.
+
+    The interface is part of the configuration when tools/protocol.schema
+    has a vendor line (PROTO_VENDOR_ENDPOINT). Without it, the functions
+    below are empty macros.
+
+    Typical use: vndInit() at startup, vndStart() once the device is
+    configured, vndHandleTransaction() from the USB_CB_TRANSACTION
+    callback and vndEndpointReset() from the USB_CB_ENDPOINT_RESET
+    callback.
+*/
+
+#ifndef VENDOR_H
+#define VENDOR_H
+
+#include "usb.h"
+#include "usb_bd.h"
+#include "protocol.h"
+
+#ifdef PROTO_VENDOR_ENDPOINT
+
+/** Endpoint pair of the interface, from the schema */
+#define VND_CFG_ENDPOINT PROTO_VENDOR_ENDPOINT
+
+/** IN channel priority, after the HID reports and the mass storage */
+#define VND_CFG_PRIORITY 2
+
+/** Number of OUT ring slots, a power of 2. Besides the slot armed in the
+    BD, three packets can wait for the IN endpoint before the host is
+    NAKed. They fill USB_CFG_RING_RAM_BYTES. */
+#define VND_CFG_RING_SLOTS 4
+
+/** Vendor interface counters */
+typedef struct {
+    unsigned long packets; /**< Packets looped back */
+    unsigned long bytes;
+} vndStats;
+
+/** Open the OUT ring and the IN channel */
+usbError vndInit(void);
+
+/** Empty the packet queue, called once configured */
+void vndStart(void);
+
+/** Handle a transaction on the interface's endpoints. Returns
+    USB_EBADPARM if the handle is not one of them. */
+usbError vndHandleTransaction(usbBdHandle handle);
+
+/** Called once the halt of an endpoint of the interface is cleared.
+    Returns USB_EBADPARM if the handle is not one of them. */
+usbError vndEndpointReset(usbBdHandle handle);
+
+/** Get the vendor interface counters */
+void vndGetStats(vndStats *stats);
+
+#else
+
+#define vndInit() (USB_SUCCESS)
+#define vndStart()
+#define vndHandleTransaction(handle) (USB_EBADPARM)
+#define vndEndpointReset(handle) (USB_EBADPARM)
+
+#endif /* PROTO_VENDOR_ENDPOINT */
+
+#endif /* VENDOR_H */
@@ -0,0 +1,642 @@
+#!/usr/bin/env python3
+"""Protocol schema compiler
+
+Reads tools/protocol.schema and generates, so that the firmware and the
+host cannot drift apart:
+
+  src/protocol_gen.h       field, profile and report size constants, the
+                           HID report descriptor of every profile, the
+                           configuration descriptor fragments (header,
+                           interfaces, per-profile endpoints), the
+                           Microsoft OS 2.0 descriptor set of the vendor
+                           interface, and PROTO_PACK_SAMPLE/
+                           PROTO_UNPACK_SAMPLE, unrolled packers for the
+                           sample feature report
+  host/protocol_decode.h   the matching C++ unpacker and field metadata
+
+The sample feature report packs the fields back to back, LSB first, each
+in its schema width; only the last byte is padded. The HID descriptor
+describes every field exactly (REPORT_SIZE, logical and physical range,
+unit exponent), so generic HID tools can read it too.
+
+Usage: tools/protogen.py [schema]
+"""
+
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SCHEMA = os.path.join(ROOT, 'tools', 'protocol.schema')
+C_OUT = os.path.join(ROOT, 'src', 'protocol_gen.h')
+HOST_OUT = os.path.join(ROOT, 'host', 'protocol_decode.h')
+
+MAX_FIELDS = 8  # The change bits of a sample fit in a byte (report.c)
+MAX_REPORT_SIZE = 64  # Full-speed interrupt endpoint
+MAX_BULK_SIZE = 64  # Full-speed bulk endpoint
+HID_ENDPOINT = 1
+USAGE_FIELD_BASE = 0x10  # Vendor usages of the feature report fields
+GUID_RE = re.compile(r'^\{[0-9A-F]{8}-[0-9A-F]{4}-[0-9A-F]{4}-[0-9A-F]{4}-'
+                     r'[0-9A-F]{12}\}$', re.I)
+
+
+class SchemaError(Exception):
+    pass
+
+
+class Field(object):
+    def __init__(self, name, bits, signed, scale, unit):
+        self.name = name
+        self.bits = bits
+        self.signed = signed
+        self.scale = scale
+        self.unit = unit
+
+    @property
+    def logical_range(self):
+        if self.signed:
+            return -(1 << (self.bits - 1)), (1 << (self.bits - 1)) - 1
+        return 0, (1 << self.bits) - 1
+
+
+def parse(path):
+    fields, profiles, command, msc, vendor = [], [], None, None, None
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            words = line.split('#', 1)[0].split()
+            if not words:
+                continue
+            where = '%s:%d' % (path, lineno)
+            try:
+                if words[0] == 'field' and len(words) in (5, 6):
+                    bits = int(words[2])
+                    if not 1 <= bits <= 16:
+                        raise SchemaError('%s: width must be 1-16' % where)
+                    if words[3] not in ('signed', 'unsigned'):
+                        raise SchemaError('%s: signed or unsigned' % where)
+                    fields.append(Field(words[1], bits, words[3] == 'signed',
+                                        float(words[4]),
+                                        words[5] if len(words) == 6 else ''))
+                elif words[0] == 'profile' and len(words) == 4:
+                    size, interval = int(words[2]), int(words[3])
+                    if not 1 <= size <= MAX_REPORT_SIZE:
+                        raise SchemaError('%s: report size must be 1-%d'
+                                          % (where, MAX_REPORT_SIZE))
+                    if not 1 <= interval <= 255:
+                        raise SchemaError('%s: interval must be 1-255' % where)
+                    profiles.append((words[1].upper(), size, interval))
+                elif words[0] == 'command' and len(words) == 2:
+                    command = int(words[1])
+                    if not 1 <= command <= MAX_REPORT_SIZE:
+                        raise SchemaError('%s: report size must be 1-%d'
+                                          % (where, MAX_REPORT_SIZE))
+                elif words[0] == 'msc' and len(words) == 3:
+                    endpoint, size = int(words[1]), int(words[2])
+                    if not 1 <= endpoint <= 15 or endpoint == HID_ENDPOINT:
+                        raise SchemaError('%s: endpoint must be 2-15' % where)
+                    if size not in (8, 16, 32, 64):
+                        raise SchemaError('%s: packet size must be 8, 16, 32 '
+                                          'or 64' % where)
+                    msc = (endpoint, size)
+                elif words[0] == 'vendor' and len(words) == 4:
+                    endpoint, size = int(words[1]), int(words[2])
+                    if not 1 <= endpoint <= 15 or endpoint == HID_ENDPOINT:
+                        raise SchemaError('%s: endpoint must be 2-15' % where)
+                    if size not in (8, 16, 32, 64):
+                        raise SchemaError('%s: packet size must be 8, 16, 32 '
+                                          'or 64' % where)
+                    if not GUID_RE.match(words[3]):
+                        raise SchemaError('%s: GUID must be written '
+                                          '{xxxxxxxx-xxxx-xxxx-xxxx-'
+                                          'xxxxxxxxxxxx}' % where)
+                    vendor = (endpoint, size, words[3].upper())
+                else:
+                    raise SchemaError('%s: cannot parse "%s"'
+                                      % (where, line.strip()))
+            except ValueError:
+                raise SchemaError('%s: bad number' % where)
+
+    if not fields or len(fields) > MAX_FIELDS:
+        raise SchemaError('%s: 1-%d fields needed' % (path, MAX_FIELDS))
+    if not profiles:
+        raise SchemaError('%s: no profile' % path)
+    if command is None:
+        raise SchemaError('%s: no command report size' % path)
+    if msc and vendor and msc[0] == vendor[0]:
+        raise SchemaError('%s: msc and vendor share an endpoint' % path)
+    return fields, profiles, command, msc, vendor
+
+
+# HID report descriptor items, HID 1.11 section 6.2.2
+
+def value_bytes(value, signed):
+    """Little-endian data of a short item, in the fewest bytes"""
+    for size in (1, 2, 4):
+        bits = size * 8
+        if signed:
+            fits = -(1 << (bits - 1)) <= value < (1 << (bits - 1))
+        else:
+            fits = 0 <= value < (1 << bits)
+        if fits:
+            value &= (1 << bits) - 1
+            return [(value >> (8 * i)) & 0xFF for i in range(size)]
+    raise SchemaError('item value %d out of range' % value)
+
+
+def item(prefix, value, signed, comment):
+    data = value_bytes(value, signed)
+    return ([prefix | {1: 1, 2: 2, 4: 3}[len(data)]] + data, comment)
+
+
+def usage_page(v, c):
+    return item(0x04, v, False, 'USAGE_PAGE (%s)' % c)
+
+
+def usage(v):
+    return item(0x08, v, False, 'USAGE (Vendor Usage %d)' % v)
+
+
+def logical_min(v):
+    return item(0x14, v, True, 'LOGICAL_MINIMUM (%d)' % v)
+
+
+def logical_max(v):
+    return item(0x24, v, True, 'LOGICAL_MAXIMUM (%d)' % v)
+
+
+def physical_min(v):
+    return item(0x34, v, True, 'PHYSICAL_MINIMUM (%d)' % v)
+
+
+def physical_max(v):
+    return item(0x44, v, True, 'PHYSICAL_MAXIMUM (%d)' % v)
+
+
+def unit_exponent(v):
+    return item(0x54, v & 0x0F, False, 'UNIT_EXPONENT (%d)' % v)
+
+
+def report_size(v):
+    return item(0x74, v, False, 'REPORT_SIZE (%d)' % v)
+
+
+def report_count(v):
+    return item(0x94, v, False, 'REPORT_COUNT (%d)' % v)
+
+
+def decimal_exponent(scale):
+    """Smallest k so that scale * 10^k is an integer"""
+    for k in range(8):
+        scaled = scale * 10 ** k
+        if abs(scaled - round(scaled)) < 1e-9 * max(1.0, scaled):
+            return k
+    raise SchemaError('scale %g needs too many digits' % scale)
+
+
+def report_descriptor(fields, report_bytes, command_bytes):
+    d = [usage_page(0xFF00, 'Vendor Defined Page 1'),
+         usage(1),
+         ([0xA1, 0x01], 'COLLECTION (Application)'),
+         # Telemetry and probe replies, opaque bytes (protocol.h)
+         usage(2),
+         logical_min(0),
+         logical_max(255),
+         report_count(report_bytes),
+         report_size(8),
+         ([0x81, 0x02], 'INPUT (Data,Var,Abs)'),
+         # Commands
+         usage(3),
+         report_count(command_bytes),
+         ([0x91, 0x02], 'OUTPUT (Data,Var,Abs)')]
+
+    # Sample feature report, every field in its own width
+    for i, f in enumerate(fields):
+        lmin, lmax = f.logical_range
+        if f.scale == 1:
+            # Physical range 0..0 means the same as the logical range
+            pmin = pmax = exp = 0
+        else:
+            k = decimal_exponent(f.scale)
+            pmin = int(round(lmin * f.scale * 10 ** k))
+            pmax = int(round(lmax * f.scale * 10 ** k))
+            exp = -k
+        d += [usage(USAGE_FIELD_BASE + i),
+              logical_min(lmin),
+              logical_max(lmax),
+              physical_min(pmin),
+              physical_max(pmax),
+              unit_exponent(exp),
+              report_size(f.bits),
+              report_count(1),
+              ([0xB1, 0x02], 'FEATURE (Data,Var,Abs) %s' % f.name)]
+    pad = -sum(f.bits for f in fields) % 8
+    if pad:
+        d += [report_size(pad),
+              ([0xB1, 0x03], 'FEATURE (Cnst,Var,Abs) padding')]
+
+    d.append(([0xC0], 'END_COLLECTION'))
+    return d
+
+
+# The configuration descriptor is sent as a list of fragments (see
+# usbCtlFragment in src/usb_ctl.h): the header, the HID interface, the
+# endpoints of each profile, the mass storage interface and the vendor
+# interface. The firmware fills in the total size.
+
+def vendor_interface_number(msc):
+    return 2 if msc else 1
+
+
+def configuration_header(msc, vendor):
+    interfaces = 1 + (1 if msc else 0) + (1 if vendor else 0)
+    return [([9], 'Size in bytes'),
+            ([2], 'Configuration Descriptor'),
+            ([0, 0], 'Total size in bytes, filled in when sent'),
+            ([interfaces], 'Number of interfaces'),
+            ([1], 'Configuration index'),
+            ([0], 'Configuration string'),
+            ([0x60], 'Self-powered, remote wakeup'),
+            ([50], '100 mA power consumption')]
+
+
+def hid_interface(report_descriptor_size):
+    return [([9], 'Size in bytes'),
+            ([4], 'Interface Descriptor'),
+            ([0], 'Interface number'),
+            ([0], 'Alternate setting number'),
+            ([2], 'Number of endpoints, excluding EP0'),
+            ([3], 'HID Class'),
+            ([0], 'Subclass'),
+            ([0], 'Protocol'),
+            ([0], 'Interface string'),
+
+            ([9], 'Size in bytes'),
+            ([0x21], 'HID Descriptor'),
+            ([0x01, 0x01], 'HID 1.1 Compliant'),
+            ([0], 'Country code (0 = not localized)'),
+            ([1], 'Number of subordinate descriptors'),
+            ([0x22], 'Descriptor type (report)'),
+            (le16(report_descriptor_size), 'Report descriptor size in bytes')]
+
+
+def hid_endpoints(report_bytes, interval, command_bytes):
+    return [([7], 'Size in bytes'),
+            ([5], 'Endpoint Descriptor'),
+            ([0x81], 'Endpoint and direction. Bit 7: OUT=0, IN=1'),
+            ([3], '0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt'),
+            (le16(report_bytes), 'Max packet size (0-1023)'),
+            ([interval], 'Max polling latency, ms for Interrupt'),
+
+            ([7], 'Size in bytes'),
+            ([5], 'Endpoint Descriptor'),
+            ([0x01], 'Endpoint and direction. Bit 7: OUT=0, IN=1'),
+            ([3], '0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt'),
+            (le16(command_bytes), 'Max packet size (0-1023)'),
+            ([interval], 'Max polling latency, ms for Interrupt')]
+
+
+def bulk_endpoints(endpoint, size):
+    return [([7], 'Size in bytes'),
+            ([5], 'Endpoint Descriptor'),
+            ([0x80 | endpoint], 'Endpoint and direction. Bit 7: OUT=0, IN=1'),
+            ([2], '0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt'),
+            (le16(size), 'Max packet size (0-1023)'),
+            ([0], 'Polling interval, unused for Bulk'),
+
+            ([7], 'Size in bytes'),
+            ([5], 'Endpoint Descriptor'),
+            ([endpoint], 'Endpoint and direction. Bit 7: OUT=0, IN=1'),
+            ([2], '0=Control, 1=Isochronous, 2=Bulk, 3=Interrupt'),
+            (le16(size), 'Max packet size (0-1023)'),
+            ([0], 'Polling interval, unused for Bulk')]
+
+
+def msc_interface(msc):
+    endpoint, size = msc
+    return [([9], 'Size in bytes'),
+            ([4], 'Interface Descriptor'),
+            ([1], 'Interface number'),
+            ([0], 'Alternate setting number'),
+            ([2], 'Number of endpoints, excluding EP0'),
+            ([8], 'Mass Storage Class'),
+            ([6], 'SCSI transparent command set'),
+            ([0x50], 'Bulk-Only Transport'),
+            ([0], 'Interface string')] + bulk_endpoints(endpoint, size)
+
+
+def vendor_interface(msc, vendor):
+    endpoint, size, _ = vendor
+    return [([9], 'Size in bytes'),
+            ([4], 'Interface Descriptor'),
+            ([vendor_interface_number(msc)], 'Interface number'),
+            ([0], 'Alternate setting number'),
+            ([2], 'Number of endpoints, excluding EP0'),
+            ([0xFF], 'Vendor Specific Class'),
+            ([0], 'Subclass'),
+            ([0], 'Protocol'),
+            ([0], 'Interface string')] + bulk_endpoints(endpoint, size)
+
+
+# Microsoft OS 2.0 descriptor set (Microsoft OS 2.0 Descriptors
+# Specification): binds the vendor interface to WinUSB and gives it a
+# device interface GUID, so Windows needs no INF. The device is a
+# composite, so the set holds a function subset for the interface.
+
+MSOS20_WINDOWS_VERSION = [0x00, 0x00, 0x03, 0x06]  # Windows 8.1
+
+
+def utf16z(text):
+    return [b for c in text for b in (ord(c), 0)] + [0, 0]
+
+
+def msos20_descriptor_set(msc, vendor):
+    name = utf16z('DeviceInterfaceGUIDs')
+    # REG_MULTI_SZ: the GUID, then an empty string ending the list
+    data = utf16z(vendor[2]) + [0, 0]
+    registry = [(le16(10 + len(name) + len(data)), 'Size in bytes'),
+                (le16(4), 'MS_OS_20_FEATURE_REG_PROPERTY'),
+                (le16(7), 'REG_MULTI_SZ'),
+                (le16(len(name)), 'Property name size in bytes'),
+                (name, 'DeviceInterfaceGUIDs'),
+                (le16(len(data)), 'Property data size in bytes'),
+                (data, vendor[2])]
+    compatible = [(le16(20), 'Size in bytes'),
+                  (le16(3), 'MS_OS_20_FEATURE_COMPATIBLE_ID'),
+                  ([ord(c) for c in 'WINUSB'] + [0, 0], 'Compatible ID'),
+                  ([0] * 8, 'Sub-compatible ID')]
+    function = [(le16(8), 'Size in bytes'),
+                (le16(2), 'MS_OS_20_SUBSET_HEADER_FUNCTION'),
+                ([vendor_interface_number(msc)], 'First interface'),
+                ([0], 'Reserved'),
+                (le16(8 + size_of(compatible) + size_of(registry)),
+                 'Function subset size in bytes')]
+    config_size = 8 + size_of(function) + size_of(compatible) + \
+        size_of(registry)
+    configuration = [(le16(8), 'Size in bytes'),
+                     (le16(1), 'MS_OS_20_SUBSET_HEADER_CONFIGURATION'),
+                     ([0], 'Configuration index'),
+                     ([0], 'Reserved'),
+                     (le16(config_size), 'Configuration subset size in bytes')]
+    header = [(le16(10), 'Size in bytes'),
+              (le16(0), 'MS_OS_20_SET_HEADER_DESCRIPTOR'),
+              (MSOS20_WINDOWS_VERSION, 'Windows version'),
+              (le16(10 + config_size), 'Total size in bytes')]
+    return header + configuration + function + compatible + registry
+
+
+def le16(v):
+    return [v & 0xFF, v >> 8]
+
+
+def size_of(desc):
+    return sum(len(b) for b, _ in desc)
+
+
+def c_macro(name, desc):
+    lines = ['#define %s \\' % name, '{ \\']
+    items = []
+    for i, (data, comment) in enumerate(desc):
+        # Long items (strings) are split on several lines
+        for j in range(0, len(data), 8):
+            text = ', '.join('0x%02X' % b for b in data[j:j + 8])
+            if (i != len(desc) - 1) or (j + 8 < len(data)):
+                text += ','
+            items.append((text, comment if j == 0 else ''))
+    width = max(len(t) for t, _ in items)
+    for text, comment in items:
+        if comment:
+            lines.append('    %-*s /* %s */ \\' % (width, text, comment))
+        else:
+            lines.append('    %-*s \\' % (width, text))
+    lines.append('}')
+    return '\n'.join(lines)
+
+
+def pack_layout(fields):
+    """Bit offset of every field in the packed sample"""
+    offsets, pos = [], 0
+    for f in fields:
+        offsets.append(pos)
+        pos += f.bits
+    return offsets, pos
+
+
+def byte_pieces(fields, offsets, nbytes):
+    """For every byte of the packed sample, the field bits it holds:
+       (field index, shift within the field, mask, shift within the byte)"""
+    pieces = []
+    for k in range(nbytes):
+        byte = []
+        for i, f in enumerate(fields):
+            lo = max(offsets[i], 8 * k)
+            hi = min(offsets[i] + f.bits, 8 * k + 8)
+            if lo < hi:
+                byte.append((i, lo - offsets[i], (1 << (hi - lo)) - 1,
+                             lo - 8 * k))
+        pieces.append(byte)
+    return pieces
+
+
+def unpack_expr(f, offset, byte):
+    """Expression of the raw field value, from the bytes of a packed
+       sample; byte is the format of a byte access"""
+    first, last = offset // 8, (offset + f.bits - 1) // 8
+    terms = []
+    for k in range(first, last + 1):
+        shift = 8 * k - offset
+        if shift < 0:
+            terms.append('(%s >> %d)' % (byte % k, -shift))
+        elif shift:
+            terms.append('(%s << %d)' % (byte % k, shift))
+        else:
+            terms.append(byte % k)
+    expr = ' | '.join(terms)
+    if f.bits < 8 * (last - first + 1) or offset % 8:
+        expr = '(%s) & 0x%X' % (expr, (1 << f.bits) - 1)
+    return expr
+
+
+def sign_extend(f, v):
+    if f.signed and f.bits < 16:
+        return '((%s ^ 0x%X) - 0x%X)' % (v, 1 << (f.bits - 1),
+                                         1 << (f.bits - 1))
+    return v
+
+
+def c_unpack_macro(fields, offsets):
+    lines = ['#define PROTO_UNPACK_SAMPLE(s, buf) \\', '    do { \\']
+    for i, f in enumerate(fields):
+        v = '(%s)' % unpack_expr(
+            f, offsets[i], '(unsigned int)(unsigned char)(buf)[%d]')
+        lines.append('        (s)->field[%d] = (short)%s; \\'
+                     % (i, sign_extend(f, v)))
+    lines.append('    } while (0)')
+    return '\n'.join(lines)
+
+
+def c_pack_macro(fields, pieces):
+    lines = ['#define PROTO_PACK_SAMPLE(buf, s) \\', '    do { \\']
+    for k, byte in enumerate(pieces):
+        terms = []
+        for i, src_shift, mask, dst_shift in byte:
+            t = '(unsigned int)(s)->field[%d]' % i
+            if src_shift:
+                t = '(%s >> %d)' % (t, src_shift)
+            if mask != 0xFF or dst_shift:
+                t = '(%s & 0x%02X)' % (t, mask)
+            if dst_shift:
+                t = '(%s << %d)' % (t, dst_shift)
+            terms.append(t)
+        lines.append('        (buf)[%d] = (unsigned char)(%s); \\'
+                     % (k, ' | '.join(terms)))
+    lines.append('    } while (0)')
+    return '\n'.join(lines)
+
+
+HEADER = 'Generated by tools/protogen.py from tools/protocol.schema, do not edit'
+
+
+def generate_c(fields, profiles, command, msc, vendor):
+    offsets, bits = pack_layout(fields)
+    nbytes = (bits + 7) // 8
+    reports = [report_descriptor(fields, size, command)
+               for _, size, _ in profiles]
+    rsize = size_of(reports[0])
+
+    out = ['/** %s */' % HEADER, '',
+           '#ifndef PROTOCOL_GEN_H', '#define PROTOCOL_GEN_H', '',
+           '/** Number of telemetry fields in a sample */',
+           '#define PROTO_NUM_FIELDS %d' % len(fields), '',
+           '/* Telemetry fields, index into statusType.field */']
+    for i, f in enumerate(fields):
+        out.append('#define PROTO_FIELD_%s %d /**< %d bits, %s, %g %s */'
+                   % (f.name.upper(), i, f.bits,
+                      'signed' if f.signed else 'unsigned', f.scale,
+                      f.unit or 'raw'))
+    out += ['', '/* Report profiles, the first one is the default */']
+    for i, (name, size, interval) in enumerate(profiles):
+        out += ['#define PROTO_PROFILE_%s %d /**< %d-byte reports every %d ms */'
+                % (name, i, size, interval),
+                '#define PROTO_%s_REPORT_SIZE %d' % (name, size),
+                '#define PROTO_%s_INTERVAL_MS %d' % (name, interval)]
+    out += ['#define PROTO_NUM_PROFILES %d' % len(profiles), '',
+            '/** Largest interrupt IN report of all profiles */',
+            '#define PROTO_MAX_REPORT_SIZE %d'
+            % max(size for _, size, _ in profiles), '',
+            '/** Size of an interrupt OUT report */',
+            '#define PROTO_CMD_REPORT_SIZE %d' % command, '']
+    if msc:
+        out += ['/** Mass storage interface (Bulk-Only Transport) and its bulk',
+                '    IN and OUT endpoint */',
+                '#define PROTO_MSC_INTERFACE 1',
+                '#define PROTO_MSC_ENDPOINT %d' % msc[0],
+                '#define PROTO_MSC_PACKET_SIZE %d' % msc[1], '']
+    if vendor:
+        msos = msos20_descriptor_set(msc, vendor)
+        out += ['/** Vendor interface, bound to WinUSB by the Microsoft OS 2.0',
+                '    descriptor set, and its bulk IN and OUT endpoint */',
+                '#define PROTO_VENDOR_INTERFACE %d'
+                % vendor_interface_number(msc),
+                '#define PROTO_VENDOR_ENDPOINT %d' % vendor[0],
+                '#define PROTO_VENDOR_PACKET_SIZE %d' % vendor[1],
+                '/** Device interface GUID of the vendor interface */',
+                '#define PROTO_VENDOR_GUID "%s"' % vendor[2], '']
+    out += [
+            '/** Sample feature report: the fields packed LSB first, in field',
+            '    order, each in its own width */',
+            '#define PROTO_SAMPLE_BITS %d' % bits,
+            '#define PROTO_SAMPLE_SIZE %d' % nbytes, '',
+            '/** Pack a statusType *s into PROTO_SAMPLE_SIZE bytes at buf */',
+            c_pack_macro(fields, byte_pieces(fields, offsets, nbytes)), '',
+            '/** Unpack PROTO_SAMPLE_SIZE bytes at buf into a statusType *s */',
+            c_unpack_macro(fields, offsets), '',
+            '/* Descriptors of every profile. The configuration descriptor is',
+            '   the header, the HID interface, the HID endpoints of the profile',
+            '   and, with mass storage, PROTO_MSC_INTERFACE_DESCRIPTORS, then',
+            '   PROTO_VENDOR_INTERFACE_DESCRIPTORS. */',
+            '#define PROTO_HID_REPORT_DESCRIPTOR_SIZE %d' % rsize, '',
+            c_macro('PROTO_CONFIGURATION_HEADER',
+                    configuration_header(msc, vendor)),
+            '', c_macro('PROTO_HID_INTERFACE', hid_interface(rsize))]
+    if msc:
+        out += ['', c_macro('PROTO_MSC_INTERFACE_DESCRIPTORS',
+                            msc_interface(msc))]
+    if vendor:
+        out += ['', c_macro('PROTO_VENDOR_INTERFACE_DESCRIPTORS',
+                            vendor_interface(msc, vendor)),
+                '', '/** Microsoft OS 2.0 descriptor set, read with a vendor request */',
+                '#define PROTO_MSOS20_DESCRIPTOR_SET_SIZE %d' % size_of(msos),
+                '', c_macro('PROTO_MSOS20_DESCRIPTOR_SET', msos)]
+    for (name, size, interval), report in zip(profiles, reports):
+        out += ['', c_macro('PROTO_HID_REPORT_DESCRIPTOR_%s' % name, report),
+                '', c_macro('PROTO_HID_ENDPOINTS_%s' % name,
+                            hid_endpoints(size, interval, command))]
+    out += ['', '#endif /* PROTOCOL_GEN_H */', '']
+    return '\n'.join(out)
+
+
+def generate_host(fields):
+    offsets, bits = pack_layout(fields)
+    nbytes = (bits + 7) // 8
+    out = ['/** %s */' % HEADER, '',
+           '#ifndef PROTOCOL_DECODE_H', '#define PROTOCOL_DECODE_H', '',
+           'extern "C" {', '#include "protocol.h"', '}', '',
+           'namespace pic18usb {', '',
+           'struct FieldInfo {',
+           '    const char *name;',
+           '    unsigned bits;',
+           '    bool isSigned;',
+           '    double scale; /**< Raw value to unit */',
+           '    const char *unit;',
+           '};', '',
+           'const FieldInfo sampleFields[PROTO_NUM_FIELDS] = {']
+    for f in fields:
+        out.append('    {"%s", %d, %s, %r, "%s"},'
+                   % (f.name, f.bits, 'true' if f.signed else 'false',
+                      f.scale, f.unit))
+    out += ['};', '',
+            '/** Unpack a PROTO_SAMPLE_SIZE-byte sample feature report */',
+            'inline void unpackSample(const unsigned char *buf, statusType &s)',
+            '{',
+            '    unsigned v;']
+    for i, f in enumerate(fields):
+        out.append('    v = %s;' % unpack_expr(f, offsets[i], 'buf[%d]'))
+        out.append('    s.field[%d] = (short)%s;' % (i, sign_extend(f, 'v')))
+    out += ['}', '',
+            '/** A field in its unit */',
+            'inline double scaledField(const statusType &s, unsigned field)',
+            '{',
+            '    const FieldInfo &f = sampleFields[field];',
+            '    int raw = f.isSigned ? s.field[field]',
+            '                         : (unsigned short)s.field[field];',
+            '    return raw * f.scale;',
+            '}', '',
+            '} // namespace pic18usb', '',
+            '#endif /* PROTOCOL_DECODE_H */', '']
+    assert nbytes > 0
+    return '\n'.join(out)
+
+
+def write(path, text):
+    # The sources use CRLF line endings
+    with open(path, 'wb') as f:
+        f.write(text.replace('\n', '\r\n').encode('ascii'))
+    print('wrote %s' % os.path.relpath(path, ROOT))
+
+
+def main(argv):
+    schema = argv[1] if len(argv) > 1 else SCHEMA
+    try:
+        fields, profiles, command, msc, vendor = parse(schema)
+        c_text = generate_c(fields, profiles, command, msc, vendor)
+        host_text = generate_host(fields)
+    except (IOError, SchemaError) as e:
+        sys.stderr.write('protogen: %s\n' % e)
+        return 1
+    write(C_OUT, c_text)
+    write(HOST_OUT, host_text)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))